@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <time.h>
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
@@ -43,6 +44,22 @@ void lsmash_get_mainargs( int *argc, char ***argv )
 }
 #endif
 
+double lsmash_get_wall_clock( void )
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency( &frequency );
+    QueryPerformanceCounter( &counter );
+    return (double)counter.QuadPart / frequency.QuadPart;
+#else
+    struct timespec ts;
+    if( clock_gettime( CLOCK_MONOTONIC, &ts ) != 0 )
+        return 0.0;
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
 int lsmash_write_lsmash_indicator( lsmash_root_t *root )
 {
     /* Write a tag in a free space to indicate the output file is written by L-SMASH. */
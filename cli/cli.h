@@ -39,6 +39,9 @@
 #  define lsmash_get_mainargs( argc, argv ) (void)0
 #endif
 
+/* Get the time of a monotonic clock in seconds to measure elapsed wall-clock time. */
+double lsmash_get_wall_clock( void );
+
 int lsmash_write_lsmash_indicator( lsmash_root_t *root );
 
 int dry_open_file
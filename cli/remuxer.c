@@ -152,12 +152,23 @@ typedef struct
     char                *chap_file;
     uint16_t             default_language;
     uint64_t             max_chunk_size;
+    uint64_t             max_frag_memory;
     uint32_t             max_chunk_duration_in_ms;
     uint32_t             frag_base_track;
     uint32_t             subseg_per_seg;
+    uint32_t             subseg_per_index;
+    uint32_t             frags_per_mfra;
     int                  dash;
     int                  compact_size_table;
+    int                  compact_fragment;
+    int                  defragment;
+    int                  resegment;
+    int                  reserve_moov;
     double               min_frag_duration;
+    double               chunk_duration;
+    uint32_t             num_chunks;
+    double               total_chunk_latency;   /* in seconds of wall-clock time */
+    double               max_chunk_latency;     /* in seconds of wall-clock time */
     int                  dry_run;
 } remuxer_t;
 
@@ -322,13 +333,45 @@ static void display_help( void )
              "  --min-frag-duration <float>\n"
              "      Specify the minimum duration which fragments are allowed to be.\n"
              "      This option requires --fragment.\n"
+             "  --chunk-duration <float>\n"
+             "      Split each fragment into chunks of the specified duration in seconds.\n"
+             "      Each chunk is a pair of moof and mdat for low-latency delivery.\n"
+             "      This option requires --fragment.\n"
              "  --dash <integer>\n"
              "      Enable DASH ISOBMFF-based Media segmentation.\n"
              "      The value is the number of subsegments per segment.\n"
              "      If zero, Indexed self-initializing Media Segment is constructed.\n"
              "      This option requires --fragment.\n"
+             "  --subsegs-per-index <integer>\n"
+             "      Construct a hierarchical segment index if a segment has more subsegments\n"
+             "      than the value, where each lower-level index references this number of\n"
+             "      subsegments at most and is placed in front of them.\n"
+             "      This option requires --dash.\n"
+             "  --max-frag-memory <integer>\n"
+             "      Specify the maximum size in bytes of media data held on memory per\n"
+             "      fragment. Media data beyond it is spilled out into a temporary file.\n"
+             "      This option requires --fragment.\n"
+             "  --frags-per-mfra <integer>\n"
+             "      Write the random access info every time the specified number of movie\n"
+             "      fragments are written so that the incomplete output can be sought.\n"
+             "      This option requires --fragment and is ignored with --dash.\n"
              "  --compact-size-table\n"
              "      Compress sample size tables if possible.\n"
+             "  --compact-fragment\n"
+             "      Minimize the size of each movie fragment header.\n"
+             "      This option requires --fragment.\n"
+             "  --defragment\n"
+             "      Convert a fragmented movie into a non-fragmented movie by copying\n"
+             "      the media data of each track fragment run as a chunk at once.\n"
+             "      This option cannot be used with --fragment or multiple inputs.\n"
+             "  --resegment\n"
+             "      Copy the media data of samples in large blocks by their byte ranges\n"
+             "      in the input file instead of reading each sample.\n"
+             "      This option requires --fragment and cannot be used with multiple inputs.\n"
+             "  --reserve-moov\n"
+             "      Reserve the space for the Movie Box in front of the media data, estimated\n"
+             "      from the input tracks, so that the output need not be rearranged.\n"
+             "      This option cannot be used with --fragment.\n"
              "  --dry-run\n"
              "      Execute as a dry run.\n"
              "Track options:\n"
@@ -778,6 +821,16 @@ static int parse_cli_option( int argc, char **argv, remuxer_t *remuxer )
             else if( remuxer->frag_base_track == 0 )
                 FAILED_PARSE_CLI_OPTION( "--min-frag-duration requires --fragment also be set.\n" );
         }
+        else if( !strcasecmp( argv[i], "--chunk-duration" ) )
+        {
+            if( ++i == argc )
+                FAILED_PARSE_CLI_OPTION( "--chunk-duration requires an argument.\n" );
+            remuxer->chunk_duration = atof( argv[i] );
+            if( remuxer->chunk_duration <= 0.0 )
+                FAILED_PARSE_CLI_OPTION( "%s is an invalid chunk duration.\n", argv[i] );
+            else if( remuxer->frag_base_track == 0 )
+                FAILED_PARSE_CLI_OPTION( "--chunk-duration requires --fragment also be set.\n" );
+        }
         else if( !strcasecmp( argv[i], "--dash" ) )
         {
             if( ++i == argc )
@@ -785,8 +838,50 @@ static int parse_cli_option( int argc, char **argv, remuxer_t *remuxer )
             remuxer->subseg_per_seg = atoi( argv[i] );
             remuxer->dash           = 1;
         }
+        else if( !strcasecmp( argv[i], "--subsegs-per-index" ) )
+        {
+            if( ++i == argc )
+                FAILED_PARSE_CLI_OPTION( "--subsegs-per-index requires an argument.\n" );
+            remuxer->subseg_per_index = atoi( argv[i] );
+            if( remuxer->subseg_per_index == 0 )
+                FAILED_PARSE_CLI_OPTION( "%s is an invalid value for --subsegs-per-index.\n", argv[i] );
+            else if( !remuxer->dash )
+                FAILED_PARSE_CLI_OPTION( "--subsegs-per-index requires --dash also be set.\n" );
+        }
+        else if( !strcasecmp( argv[i], "--max-frag-memory" ) )
+        {
+            if( ++i == argc )
+                FAILED_PARSE_CLI_OPTION( "--max-frag-memory requires an argument.\n" );
+            remuxer->max_frag_memory = strtoull( argv[i], NULL, 10 );
+            if( remuxer->max_frag_memory == 0 )
+                FAILED_PARSE_CLI_OPTION( "%s is an invalid value for --max-frag-memory.\n", argv[i] );
+            else if( remuxer->frag_base_track == 0 )
+                FAILED_PARSE_CLI_OPTION( "--max-frag-memory requires --fragment also be set.\n" );
+        }
+        else if( !strcasecmp( argv[i], "--frags-per-mfra" ) )
+        {
+            if( ++i == argc )
+                FAILED_PARSE_CLI_OPTION( "--frags-per-mfra requires an argument.\n" );
+            remuxer->frags_per_mfra = atoi( argv[i] );
+            if( remuxer->frags_per_mfra == 0 )
+                FAILED_PARSE_CLI_OPTION( "%s is an invalid value for --frags-per-mfra.\n", argv[i] );
+            else if( remuxer->frag_base_track == 0 )
+                FAILED_PARSE_CLI_OPTION( "--frags-per-mfra requires --fragment also be set.\n" );
+        }
         else if( !strcasecmp( argv[i], "--compact-size-table" ) )
             remuxer->compact_size_table = 1;
+        else if( !strcasecmp( argv[i], "--compact-fragment" ) )
+        {
+            if( remuxer->frag_base_track == 0 )
+                FAILED_PARSE_CLI_OPTION( "--compact-fragment requires --fragment also be set.\n" );
+            remuxer->compact_fragment = 1;
+        }
+        else if( !strcasecmp( argv[i], "--defragment" ) )
+            remuxer->defragment = 1;
+        else if( !strcasecmp( argv[i], "--resegment" ) )
+            remuxer->resegment = 1;
+        else if( !strcasecmp( argv[i], "--reserve-moov" ) )
+            remuxer->reserve_moov = 1;
         else if( !strcasecmp( argv[i], "--dry-run" ) )
             remuxer->dry_run = 1;
         else
@@ -794,6 +889,12 @@ static int parse_cli_option( int argc, char **argv, remuxer_t *remuxer )
     }
     if( !remuxer->output->root )
         FAILED_PARSE_CLI_OPTION( "output file name is not specified.\n" );
+    if( remuxer->defragment && (remuxer->frag_base_track || remuxer->num_input > 1) )
+        FAILED_PARSE_CLI_OPTION( "--defragment cannot be used with --fragment or multiple inputs.\n" );
+    if( remuxer->resegment && (remuxer->frag_base_track == 0 || remuxer->num_input > 1) )
+        FAILED_PARSE_CLI_OPTION( "--resegment requires --fragment and cannot be used with multiple inputs.\n" );
+    if( remuxer->reserve_moov && remuxer->frag_base_track )
+        FAILED_PARSE_CLI_OPTION( "--reserve-moov cannot be used with --fragment.\n" );
     /* Parse track options */
     /* Get the current track and media parameters */
     for( int i = 0; i < remuxer->num_input; i++ )
@@ -1005,8 +1106,12 @@ static int set_movie_parameters( remuxer_t *remuxer )
         else
             WARNING_MSG( "--dash requires --fragment.\n" );
     }
-    out_file->param.max_chunk_duration = remuxer->max_chunk_duration_in_ms * 1e-3;
-    out_file->param.max_chunk_size     = remuxer->max_chunk_size;
+    out_file->param.max_chunk_duration       = remuxer->max_chunk_duration_in_ms * 1e-3;
+    out_file->param.max_chunk_size           = remuxer->max_chunk_size;
+    out_file->param.max_fragment_memory      = remuxer->max_frag_memory;
+    out_file->param.subsegments_per_index    = remuxer->subseg_per_index;
+    out_file->param.mfra_checkpoint_interval = remuxer->frags_per_mfra;
+    out_file->param.compact_movie_fragment   = remuxer->compact_fragment;
     replace_with_valid_brand( remuxer );
     if( self_containd_segment )
     {
@@ -1342,6 +1447,15 @@ static int flush_movie_fragment( remuxer_t *remuxer )
     return 0;
 }
 
+/* Record how long, in wall-clock time, the first sample in the chunk just written waited from its append to its output. */
+static void record_chunk_latency( remuxer_t *remuxer, double latency )
+{
+    remuxer->num_chunks          += 1;
+    remuxer->total_chunk_latency += latency;
+    if( remuxer->max_chunk_latency < latency )
+        remuxer->max_chunk_latency = latency;
+}
+
 static int moov_to_front_callback( void *param, uint64_t written_movie_size, uint64_t total_movie_size )
 {
     static uint32_t progress_pos = 0;
@@ -1421,12 +1535,15 @@ static int switch_segment( remuxer_t *remuxer )
         brands[1] = ISOM_BRAND_TYPE_MSIX;
         for( uint32_t i = 0; i < out_file->param.brand_count; i++ )
             brands[i + 2] = out_file->param.brands[i];
-        seg_param.major_brand = ISOM_BRAND_TYPE_MSDH;
-        seg_param.brand_count = brand_count;
-        seg_param.brands      = brands;
-        seg_param.mode        = LSMASH_FILE_MODE_WRITE | LSMASH_FILE_MODE_FRAGMENTED
-                              | LSMASH_FILE_MODE_BOX   | LSMASH_FILE_MODE_MEDIA
-                              | LSMASH_FILE_MODE_INDEX | LSMASH_FILE_MODE_SEGMENT;
+        seg_param.major_brand            = ISOM_BRAND_TYPE_MSDH;
+        seg_param.brand_count            = brand_count;
+        seg_param.brands                 = brands;
+        seg_param.mode                   = LSMASH_FILE_MODE_WRITE | LSMASH_FILE_MODE_FRAGMENTED
+                                         | LSMASH_FILE_MODE_BOX   | LSMASH_FILE_MODE_MEDIA
+                                         | LSMASH_FILE_MODE_INDEX | LSMASH_FILE_MODE_SEGMENT;
+        seg_param.subsegments_per_index  = out_file->param.subsegments_per_index;
+        seg_param.compact_movie_fragment = out_file->param.compact_movie_fragment;
+        seg_param.max_fragment_memory    = out_file->param.max_fragment_memory;
     }
     else
     {
@@ -1490,6 +1607,379 @@ static void adjust_timestamp( output_track_t *out_track, lsmash_sample_t *sample
     }
 }
 
+/* Estimate the size of the Movie Box of a non-fragmented output from the input timelines.
+ * The estimation is rough but tends to exceed the actual size, and the layout doesn't break even if it doesn't. */
+static uint64_t estimate_movie_size( remuxer_t *remuxer )
+{
+    uint64_t movie_size = 4096;
+    for( int i = 0; i < remuxer->num_input; i++ )
+    {
+        input_t       *in       = &remuxer->input[i];
+        input_movie_t *in_movie = &in->file.movie;
+        movie_size += 1024 * (uint64_t)in_movie->num_itunes_metadata;
+        for( uint32_t j = 0; j < in_movie->num_tracks; j++ )
+        {
+            input_track_t *in_track = &in_movie->track[j];
+            if( !in_track->active )
+                continue;
+            uint32_t sample_count = lsmash_get_sample_count_in_media_timeline( in->root, in_track->track_ID );
+            uint64_t max_chunk_duration = (uint64_t)remuxer->max_chunk_duration_in_ms * in_track->media.param.timescale / 1000;
+            uint64_t chunk_dts          = 0;
+            uint64_t chunk_size         = 0;
+            uint64_t prev_dts           = 0;
+            uint64_t prev_delta         = 0;
+            uint64_t prev_offset        = 0;
+            uint32_t prev_length        = 0;
+            uint32_t stts_entry_count   = 0;
+            uint32_t ctts_entry_count   = 0;
+            uint32_t sync_count         = 0;
+            uint32_t chunk_count        = 0;
+            int      constant_size      = 1;
+            int      dependency_present = 0;
+            for( uint32_t sample_number = 1; sample_number <= sample_count; sample_number++ )
+            {
+                lsmash_sample_t sample;
+                if( lsmash_get_sample_info_from_media_timeline( in->root, in_track->track_ID, sample_number, &sample ) < 0 )
+                    return 0;
+                uint64_t offset = sample.cts - sample.dts;
+                if( sample_number == 1 )
+                {
+                    ctts_entry_count = 1;
+                    prev_offset      = offset;
+                    prev_length      = sample.length;
+                }
+                else
+                {
+                    uint64_t delta = sample.dts - prev_dts;
+                    if( stts_entry_count == 0 || delta != prev_delta )
+                        ++stts_entry_count;
+                    if( offset != prev_offset )
+                        ++ctts_entry_count;
+                    if( sample.length != prev_length )
+                        constant_size = 0;
+                    prev_delta  = delta;
+                    prev_offset = offset;
+                }
+                if( sample.prop.ra_flags & ISOM_SAMPLE_RANDOM_ACCESS_FLAG_SYNC )
+                    ++sync_count;
+                if( sample.prop.leading || sample.prop.independent || sample.prop.disposable || sample.prop.redundant )
+                    dependency_present = 1;
+                if( chunk_count == 0
+                 || sample.dts - chunk_dts >= max_chunk_duration
+                 || chunk_size + sample.length > remuxer->max_chunk_size )
+                {
+                    ++chunk_count;
+                    chunk_dts  = sample.dts;
+                    chunk_size = 0;
+                }
+                chunk_size += sample.length;
+                prev_dts    = sample.dts;
+            }
+            /* Chunks may be split more by interleaving, so count them twice. */
+            movie_size += 4096
+                        + 8 * (uint64_t)(stts_entry_count + 1)
+                        + 8 * (uint64_t)ctts_entry_count
+                        + 4 * (uint64_t)(sync_count < sample_count ? sync_count : 0)
+                        + 1 * (uint64_t)(dependency_present ? sample_count : 0)
+                        + 4 * (uint64_t)(constant_size ? 0 : sample_count)
+                        + 2 * (12 + 8) * (uint64_t)chunk_count;
+        }
+    }
+    /* Leave some slack for what is not considered above. */
+    return movie_size + movie_size / 8;
+}
+
+/* Get the next sample of an input track.
+ * If 'by_reference' is set, get only the information of the sample without its data.
+ * Return 1 if got, 0 if reached the end of the media timeline, or -1 if failed. */
+static int get_next_sample( input_t *in, input_track_t *in_track, output_track_t *out_track, int by_reference )
+{
+    lsmash_sample_t *sample;
+    if( by_reference )
+    {
+        sample = lsmash_create_sample( 0 );
+        if( sample
+         && lsmash_get_sample_info_from_media_timeline( in->root, in_track->track_ID, in_track->current_sample_number, sample ) < 0 )
+        {
+            lsmash_delete_sample( sample );
+            sample = NULL;
+        }
+    }
+    else
+        sample = lsmash_get_sample_from_media_timeline( in->root, in_track->track_ID, in_track->current_sample_number );
+    if( sample )
+    {
+        adapt_description_index( out_track, in_track, sample );
+        adjust_timestamp( out_track, sample );
+        in_track->sample = sample;
+        in_track->dts    = (double)sample->dts / in_track->media.param.timescale;
+        return 1;
+    }
+    if( lsmash_check_sample_existence_in_media_timeline( in->root, in_track->track_ID, in_track->current_sample_number ) )
+        return ERROR_MSG( "failed to get a sample.\n" );
+    lsmash_sample_t sample_info = { 0 };
+    if( lsmash_get_sample_info_from_media_timeline( in->root, in_track->track_ID, in_track->current_sample_number, &sample_info ) < 0 )
+    {
+        /* No more appendable samples in this track. */
+        in_track->sample = NULL;
+        in_track->reach_end_of_media_timeline = 1;
+        return 0;
+    }
+    return ERROR_MSG( "failed to get a sample.\n" );
+}
+
+/* An entry of the scheduler, which is a binary min-heap of active tracks keyed on the DTS of the next sample. */
+typedef struct
+{
+    double   dts;                   /* DTS of the next sample in seconds */
+    uint32_t out_track_number;
+    int      input_number;
+    uint32_t in_track_number;
+} schedule_t;
+
+static inline int schedule_precedes( schedule_t *a, schedule_t *b )
+{
+    /* Tracks with the same DTS are scheduled in the order of output tracks. */
+    return a->dts < b->dts || (a->dts == b->dts && a->out_track_number < b->out_track_number);
+}
+
+static void schedule_push( schedule_t *heap, uint32_t *count, schedule_t entry )
+{
+    uint32_t i = (*count)++;
+    while( i && schedule_precedes( &entry, &heap[(i - 1) / 2] ) )
+    {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = entry;
+}
+
+static schedule_t schedule_pop( schedule_t *heap, uint32_t *count )
+{
+    schedule_t top  = heap[0];
+    schedule_t last = heap[ --(*count) ];
+    uint32_t i = 0;
+    while( 2 * i + 1 < *count )
+    {
+        uint32_t child = 2 * i + 1;
+        if( child + 1 < *count && schedule_precedes( &heap[child + 1], &heap[child] ) )
+            ++child;
+        if( !schedule_precedes( &heap[child], &last ) )
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = last;
+    return top;
+}
+
+/* Remux into a non-fragmented movie.
+ * Always append the sample with the earliest DTS among all active tracks, which costs O(log tracks) per sample. */
+static int do_remux_by_schedule( remuxer_t *remuxer )
+{
+    input_t        *inputs    = remuxer->input;
+    output_t       *output    = remuxer->output;
+    output_movie_t *out_movie = &output->file.movie;
+    schedule_t     *schedule  = lsmash_malloc( (out_movie->num_tracks + 1) * sizeof(schedule_t) );
+    if( !schedule )
+        return ERROR_MSG( "failed to allocate the scheduler.\n" );
+    uint32_t schedule_count   = 0;
+    uint32_t out_track_number = 0;
+    uint64_t total_media_size = 0;
+    uint32_t progress_pos     = 0;
+    int      ret              = 0;
+    /* Schedule the first sample of each active track. */
+    for( int i = 0; i < remuxer->num_input && ret >= 0; i++ )
+    {
+        input_movie_t *in_movie = &inputs[i].file.movie;
+        for( uint32_t j = 0; j < in_movie->num_tracks; j++ )
+        {
+            input_track_t *in_track = &in_movie->track[j];
+            if( !in_track->active )
+                continue;
+            output_track_t *out_track = &out_movie->track[ out_track_number++ ];
+            if( (ret = get_next_sample( &inputs[i], in_track, out_track, 0 )) < 0 )
+                break;
+            if( ret > 0 )
+            {
+                schedule_t entry = { in_track->dts, out_track_number, i, j };
+                schedule_push( schedule, &schedule_count, entry );
+            }
+        }
+    }
+    while( ret >= 0 && schedule_count )
+    {
+        schedule_t      entry     = schedule_pop( schedule, &schedule_count );
+        input_t        *in        = &inputs[ entry.input_number ];
+        input_track_t  *in_track  = &in->file.movie.track[ entry.in_track_number ];
+        output_track_t *out_track = &out_movie->track[ entry.out_track_number - 1 ];
+        lsmash_sample_t *sample   = in_track->sample;
+        if( sample->index )
+        {
+            uint64_t sample_size     = sample->length;      /* sample might be deleted internally after appending. */
+            uint64_t last_sample_dts = sample->dts;         /* same as above */
+            uint32_t sample_index    = sample->index;       /* same as above */
+            /* Append a sample into output movie. */
+            if( lsmash_append_sample( output->root, out_track->track_ID, sample ) < 0 )
+            {
+                lsmash_delete_sample( sample );
+                in_track->sample = NULL;
+                ret = ERROR_MSG( "failed to append a sample.\n" );
+                break;
+            }
+            in_track->current_sample_index    = sample_index;
+            out_track->current_sample_number += 1;
+            out_track->last_sample_dts        = last_sample_dts;
+            total_media_size                 += sample_size;
+            /* Print, per 4 megabytes, total size of imported media. */
+            if( (total_media_size >> 22) > progress_pos )
+            {
+                progress_pos = total_media_size >> 22;
+                eprintf( "Importing: %"PRIu64" bytes\r", total_media_size );
+            }
+        }
+        else
+            lsmash_delete_sample( sample );
+        in_track->sample                 = NULL;
+        in_track->current_sample_number += 1;
+        /* Schedule the next sample of this track. */
+        if( (ret = get_next_sample( in, in_track, out_track, 0 )) > 0 )
+        {
+            entry.dts = in_track->dts;
+            schedule_push( schedule, &schedule_count, entry );
+        }
+    }
+    lsmash_free( schedule );
+    if( ret < 0 )
+        return -1;
+    for( uint32_t i = 0; i < out_movie->num_tracks; i++ )
+        if( lsmash_flush_pooled_samples( output->root, out_movie->track[i].track_ID, out_movie->track[i].last_sample_delta ) )
+            return ERROR_MSG( "failed to flush samples.\n" );
+    return 0;
+}
+
+/* Remux a fragmented movie into a non-fragmented movie by appending track fragment runs as chunks
+ * and copying their media data in bulk instead of each sample.
+ * Return 1 if any sample needs to be changed, and then it must be remuxed sample by sample. */
+static int do_defragment( remuxer_t *remuxer )
+{
+    input_t        *in        = &remuxer->input[0];
+    output_t       *output    = remuxer->output;
+    output_movie_t *out_movie = &output->file.movie;
+    uint32_t       *track_IDs = lsmash_malloc( 2 * out_movie->num_tracks * sizeof(uint32_t) );
+    if( !track_IDs )
+        return ERROR_MSG( "failed to allocate the track mapping.\n" );
+    uint32_t *dst_track_IDs = track_IDs;
+    uint32_t *src_track_IDs = track_IDs + out_movie->num_tracks;
+    uint32_t  track_count   = 0;
+    for( uint32_t i = 0; i < in->file.movie.num_tracks; i++ )
+    {
+        input_track_t *in_track = &in->file.movie.track[i];
+        if( !in_track->active )
+            continue;
+        /* Samples are appended as they are. */
+        output_track_t *out_track = &out_movie->track[ track_count ];
+        uint64_t first_dts = 0;
+        int keep = in_track->current_sample_number == 1
+                && (lsmash_get_sample_count_in_media_timeline( in->root, in_track->track_ID ) == 0
+                 || (lsmash_get_dts_from_media_timeline( in->root, in_track->track_ID, 1, &first_dts ) == 0 && first_dts == 0));
+        for( uint32_t j = 0; keep && j < in_track->num_summaries; j++ )
+            keep = out_track->summary_remap[j] == j + 1;
+        if( !keep )
+        {
+            lsmash_free( track_IDs );
+            WARNING_MSG( "samples need to be changed, so defragment sample by sample.\n" );
+            return 1;
+        }
+        dst_track_IDs[track_count] = out_track->track_ID;
+        src_track_IDs[track_count] = in_track->track_ID;
+        ++track_count;
+    }
+    int err = lsmash_append_samples_from_media_timelines( output->root, dst_track_IDs, in->root, src_track_IDs, track_count );
+    lsmash_free( track_IDs );
+    if( err == LSMASH_ERR_PATCH_WELCOME )
+    {
+        WARNING_MSG( "some tracks are not supported, so defragment sample by sample.\n" );
+        return 1;
+    }
+    if( err < 0 )
+        return ERROR_MSG( "failed to append samples.\n" );
+    for( uint32_t i = 0; i < out_movie->num_tracks; i++ )
+        if( lsmash_flush_pooled_samples( output->root, out_movie->track[i].track_ID, out_movie->track[i].last_sample_delta ) )
+            return ERROR_MSG( "failed to flush samples.\n" );
+    return 0;
+}
+
+static int is_lpcm_summary( lsmash_summary_t *summary )
+{
+    lsmash_codec_type_t type = summary->sample_type;
+    return summary->summary_type == LSMASH_SUMMARY_TYPE_AUDIO
+        && (lsmash_check_codec_type_identical( type, QT_CODEC_TYPE_23NI_AUDIO )
+         || lsmash_check_codec_type_identical( type, QT_CODEC_TYPE_NONE_AUDIO )
+         || lsmash_check_codec_type_identical( type, QT_CODEC_TYPE_LPCM_AUDIO )
+         || lsmash_check_codec_type_identical( type, QT_CODEC_TYPE_SOWT_AUDIO )
+         || lsmash_check_codec_type_identical( type, QT_CODEC_TYPE_TWOS_AUDIO )
+         || lsmash_check_codec_type_identical( type, QT_CODEC_TYPE_FL32_AUDIO )
+         || lsmash_check_codec_type_identical( type, QT_CODEC_TYPE_FL64_AUDIO )
+         || lsmash_check_codec_type_identical( type, QT_CODEC_TYPE_IN24_AUDIO )
+         || lsmash_check_codec_type_identical( type, QT_CODEC_TYPE_IN32_AUDIO )
+         || lsmash_check_codec_type_identical( type, QT_CODEC_TYPE_NOT_SPECIFIED )
+         || lsmash_check_codec_type_identical( type, QT_CODEC_TYPE_RAW_AUDIO ));
+}
+
+/* Check if any sample of a track must be inspected or split on appending.
+ * Such samples can't be appended by reference: samples of hint tracks and LPCM samples consisting of multiple frames. */
+static int need_sample_data( input_t *in, input_track_t *in_track )
+{
+    for( uint32_t j = 0; j < in_track->num_summaries; j++ )
+    {
+        lsmash_summary_t *summary = in_track->summaries[j].summary;
+        if( !summary )
+            continue;
+        if( lsmash_check_codec_type_identical( summary->sample_type, ISOM_CODEC_TYPE_RTP_HINT  )
+         || lsmash_check_codec_type_identical( summary->sample_type, ISOM_CODEC_TYPE_RRTP_HINT ) )
+            return 1;
+        if( !is_lpcm_summary( summary ) )
+            continue;
+        uint32_t frame_size   = ((lsmash_audio_summary_t *)summary)->bytes_per_frame;
+        uint32_t sample_count = lsmash_get_sample_count_in_media_timeline( in->root, in_track->track_ID );
+        for( uint32_t k = 1; k <= sample_count; k++ )
+        {
+            lsmash_sample_t info;
+            if( lsmash_get_sample_info_from_media_timeline( in->root, in_track->track_ID, k, &info ) < 0 )
+                return 1;
+            if( info.index == j + 1 && info.length != frame_size )
+                return 1;
+        }
+    }
+    return 0;
+}
+
+/* Check if the media data of all active tracks is in the input file itself and needn't be inspected or split,
+ * and then samples can be appended by referring to their byte ranges in it. */
+static int can_resegment( remuxer_t *remuxer )
+{
+    input_t *in = &remuxer->input[0];
+    for( uint32_t i = 0; i < in->file.movie.num_tracks; i++ )
+    {
+        input_track_t *in_track = &in->file.movie.track[i];
+        if( !in_track->active )
+            continue;
+        for( uint32_t j = 0; j < in_track->media.num_data_refs; j++ )
+            if( in_track->media.data_refs[j].fh != in->file.fh )
+            {
+                WARNING_MSG( "media data is not in the input file, so resegment sample by sample.\n" );
+                return 0;
+            }
+        if( need_sample_data( in, in_track ) )
+        {
+            WARNING_MSG( "samples need to be inspected or split, so resegment sample by sample.\n" );
+            return 0;
+        }
+    }
+    return 1;
+}
+
 static int do_remux( remuxer_t *remuxer )
 {
 #define LSMASH_MAX( a, b ) ((a) > (b) ? (a) : (b))
@@ -1497,8 +1987,19 @@ static int do_remux( remuxer_t *remuxer )
     output_t       *output    = remuxer->output;
     output_movie_t *out_movie = &output->file.movie;
     set_reference_chapter_track( remuxer );
+    if( remuxer->defragment )
+    {
+        int ret = do_defragment( remuxer );
+        if( ret <= 0 )
+            return ret;
+    }
+    if( remuxer->frag_base_track == 0 )
+        return do_remux_by_schedule( remuxer );
+    int by_reference = remuxer->resegment && can_resegment( remuxer );
     double   largest_dts                 = 0;   /* in seconds */
     double   frag_base_dts               = 0;   /* in seconds */
+    double   chunk_base_dts              = 0;   /* in seconds */
+    double   chunk_append_time           = -1;  /* wall-clock time when the first sample of the current chunk was appended */
     uint32_t input_movie_number          = 1;
     uint32_t num_consecutive_sample_skip = 0;
     uint32_t num_active_input_tracks     = out_movie->num_tracks;
@@ -1530,37 +2031,12 @@ static int do_remux( remuxer_t *remuxer )
             /* Get a new sample data if the track doesn't hold any one. */
             if( !sample )
             {
-                sample = lsmash_get_sample_from_media_timeline( in->root, in_track->track_ID, in_track->current_sample_number );
-                if( sample )
-                {
-                    output_track_t *out_track = &out_movie->track[ out_movie->current_track_number - 1 ];
-                    adapt_description_index( out_track, in_track, sample );
-                    adjust_timestamp( out_track, sample );
-                    in_track->sample = sample;
-                    in_track->dts    = (double)sample->dts / in_track->media.param.timescale;
-                }
-                else
-                {
-                    if( lsmash_check_sample_existence_in_media_timeline( in->root, in_track->track_ID, in_track->current_sample_number ) )
-                    {
-                        ERROR_MSG( "failed to get a sample.\n" );
-                        break;
-                    }
-                    lsmash_sample_t sample_info = { 0 };
-                    if( lsmash_get_sample_info_from_media_timeline( in->root, in_track->track_ID, in_track->current_sample_number, &sample_info ) < 0 )
-                    {
-                        /* No more appendable samples in this track. */
-                        in_track->sample = NULL;
-                        in_track->reach_end_of_media_timeline = 1;
-                        if( --num_active_input_tracks == 0 )
-                            break;      /* end of muxing */
-                    }
-                    else
-                    {
-                        ERROR_MSG( "failed to get a sample.\n" );
-                        break;
-                    }
-                }
+                int ret = get_next_sample( in, in_track, &out_movie->track[ out_movie->current_track_number - 1 ], by_reference );
+                if( ret < 0 )
+                    break;
+                if( ret == 0 && --num_active_input_tracks == 0 )
+                    break;      /* end of muxing */
+                sample = in_track->sample;
             }
             if( sample )
             {
@@ -1583,6 +2059,27 @@ static int do_remux( remuxer_t *remuxer )
                             pending_flush_fragments = 1;
                             frag_base_dts = in_track->dts;
                         }
+                        else if( remuxer->chunk_duration != 0.0
+                              && remuxer->frag_base_track == out_movie->current_track_number
+                              && in_track->dts - chunk_base_dts >= remuxer->chunk_duration
+                              && total_media_size )
+                        {
+                            /* Output the samples appended so far as a chunk within the current fragment. */
+                            if( flush_movie_fragment( remuxer ) < 0 )
+                            {
+                                ERROR_MSG( "failed to flush a movie fragment.\n" );
+                                break;
+                            }
+                            if( lsmash_create_fragment_chunk( output->root ) < 0 )
+                            {
+                                ERROR_MSG( "failed to create a chunk of a movie fragment.\n" );
+                                break;
+                            }
+                            if( chunk_append_time >= 0 )
+                                record_chunk_latency( remuxer, lsmash_get_wall_clock() - chunk_append_time );
+                            chunk_append_time = -1;
+                            chunk_base_dts    = in_track->dts;
+                        }
                     }
                     else if( num_consecutive_sample_skip == num_active_input_tracks || total_media_size == 0 )
                     {
@@ -1598,6 +2095,10 @@ static int do_remux( remuxer_t *remuxer )
                             ERROR_MSG( "failed to create a movie fragment.\n" );
                             break;
                         }
+                        if( chunk_append_time >= 0 )
+                            record_chunk_latency( remuxer, lsmash_get_wall_clock() - chunk_append_time );
+                        chunk_append_time       = -1;
+                        chunk_base_dts          = frag_base_dts;
                         pending_flush_fragments = 0;
                     }
                 }
@@ -1633,11 +2134,16 @@ static int do_remux( remuxer_t *remuxer )
                         uint64_t last_sample_dts = sample->dts;         /* same as above */
                         uint32_t sample_index    = sample->index;       /* same as above */
                         /* Append a sample into output movie. */
-                        if( lsmash_append_sample( output->root, out_track->track_ID, sample ) < 0 )
+                        int err = by_reference
+                                ? lsmash_append_sample_by_reference( output->root, out_track->track_ID, sample, in->file.fh )
+                                : lsmash_append_sample( output->root, out_track->track_ID, sample );
+                        if( err < 0 )
                         {
                             lsmash_delete_sample( sample );
                             return ERROR_MSG( "failed to append a sample.\n" );
                         }
+                        if( remuxer->chunk_duration != 0.0 && chunk_append_time < 0 )
+                            chunk_append_time = lsmash_get_wall_clock();
                         largest_dts                       = LSMASH_MAX( largest_dts, in_track->dts );
                         in_track->sample                  = NULL;
                         in_track->current_sample_number  += 1;
@@ -1799,12 +2305,23 @@ int main( int argc, char *argv[] )
         .chap_file                = NULL,
         .default_language         = 0,
         .max_chunk_size           = 4*1024*1024,
+        .max_frag_memory          = 0,
         .max_chunk_duration_in_ms = 500,
         .frag_base_track          = 0,
         .subseg_per_seg           = 0,
+        .subseg_per_index         = 0,
+        .frags_per_mfra           = 0,
         .dash                     = 0,
         .compact_size_table       = 0,
+        .compact_fragment         = 0,
+        .defragment               = 0,
+        .resegment                = 0,
+        .reserve_moov             = 0,
         .min_frag_duration        = 0.0,
+        .chunk_duration           = 0.0,
+        .num_chunks               = 0,
+        .total_chunk_latency      = 0.0,
+        .max_chunk_latency        = 0.0,
         .dry_run                  = 0
     };
     if( parse_cli_option( argc, argv, &remuxer ) )
@@ -1813,6 +2330,13 @@ int main( int argc, char *argv[] )
         return REMUXER_ERR( "failed to set up preparation for output.\n" );
     if( remuxer.frag_base_track && construct_timeline_maps( &remuxer ) )
         return REMUXER_ERR( "failed to construct timeline maps.\n" );
+    if( remuxer.reserve_moov )
+    {
+        /* Reserve the space for the Movie Box in front of the media data so that no moov-to-front rearrangement is needed. */
+        uint64_t movie_size = estimate_movie_size( &remuxer );
+        if( movie_size && movie_size <= UINT32_MAX && lsmash_reserve_movie_size( output.root, movie_size ) )
+            return REMUXER_ERR( "failed to reserve the space for the Movie Box.\n" );
+    }
     if( do_remux( &remuxer ) )
         return REMUXER_ERR( "failed to remux movies.\n" );
     if( remuxer.frag_base_track == 0 && construct_timeline_maps( &remuxer ) )
@@ -1820,6 +2344,9 @@ int main( int argc, char *argv[] )
     if( finish_movie( &remuxer ) )
         return REMUXER_ERR( "failed to finish output movie.\n" );
     REFRESH_CONSOLE;
+    if( remuxer.num_chunks )
+        eprintf( "Chunk latency from append to output: average %.3f ms, maximum %.3f ms\n",
+                 remuxer.total_chunk_latency * 1000 / remuxer.num_chunks, remuxer.max_chunk_latency * 1000 );
     eprintf( "%s completed!\n", !remuxer.dash || remuxer.subseg_per_seg == 0 ? "Remuxing" : "Segmentation" );
     cleanup_remuxer( &remuxer );
     return 0;
@@ -206,23 +206,7 @@ uint64_t h264_find_next_start_code
         *start_code_length = long_start_code ? NALU_LONG_START_CODE_LENGTH : NALU_SHORT_START_CODE_LENGTH;
         uint64_t distance = *start_code_length + nuh->length;
         /* Find the start code of the next NALU and get the distance from the start code of the latest NALU. */
-        if( !lsmash_bs_is_end( bs, distance + NALU_SHORT_START_CODE_LENGTH ) )
-        {
-            uint32_t sync_bytes = lsmash_bs_show_be24( bs, distance );
-            while( 0x000001 != sync_bytes )
-            {
-                if( lsmash_bs_is_end( bs, ++distance + NALU_SHORT_START_CODE_LENGTH ) )
-                {
-                    distance = lsmash_bs_get_remaining_buffer_size( bs );
-                    break;
-                }
-                sync_bytes <<= 8;
-                sync_bytes  |= lsmash_bs_show_byte( bs, distance + NALU_SHORT_START_CODE_LENGTH - 1 );
-                sync_bytes  &= 0xFFFFFF;
-            }
-        }
-        else
-            distance = lsmash_bs_get_remaining_buffer_size( bs );
+        distance = nalu_find_next_start_code_distance( bs, distance );
         /* Any NALU has no consecutive zero bytes at the end. */
         while( 0x00 == lsmash_bs_show_byte( bs, distance - 1 ) )
         {
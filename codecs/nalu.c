@@ -233,6 +233,35 @@ uint64_t nalu_find_first_start_code
     return first_sc_head_pos;
 }
 
+/* Return the distance from the current position of the stream to the next start code (0x000001)
+ * searched from 'distance' onwards.
+ * Return the size of the remaining data if no start code is found.
+ * The buffered data is scanned for the last byte of the start code by memchr() instead of
+ * showing the stream byte by byte, which is the dominant cost for streams of large NALUs. */
+uint64_t nalu_find_next_start_code_distance
+(
+    lsmash_bs_t *bs,
+    uint64_t     distance
+)
+{
+    /* As well as the start code itself, at least one following byte is required to be a start code of the next NALU. */
+    while( !lsmash_bs_is_error( bs ) && !lsmash_bs_is_end( bs, distance + NALU_SHORT_START_CODE_LENGTH ) )
+    {
+        uint8_t *data = lsmash_bs_get_buffer_data( bs );
+        uint8_t *end  = data + lsmash_bs_get_remaining_buffer_size( bs ) - 1;
+        uint8_t *p    = data + distance + NALU_SHORT_START_CODE_LENGTH - 1;
+        while( p < end && (p = memchr( p, 0x01, end - p )) )
+        {
+            if( p[-1] == 0x00 && p[-2] == 0x00 )
+                return (p - data) - (NALU_SHORT_START_CODE_LENGTH - 1);
+            ++p;
+        }
+        /* Not found in the buffered data. Read more and resume from the first unchecked position. */
+        distance = (end - data) - (NALU_SHORT_START_CODE_LENGTH - 1);
+    }
+    return lsmash_bs_get_remaining_buffer_size( bs );
+}
+
 uint64_t nalu_get_codeNum
 (
     lsmash_bits_t *bits
@@ -94,6 +94,15 @@ uint64_t nalu_find_first_start_code
     lsmash_bs_t *bs
 );
 
+/* Return the distance from the current position of the stream to the next start code
+ * searched from 'distance' onwards.
+ * Return the size of the remaining data if no start code is found. */
+uint64_t nalu_find_next_start_code_distance
+(
+    lsmash_bs_t *bs,
+    uint64_t     distance
+);
+
 uint64_t nalu_get_codeNum
 (
     lsmash_bits_t *bits
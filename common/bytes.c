@@ -99,7 +99,9 @@ static void bs_alloc( lsmash_bs_t *bs, size_t alloc )
         bs->error = 1;
         return;
     }
+    /* Grow the buffer geometrically so that writing a large box byte by byte doesn't reallocate it for each byte. */
     alloc  = LSMASH_MAX( alloc, bs->buffer.max_size );
+    alloc  = LSMASH_MAX( alloc, bs->buffer.alloc * 2 );
     uint8_t *data;
     if( !bs->buffer.data )
         data = lsmash_malloc( alloc );
@@ -689,6 +691,44 @@ int lsmash_bs_read_data( lsmash_bs_t *bs, uint8_t *buf, size_t *size )
     return 0;
 }
 
+/* Copy the data of 'size' bytes at 'pos' in the stream of 'src' to 'dst' through a temporary buffer 'buf'.
+ * If 'dst' has a writable stream, the data is written directly into it instead of its buffer. */
+int lsmash_bs_copy_data( lsmash_bs_t *dst, lsmash_bs_t *src, uint64_t pos, uint64_t size, uint8_t *buf, size_t buf_size )
+{
+    if( !dst || !src || !buf || buf_size == 0 || buf_size > INT_MAX )
+        return LSMASH_ERR_FUNCTION_PARAM;
+    if( size == 0 )
+        return 0;
+    int direct = dst->stream && dst->write;
+    int err;
+    if( direct && (err = lsmash_bs_flush_buffer( dst )) < 0 )
+        return err;
+    int64_t ret = lsmash_bs_write_seek( src, pos, SEEK_SET );
+    if( ret < 0 )
+        return ret;
+    while( size )
+    {
+        size_t read_size = LSMASH_MIN( size, buf_size );
+        if( (err = lsmash_bs_read_data( src, buf, &read_size )) < 0 )
+            return err;
+        if( read_size == 0 )
+            return LSMASH_ERR_INVALID_DATA;
+        if( direct )
+        {
+            if( (err = lsmash_bs_write_data( dst, buf, read_size )) < 0 )
+                return err;
+        }
+        else
+        {
+            lsmash_bs_put_bytes( dst, read_size, buf );
+            if( dst->error )
+                return LSMASH_ERR_NAMELESS;
+        }
+        size -= read_size;
+    }
+    return 0;
+}
+
 int lsmash_bs_import_data( lsmash_bs_t *bs, void *data, uint32_t length )
 {
     if( !bs || !data || length == 0 )
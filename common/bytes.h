@@ -148,6 +148,7 @@ uint32_t lsmash_bs_get_le32( lsmash_bs_t *bs );
 int lsmash_bs_read( lsmash_bs_t *bs, uint32_t size );
 int lsmash_bs_read_data( lsmash_bs_t *bs, uint8_t *buf, size_t *size );
 int lsmash_bs_import_data( lsmash_bs_t *bs, void *data, uint32_t length );
+int lsmash_bs_copy_data( lsmash_bs_t *dst, lsmash_bs_t *src, uint64_t pos, uint64_t size, uint8_t *buf, size_t buf_size );
 
 /* Check if the given offset reaches both EOF of the stream and the end of the buffer. */
 static inline int lsmash_bs_is_end( lsmash_bs_t *bs, uint32_t offset )
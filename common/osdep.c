@@ -20,14 +20,28 @@
 
 /* This file is available under an ISC license. */
 
+/* for fallocate() and copy_file_range() */
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include "internal.h" /* must be placed first */
 
 #include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #ifdef _WIN32
 #include <windows.h>
 #endif
 
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
 #ifdef _WIN32
 
 int lsmash_string_to_wchar( int cp, const char *from, wchar_t **to )
@@ -65,3 +79,96 @@ FILE *lsmash_win32_fopen( const char *name, const char *mode )
 
 #endif
 
+int lsmash_get_file_status( const char *name, uint64_t *size, int64_t *mtime )
+{
+    if( !name || !size || !mtime )
+        return LSMASH_ERR_FUNCTION_PARAM;
+#ifdef _WIN32
+    struct _stat64 st;
+    wchar_t *wname = NULL;
+    int ret = -1;
+    if( lsmash_string_to_wchar( CP_UTF8, name, &wname ) )
+        ret = _wstat64( wname, &st );
+    lsmash_free( wname );
+    if( ret != 0 && _stat64( name, &st ) != 0 )
+        return LSMASH_ERR_IO;
+#else
+    struct stat st;
+    if( stat( name, &st ) != 0 )
+        return LSMASH_ERR_IO;
+#endif
+    *size  = st.st_size;
+#if defined( __linux__ )
+    *mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#elif defined( __APPLE__ )
+    *mtime = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    *mtime = (int64_t)st.st_mtime * 1000000000;
+#endif
+    return 0;
+}
+
+uint64_t lsmash_get_file_block_size( FILE *fp )
+{
+#ifdef __linux__
+    struct stat st;
+    if( !fp || fstat( fileno( fp ), &st ) != 0 || st.st_blksize <= 0 )
+        return 0;
+    return st.st_blksize;
+#else
+    (void)fp;
+    return 0;
+#endif
+}
+
+int lsmash_insert_file_range( FILE *fp, uint64_t offset, uint64_t length )
+{
+    if( !fp || offset > INT64_MAX || length > INT64_MAX )
+        return LSMASH_ERR_FUNCTION_PARAM;
+#if defined( __linux__ ) && defined( FALLOC_FL_INSERT_RANGE )
+    if( fflush( fp ) != 0 )
+        return LSMASH_ERR_IO;
+    if( fallocate( fileno( fp ), FALLOC_FL_INSERT_RANGE, (off_t)offset, (off_t)length ) == 0 )
+        return 0;
+    return (errno == EOPNOTSUPP || errno == EINVAL || errno == ENOSYS) ? LSMASH_ERR_PATCH_WELCOME : LSMASH_ERR_IO;
+#else
+    return LSMASH_ERR_PATCH_WELCOME;
+#endif
+}
+
+int lsmash_copy_file_data( FILE *src_fp, uint64_t src_offset, FILE *dst_fp, uint64_t dst_offset, uint64_t length )
+{
+    if( !src_fp || !dst_fp || src_offset > INT64_MAX || dst_offset > INT64_MAX || length > INT64_MAX )
+        return LSMASH_ERR_FUNCTION_PARAM;
+#if defined( __linux__ ) && defined( SYS_copy_file_range )
+    if( fflush( src_fp ) != 0
+     || fflush( dst_fp ) != 0 )
+        return LSMASH_ERR_IO;
+    int   src_fd = fileno( src_fp );
+    int   dst_fd = fileno( dst_fp );
+    off_t src    = (off_t)src_offset;
+    off_t dst    = (off_t)dst_offset;
+    while( length )
+    {
+        /* Call the system call directly since the wrapper is not available in older C libraries. */
+        long ret = syscall( SYS_copy_file_range, src_fd, &src, dst_fd, &dst, (size_t)LSMASH_MIN( length, 1 << 30 ), 0u );
+        if( ret <= 0 )
+        {
+            if( ret < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP) )
+                return LSMASH_ERR_PATCH_WELCOME;
+            return LSMASH_ERR_IO;
+        }
+        length -= ret;
+    }
+    return 0;
+#else
+    (void)src_offset;
+    (void)dst_offset;
+    return LSMASH_ERR_PATCH_WELCOME;
+#endif
+}
+
+int lsmash_copy_file_range( FILE *fp, uint64_t src_offset, uint64_t dst_offset, uint64_t length )
+{
+    return lsmash_copy_file_data( fp, src_offset, fp, dst_offset, length );
+}
@@ -52,6 +52,40 @@
 #  define lsmash_fopen fopen
 #endif
 
+#include <stdio.h>
+#include <stdint.h>
+
+/* Get the size and the last modification time of a file.
+ * The time is given in nanoseconds, but its resolution depends on the platform and the file system.
+ * Return 0 if successful.
+ * Return a negative value otherwise. */
+int lsmash_get_file_status( const char *name, uint64_t *size, int64_t *mtime );
+
+/* Get the block size of the file system for an opened file.
+ * Return 0 if unknown. */
+uint64_t lsmash_get_file_block_size( FILE *fp );
+
+/* Insert a hole of 'length' bytes at 'offset' in an opened file by shifting the following data inside the kernel.
+ * Both 'offset' and 'length' must be multiples of the block size of the file system.
+ * Return 0 if successful.
+ * Return LSMASH_ERR_PATCH_WELCOME if the platform or the file system doesn't support it.
+ * Return a negative value otherwise. */
+int lsmash_insert_file_range( FILE *fp, uint64_t offset, uint64_t length );
+
+/* Copy 'length' bytes from 'src_offset' to 'dst_offset' in an opened file inside the kernel.
+ * The source and the destination ranges must not overlap.
+ * Return 0 if successful.
+ * Return LSMASH_ERR_PATCH_WELCOME if the platform or the file system doesn't support it.
+ * Return a negative value otherwise. */
+int lsmash_copy_file_range( FILE *fp, uint64_t src_offset, uint64_t dst_offset, uint64_t length );
+
+/* Copy 'length' bytes at 'src_offset' in an opened file to 'dst_offset' in another opened file inside the kernel.
+ * The file positions of both files are not changed.
+ * Return 0 if successful.
+ * Return LSMASH_ERR_PATCH_WELCOME if the platform or the file systems don't support it.
+ * Return a negative value otherwise. */
+int lsmash_copy_file_data( FILE *src_fp, uint64_t src_offset, FILE *dst_fp, uint64_t dst_offset, uint64_t length );
+
 #ifdef _WIN32
 #  include <wchar.h>
    int lsmash_string_to_wchar( int cp, const char *from, wchar_t **to );
@@ -31,6 +31,7 @@
 #include "read.h"
 #include "print.h"
 #include "timeline.h"
+#include "file.h"
 
 #include "codecs/mp4a.h"
 #include "codecs/mp4sys.h"
@@ -614,6 +615,8 @@ static void isom_remove_file_abstract( isom_file_abstract_t *file_abstract )
     if( file_abstract->fragment )
     {
         lsmash_list_destroy( file_abstract->fragment->pool );
+        lsmash_list_destroy( file_abstract->fragment->held );
+        isom_close_temporary_stream( file_abstract->fragment->spill );
         lsmash_free( file_abstract->fragment );
     }
     REMOVE_BOX_IN_LIST( file_abstract );
@@ -639,6 +642,7 @@ static void isom_remove_trak( isom_trak_t *trak )
     {
         isom_remove_sample_pool( trak->cache->chunk.pool );
         lsmash_list_destroy( trak->cache->roll.pool );
+        lsmash_list_remove_entries( &trak->cache->interleave );
         lsmash_free( trak->cache->rap );
         lsmash_free( trak->cache->fragment );
         lsmash_free( trak->cache );
@@ -1293,6 +1297,7 @@ isom_trak_t *isom_add_trak( isom_moov_t *moov )
     isom_cache_t    *cache    = lsmash_malloc_zero( sizeof(isom_cache_t) );
     if( !cache )
         goto fail;
+    lsmash_list_init( &cache->interleave, lsmash_delete_sample );
     if( moov->file->fragment )
     {
         fragment = lsmash_malloc_zero( sizeof(isom_fragment_t) );
@@ -1494,14 +1494,28 @@ typedef struct
 } isom_udta_t;
 
 /** Caches for handling tracks **/
+typedef struct
+{
+    uint64_t pos;               /* position of the data in the source stream */
+    uint64_t size;              /* size of the data */
+} isom_pool_extent_t;
+
 typedef struct
 {
     uint64_t alloc;             /* total buffer size for the pool */
     uint64_t size;              /* total size of samples in the pool */
     uint32_t sample_count;      /* number of samples in the pool */
     uint8_t *data;              /* actual data of samples in the pool */
+    /* If samples are pooled by reference, their data is not held on the pool but copied from the source stream
+     * when written. Physically consecutive samples are merged into an extent. */
+    lsmash_bs_t        *src;            /* source stream of samples pooled by reference, or NULL */
+    isom_pool_extent_t *extents;        /* ranges of the data of samples in the source stream */
+    uint32_t            extent_count;
+    uint32_t            extent_alloc;
 } isom_sample_pool_t;
 
+#define ISOM_MEDIA_DATA_COPY_SIZE (1 << 22)     /* size of a buffer for copying media data between streams */
+
 typedef struct
 {
     uint32_t chunk_number;                  /* chunk number */
@@ -1555,6 +1569,8 @@ typedef struct
     uint64_t largest_cts;          /* the largest CTS of a subsegment of the reference stream */
     uint64_t smallest_cts;         /* the smallest CTS of a subsegment of the reference stream */
     uint64_t first_sample_cts;     /* the CTS of the first sample of a subsegment of the reference stream  */
+    uint32_t sample_count;         /* the number of samples of a subsegment of the reference stream */
+    uint32_t output_sample_count;  /* the number of output samples of a subsegment of the reference stream */
     /* SAP related info within the active subsegment of the reference stream */
     uint64_t                  first_ed_cts;     /* the earliest CTS of decodable samples after the first recovery point */
     uint64_t                  first_rp_cts;     /* the CTS of the first recovery point */
@@ -1570,11 +1586,16 @@ typedef struct
     uint8_t           has_samples;          /* Whether whole movie has any sample or not. */
     uint8_t           roll_grouping;
     uint8_t           rap_grouping;
+    uint8_t           flushed;              /* Whether the duration of the last sample in this track fragment is decided or not. */
     uint32_t          traf_number;
     uint32_t          last_duration;        /* the last sample duration in this track fragment */
     uint64_t          largest_cts;          /* the largest CTS in this track fragment */
     uint32_t          sample_count;         /* the number of samples in this track fragment */
     uint32_t          output_sample_count;  /* the number of output samples in this track fragment */
+    lsmash_bs_t      *src;                  /* source stream of the sample being appended by reference, or NULL */
+    lsmash_entry_t   *converted_rap;        /* the last entry in the Track Fragment Random Access Box whose time was converted */
+    uint32_t          rap_edit_number;      /* the number of edits preceding the one the converted entries reached */
+    uint64_t          rap_edit_offset;      /* the presentation time of the edit the converted entries reached */
     isom_subsegment_t subsegment;
 } isom_fragment_t;
 
@@ -1587,6 +1608,7 @@ typedef struct
     isom_grouping_t   roll;
     isom_rap_group_t *rap;
     isom_fragment_t  *fragment;
+    lsmash_entry_list_t interleave; /* samples queued by the interleaver */
 } isom_cache_t;
 
 /** Movie Fragments Boxes **/
@@ -1843,9 +1865,14 @@ typedef struct
 #define FIRST_MOOF_POS_UNDETERMINED UINT64_MAX
     isom_moof_t         *movie;             /* the address corresponding to the current Movie Fragment Box */
     uint64_t             first_moof_pos;
+    uint64_t             subsegment_pos;    /* the position of the first Movie Fragment Box in the current subsegment */
     uint64_t             pool_size;         /* the total sample size in the current movie fragment */
     uint64_t             sample_count;      /* the number of samples within the current movie fragment */
     lsmash_entry_list_t *pool;              /* samples pooled to interleave for the current movie fragment */
+    uint64_t             memory_size;       /* the total size of the data of samples in 'pool' held on memory */
+    uint64_t             spill_size;        /* the total size of the data of samples in 'pool' spilled out */
+    lsmash_bs_t         *spill;             /* temporary file to which the data of samples beyond the memory limit is spilled */
+    lsmash_entry_list_t *held;              /* samples held until the current movie fragment is split, or NULL */
 } isom_fragment_manager_t;
 
 /** **/
@@ -2024,9 +2051,21 @@ struct lsmash_file_tag
         double    max_chunk_duration;       /* max duration per chunk in seconds */
         double    max_async_tolerance;      /* max tolerance, in seconds, for amount of interleaving asynchronization between tracks */
         uint64_t  max_chunk_size;           /* max size per chunk in bytes. */
+        uint64_t  max_timeline_memory;      /* max size of memory in bytes for sample info of each timeline. */
+        uint64_t  expected_output_size;     /* the expected size of the output file in bytes */
+        uint64_t  max_fragment_size;        /* max size of media data per movie fragment in bytes */
+        uint64_t  max_fragment_memory;      /* max size of memory in bytes for media data pooled per movie fragment */
+        uint64_t  reserved_movie_pos;       /* the position of the space reserved for the Movie Box */
+        uint64_t  reserved_movie_size;      /* the size of the space reserved for the Movie Box */
+        uint64_t  reserved_index_pos;       /* the position of the space reserved for the Segment Index Boxes */
+        uint64_t  reserved_index_size;      /* the size of the space reserved for the Segment Index Boxes */
+        uint32_t  mfra_checkpoint_interval; /* the number of movie fragments per checkpoint of the random access info */
+        uint32_t  reserved_subsegment_count; /* the number of subsegments per track reserved for the Segment Index Boxes */
+        uint32_t  subsegments_per_index;    /* the max number of subsegments referenced by each lower-level Segment Index Box */
         uint32_t  brand_count;
         uint32_t *compatible_brands;        /* the backup of the compatible brands in the File Type Box or the valid Segment Type Box */
         uint8_t   fake_file_mode;           /* If set to 1, the bytestream manager handles fake-file stream. */
+        uint8_t   compact_movie_fragment;   /* If set to 1, minimize the size of each Movie Fragment Box. */
         /* flags for compatibility */
 #define COMPAT_FLAGS_OFFSET offsetof( lsmash_file_t, qt_compatible )
         uint8_t qt_compatible;              /* compatibility with QuickTime file format */
@@ -2448,6 +2487,27 @@ int isom_pool_sample
     uint32_t            samples_per_packet
 );
 
+int isom_pool_sample_reference
+(
+    isom_sample_pool_t *pool,
+    lsmash_bs_t        *src,
+    lsmash_sample_t    *sample,
+    uint32_t            samples_per_packet
+);
+
+int isom_write_sample_pool
+(
+    lsmash_bs_t        *bs,
+    isom_sample_pool_t *pool
+);
+
+int isom_spill_sample_pool
+(
+    isom_sample_pool_t *pool,
+    lsmash_bs_t        *spill,
+    uint64_t            pos
+);
+
 int isom_append_sample_by_type
 (
     void                *track,
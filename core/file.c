@@ -486,6 +486,176 @@ static int64_t default_io_stream_seek( void *opaque, int64_t offset, int whence
     return lsmash_ftell( ((default_io_stream_t *)opaque)->file_ptr );
 }
 
+/* Get the file pointer of a bytestream if it is a seekable default I/O stream.
+ * Operations inside the kernel are available only for it. */
+static FILE *isom_get_default_io_stream_file( lsmash_bs_t *bs )
+{
+    if( !bs
+     || !bs->stream
+     ||  bs->unseekable
+     ||  bs->write != default_io_stream_write )
+        return NULL;
+    default_io_stream_t *stream = (default_io_stream_t *)bs->stream;
+    return stream->is_standard_stream ? NULL : stream->file_ptr;
+}
+
+uint64_t isom_get_file_block_size
+(
+    lsmash_file_t *file
+)
+{
+    FILE *fp = isom_get_default_io_stream_file( file->bs );
+    return fp ? lsmash_get_file_block_size( fp ) : 0;
+}
+
+int isom_insert_file_range
+(
+    lsmash_file_t *file,
+    uint64_t       offset,
+    uint64_t       length
+)
+{
+    lsmash_bs_t *bs = file->bs;
+    FILE        *fp = isom_get_default_io_stream_file( bs );
+    if( !fp )
+        return LSMASH_ERR_PATCH_WELCOME;
+    int err = lsmash_bs_flush_buffer( bs );
+    if( err < 0 )
+        return err;
+    if( (err = lsmash_insert_file_range( fp, offset, length )) < 0 )
+        return err;
+    bs->written += length;
+    return 0;
+}
+
+/* Move 'size' bytes of data from 'src_pos' to 'dst_pos' through a buffer.
+ * The source and the destination may overlap since the whole data is read before written. */
+static int isom_move_file_data( FILE *fp, uint64_t src_pos, uint64_t dst_pos, uint64_t size, uint8_t *buf )
+{
+    if( lsmash_fseek( fp, (int64_t)src_pos, SEEK_SET ) != 0
+     || fread( buf, 1, size, fp ) != size
+     || lsmash_fseek( fp, (int64_t)dst_pos, SEEK_SET ) != 0
+     || fwrite( buf, 1, size, fp ) != size )
+        return LSMASH_ERR_IO;
+    return 0;
+}
+
+int isom_shift_file_data
+(
+    lsmash_file_t        *file,
+    lsmash_adhoc_remux_t *remux,
+    uint64_t              pos,
+    uint64_t              shift
+)
+{
+    lsmash_bs_t *bs = file->bs;
+    FILE        *fp = isom_get_default_io_stream_file( bs );
+    if( !fp || shift == 0 )
+        return LSMASH_ERR_PATCH_WELCOME;
+    int err = lsmash_bs_flush_buffer( bs );
+    if( err < 0 )
+        return err;
+    /* Copy backward from the end by windows.
+     * Let the kernel copy windows of at most 'shift' bytes if possible since such a window never overlaps its destination.
+     * Otherwise, move windows through a buffer of which size is decided in the same way as the other ad-hoc remuxing. */
+    remux->buffer_size = LSMASH_MAX( remux->buffer_size, shift * 2 );
+    uint64_t end       = file->size;
+    uint64_t file_size = end + shift;
+    uint64_t src_pos   = end;
+    uint8_t *buf       = NULL;
+    int      in_kernel = 1;
+    while( src_pos > pos )
+    {
+        uint64_t size = LSMASH_MIN( in_kernel ? shift : remux->buffer_size, src_pos - pos );
+        if( in_kernel )
+        {
+            err = lsmash_copy_file_range( fp, src_pos - size, src_pos - size + shift, size );
+            if( err == LSMASH_ERR_PATCH_WELCOME )
+            {
+                in_kernel = 0;
+                continue;
+            }
+            if( err < 0 )
+                break;
+        }
+        else
+        {
+            if( !buf && (buf = lsmash_malloc( remux->buffer_size )) == NULL )
+            {
+                err = LSMASH_ERR_MEMORY_ALLOC;
+                break;
+            }
+            if( (err = isom_move_file_data( fp, src_pos - size, src_pos - size + shift, size, buf )) < 0 )
+                break;
+        }
+        src_pos -= size;
+        if( remux->func )
+            remux->func( remux->param, file_size - (src_pos - pos), file_size );
+    }
+    lsmash_free( buf );
+    if( err < 0 )
+        return err;
+    bs->written = LSMASH_MAX( bs->written, file_size );
+    return 0;
+}
+
+lsmash_bs_t *isom_create_temporary_stream( void )
+{
+    default_io_stream_t *stream = (default_io_stream_t *)lsmash_malloc_zero( sizeof(default_io_stream_t) );
+    if( !stream )
+        return NULL;
+    stream->file_ptr  = tmpfile();
+    stream->file_mode = LSMASH_FILE_MODE_READ | LSMASH_FILE_MODE_WRITE;
+    lsmash_bs_t *bs = stream->file_ptr ? lsmash_bs_create() : NULL;
+    if( !bs )
+    {
+        default_io_stream_close( stream );
+        return NULL;
+    }
+    bs->stream     = stream;
+    bs->read       = default_io_stream_read;
+    bs->write      = default_io_stream_write;
+    bs->seek       = default_io_stream_seek;
+    bs->unseekable = 0;
+    return bs;
+}
+
+void isom_close_temporary_stream
+(
+    lsmash_bs_t *bs
+)
+{
+    if( !bs )
+        return;
+    default_io_stream_close( (default_io_stream_t *)bs->stream );
+    lsmash_bs_cleanup( bs );
+}
+
+int isom_copy_stream_data
+(
+    lsmash_bs_t *dst,
+    lsmash_bs_t *src,
+    uint64_t     pos,
+    uint64_t     size
+)
+{
+    FILE *dst_fp = isom_get_default_io_stream_file( dst );
+    FILE *src_fp = isom_get_default_io_stream_file( src );
+    if( !dst_fp || !src_fp )
+        return LSMASH_ERR_PATCH_WELCOME;
+    int err = lsmash_bs_flush_buffer( dst );
+    if( err < 0 )
+        return err;
+    if( (err = lsmash_copy_file_data( src_fp, pos, dst_fp, dst->offset, size )) < 0 )
+        return err;
+    /* The file position of the destination is not moved by the copy. */
+    if( lsmash_fseek( dst_fp, dst->offset + size, SEEK_SET ) != 0 )
+        return LSMASH_ERR_IO;
+    dst->written += size;
+    dst->offset  += size;
+    return 0;
+}
+
 /*******************************
     public interfaces
 *******************************/
@@ -514,19 +684,27 @@ int lsmash_open_file
     if( !stream )
         return LSMASH_ERR_NAMELESS;
     memset( param, 0, sizeof(lsmash_file_parameters_t) );
-    param->mode                = stream->file_mode;
-    param->opaque              = (void *)stream;
-    param->read                = default_io_stream_read;
-    param->write               = default_io_stream_write;
-    param->seek                = stream->is_standard_stream ? NULL : default_io_stream_seek;
-    param->major_brand         = 0;
-    param->brands              = NULL;
-    param->brand_count         = 0;
-    param->minor_version       = 0;
-    param->max_chunk_duration  = 0.5;
-    param->max_async_tolerance = 2.0;
-    param->max_chunk_size      = 4 * 1024 * 1024;
-    param->max_read_size       = 4 * 1024 * 1024;
+    param->mode                      = stream->file_mode;
+    param->opaque                    = (void *)stream;
+    param->read                      = default_io_stream_read;
+    param->write                     = default_io_stream_write;
+    param->seek                      = stream->is_standard_stream ? NULL : default_io_stream_seek;
+    param->major_brand               = 0;
+    param->brands                    = NULL;
+    param->brand_count               = 0;
+    param->minor_version             = 0;
+    param->max_chunk_duration        = 0.5;
+    param->max_async_tolerance       = 2.0;
+    param->max_chunk_size            = 4 * 1024 * 1024;
+    param->max_read_size             = 4 * 1024 * 1024;
+    param->max_timeline_memory       = 0;
+    param->expected_output_size      = 0;
+    param->max_fragment_size         = 0;
+    param->max_fragment_memory       = 0;
+    param->reserved_subsegment_count = 0;
+    param->subsegments_per_index     = 0;
+    param->mfra_checkpoint_interval  = 0;
+    param->compact_movie_fragment    = 0;
     return 0;
 }
 
@@ -556,17 +734,25 @@ lsmash_file_t *lsmash_set_file
     lsmash_bs_t *bs = lsmash_bs_create();
     if( !bs )
         goto fail;
-    file->bs                  = bs;
-    file->flags               = param->mode;
-    file->bs->stream          = param->opaque;
-    file->bs->read            = param->read;
-    file->bs->write           = param->write;
-    file->bs->seek            = param->seek;
-    file->bs->unseekable      = (param->seek == NULL);
-    file->bs->buffer.max_size = param->max_read_size;
-    file->max_chunk_duration  = param->max_chunk_duration;
-    file->max_async_tolerance = LSMASH_MAX( param->max_async_tolerance, 2 * param->max_chunk_duration );
-    file->max_chunk_size      = param->max_chunk_size;
+    file->bs                        = bs;
+    file->flags                     = param->mode;
+    file->bs->stream                = param->opaque;
+    file->bs->read                  = param->read;
+    file->bs->write                 = param->write;
+    file->bs->seek                  = param->seek;
+    file->bs->unseekable            = (param->seek == NULL);
+    file->bs->buffer.max_size       = param->max_read_size;
+    file->max_chunk_duration        = param->max_chunk_duration;
+    file->max_async_tolerance       = LSMASH_MAX( param->max_async_tolerance, 2 * param->max_chunk_duration );
+    file->max_chunk_size            = param->max_chunk_size;
+    file->expected_output_size      = param->expected_output_size;
+    file->max_fragment_size         = param->max_fragment_size;
+    file->max_fragment_memory       = param->max_fragment_memory;
+    file->reserved_subsegment_count = param->reserved_subsegment_count;
+    file->subsegments_per_index     = param->subsegments_per_index;
+    file->mfra_checkpoint_interval  = param->mfra_checkpoint_interval;
+    file->compact_movie_fragment    = param->compact_movie_fragment;
+    file->max_timeline_memory       = param->max_timeline_memory;
     if( (file->flags & LSMASH_FILE_MODE_WRITE)
      && (file->flags & LSMASH_FILE_MODE_BOX) )
     {
@@ -583,6 +769,7 @@ lsmash_file_t *lsmash_set_file
             if( !file->fragment )
                 goto fail;
             file->fragment->first_moof_pos = FIRST_MOOF_POS_UNDETERMINED;
+            file->fragment->subsegment_pos = FIRST_MOOF_POS_UNDETERMINED;
             file->fragment->pool = lsmash_list_create( isom_remove_sample_pool );
             if( !file->fragment->pool )
                 goto fail;
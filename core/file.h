@@ -30,6 +30,53 @@ int isom_check_mandatory_boxes
     lsmash_file_t *file
 );
 
+/* Get the block size of the file system for the stream of a file.
+ * Return 0 if unknown or the stream is not a file opened by lsmash_open_file(). */
+uint64_t isom_get_file_block_size
+(
+    lsmash_file_t *file
+);
+
+/* Insert a hole of 'length' bytes at 'offset' in the stream of a file inside the kernel.
+ * Return LSMASH_ERR_PATCH_WELCOME if not available. */
+int isom_insert_file_range
+(
+    lsmash_file_t *file,
+    uint64_t       offset,
+    uint64_t       length
+);
+
+/* Move the data from 'pos' to the end of the stream of a file forward by 'shift' bytes in large windows,
+ * inside the kernel if possible.
+ * Return LSMASH_ERR_PATCH_WELCOME if not available, and then the stream is not modified. */
+int isom_shift_file_data
+(
+    lsmash_file_t        *file,
+    lsmash_adhoc_remux_t *remux,
+    uint64_t              pos,
+    uint64_t              shift
+);
+
+/* Create a bytestream of an anonymous temporary file, which is deleted automatically when closed. */
+lsmash_bs_t *isom_create_temporary_stream( void );
+
+void isom_close_temporary_stream
+(
+    lsmash_bs_t *bs
+);
+
+/* Copy the data of 'size' bytes at 'pos' in the stream of 'src' to the current position in the stream of 'dst'
+ * inside the kernel.
+ * Return LSMASH_ERR_PATCH_WELCOME if not available. Then part of the data might be copied, but the position of 'dst'
+ * is not moved. */
+int isom_copy_stream_data
+(
+    lsmash_bs_t *dst,
+    lsmash_bs_t *src,
+    uint64_t     pos,
+    uint64_t     size
+);
+
 int isom_rearrange_data
 (
     lsmash_file_t        *file,
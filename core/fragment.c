@@ -22,6 +22,7 @@
 
 #include "common/internal.h" /* must be placed first */
 
+#include <stdlib.h>
 #include <string.h>
 #include "box.h"
 #include "box_default.h"
@@ -44,11 +45,11 @@ static isom_sidx_t *isom_get_sidx( lsmash_file_t *file, uint32_t reference_ID )
     return isom_non_existing_sidx();
 }
 
-static int isom_finish_fragment_movie( lsmash_file_t *file );
+static int isom_finish_fragment_movie( lsmash_file_t *file, int chunk );
+static int isom_split_fragment_movie( lsmash_file_t *file, int force );
+static isom_trun_optional_row_t *isom_request_trun_optional_row( isom_trun_t *trun, isom_tfhd_t *tfhd, uint32_t sample_number );
 
-/* A movie fragment cannot switch a sample description to another.
- * So you must call this function before switching sample descriptions. */
-int lsmash_create_fragment_movie( lsmash_root_t *root )
+static int isom_create_fragment_movie( lsmash_root_t *root, int chunk )
 {
     if( isom_check_initializer_present( root ) < 0 )
         return LSMASH_ERR_FUNCTION_PARAM;
@@ -57,7 +58,7 @@ int lsmash_create_fragment_movie( lsmash_root_t *root )
      || !file->fragment )
         return LSMASH_ERR_NAMELESS;
     /* Finish and write the current movie fragment before starting a new one. */
-    int ret = isom_finish_fragment_movie( file );
+    int ret = isom_finish_fragment_movie( file, chunk );
     if( ret < 0 )
         return ret;
     /* Add a new movie fragment if the current one is not present or not written. */
@@ -82,6 +83,18 @@ int lsmash_create_fragment_movie( lsmash_root_t *root )
     return 0;
 }
 
+/* A movie fragment cannot switch a sample description to another.
+ * So you must call this function before switching sample descriptions. */
+int lsmash_create_fragment_movie( lsmash_root_t *root )
+{
+    return isom_create_fragment_movie( root, 0 );
+}
+
+int lsmash_create_fragment_chunk( lsmash_root_t *root )
+{
+    return isom_create_fragment_movie( root, 1 );
+}
+
 static inline uint64_t isom_fragment_get_implicit_segment_duration
 (
     isom_cache_t *cache
@@ -140,15 +153,14 @@ static int isom_set_fragment_overall_duration( lsmash_file_t *file )
     return ret;
 }
 
-static int isom_write_fragment_random_access_info( lsmash_file_t *file )
+/* Convert the 'time' fields of the entries added into the Track Fragment Random Access Boxes since the last conversion
+ * from composition times into presentation times, i.e. all of them shall reflect edit list.
+ * The progress of the conversion is kept per track, so the cost is proportional to the number of new entries. */
+static int isom_update_random_access_time( lsmash_file_t *file )
 {
     assert( file == file->initializer );
-    if( LSMASH_IS_NON_EXISTING_BOX( file->mfra ) )
-        return 0;
     if( LSMASH_IS_NON_EXISTING_BOX( file->moov->mvex ) )
         return LSMASH_ERR_NAMELESS;
-    /* Reconstruct the Movie Fragment Random Access Box.
-     * All 'time' field in the Track Fragment Random Access Boxes shall reflect edit list. */
     uint32_t movie_timescale = lsmash_get_movie_timescale( file->root );
     if( movie_timescale == 0 )
         return LSMASH_ERR_NAMELESS; /* Division by zero will occur. */
@@ -160,7 +172,9 @@ static int isom_write_fragment_random_access_info( lsmash_file_t *file )
         /* Get the edit list of the track associated with the trex->track_ID.
          * If failed or absent, implicit timeline mapping edit is used, and skip this operation for the track. */
         isom_trak_t *trak = isom_get_trak( file, trex->track_ID );
-        if( LSMASH_IS_NON_EXISTING_BOX( trak ) )
+        if( LSMASH_IS_NON_EXISTING_BOX( trak )
+         || !trak->cache
+         || !trak->cache->fragment )
             return LSMASH_ERR_NAMELESS;
         if( !trak->edts->elst->list
          || !trak->edts->elst->list->head
@@ -170,14 +184,16 @@ static int isom_write_fragment_random_access_info( lsmash_file_t *file )
         /* Get the Track Fragment Random Access Boxes of the track associated with the trex->track_ID.
          * If failed or absent, skip reconstructing the Track Fragment Random Access Box of the track. */
         isom_tfra_t *tfra = isom_get_tfra( file->mfra, trex->track_ID );
-        if( LSMASH_IS_NON_EXISTING_BOX( tfra ) )
+        if( LSMASH_IS_NON_EXISTING_BOX( tfra ) || !tfra->list )
             continue;
-        /* Reconstruct the Track Fragment Random Access Box. */
-        lsmash_entry_t    *edit_entry      = elst->list->head;
-        isom_elst_entry_t *edit            = edit_entry->data;
-        uint64_t           edit_offset     = 0;     /* units in media timescale */
+        /* Resume the conversion from the entry next to the last converted one. */
+        isom_fragment_t   *fragment        = trak->cache->fragment;
+        lsmash_entry_t    *rap_entry       = fragment->converted_rap ? fragment->converted_rap->next : tfra->list->head;
+        lsmash_entry_t    *edit_entry      = lsmash_list_get_entry( elst->list, fragment->rap_edit_number + 1 );
+        isom_elst_entry_t *edit            = edit_entry ? edit_entry->data : NULL;
+        uint64_t           edit_offset     = fragment->rap_edit_offset;     /* units in media timescale */
         uint32_t           media_timescale = lsmash_get_media_timescale( file->root, trex->track_ID );
-        for( lsmash_entry_t *rap_entry = tfra->list->head; rap_entry; )
+        while( rap_entry )
         {
             isom_tfra_location_time_entry_t *rap = (isom_tfra_location_time_entry_t *)rap_entry->data;
             if( !rap )
@@ -205,6 +221,7 @@ static int isom_write_fragment_random_access_info( lsmash_file_t *file )
                              *         2. The other samples, which precede it in the composition timeline, is in the presentation. */
                 edit_offset += segment_duration;
                 edit_entry   = edit_entry->next;
+                ++ fragment->rap_edit_number;
                 if( !edit_entry )
                 {
                     /* No more presentation. */
@@ -218,7 +235,9 @@ static int isom_write_fragment_random_access_info( lsmash_file_t *file )
                 /* No more presentation.
                  * Drop the rest of sync samples since they are generally absent in the whole presentation.
                  * Though the exceptions are sync samples with earlier composition time, we ignore them. (SAP type 2: TEPT = TDEC = TSAP < TPTF)
-                 * To support this exception, we need sorting entries of the list by composition times. */
+                 * To support this exception, we need sorting entries of the list by composition times.
+                 * An implicit duration of the last edit covers all samples appended so far, so that this happens only
+                 * if the edit list ends at the explicit duration, and then sync samples appended later are also dropped. */
                 while( rap_entry )
                 {
                     lsmash_entry_t *next = rap_entry->next;
@@ -232,15 +251,63 @@ static int isom_write_fragment_random_access_info( lsmash_file_t *file )
             rap->time = edit_offset;
             if( composition_time >= edit->media_time )
                 rap->time += composition_time - edit->media_time;
+            fragment->converted_rap = rap_entry;
             rap_entry = rap_entry->next;
         }
-        tfra->number_of_entry = tfra->list->entry_count;
+        fragment->rap_edit_offset = edit_offset;
+        tfra->number_of_entry     = tfra->list->entry_count;
+    }
+    return 0;
+}
+
+/* Write the Movie Fragment Random Access Box at the current position. */
+static int isom_write_random_access_info_box( lsmash_file_t *file )
+{
+    /* The Movie Fragment Random Access Box might have been written as a checkpoint. */
+    isom_mfra_t *mfra = file->mfra;
+    mfra->manager &= ~LSMASH_WRITTEN_BOX;
+    if( LSMASH_IS_EXISTING_BOX( mfra->mfro ) )
+        mfra->mfro->manager &= ~LSMASH_WRITTEN_BOX;
+    for( lsmash_entry_t *entry = mfra->tfra_list.head; entry; entry = entry->next )
+    {
+        isom_tfra_t *tfra = (isom_tfra_t *)entry->data;
+        if( LSMASH_IS_EXISTING_BOX( tfra ) )
+            tfra->manager &= ~LSMASH_WRITTEN_BOX;
     }
-    /* Decide the size of the Movie Fragment Random Access Box. */
-    if( isom_update_box_size( file->mfra ) == 0 )
+    /* Decide the size of the Movie Fragment Random Access Box and write it. */
+    if( isom_update_box_size( mfra ) == 0 )
         return LSMASH_ERR_NAMELESS;
-    /* Write the Movie Fragment Random Access Box. */
-    return isom_write_box( file->bs, (isom_box_t *)file->mfra );
+    mfra->pos = file->bs->offset;
+    return isom_write_box( file->bs, (isom_box_t *)mfra );
+}
+
+/* Write the random access information of the movie fragments written so far as a checkpoint after the last one,
+ * so that readers can find sync samples in the file before the whole movie is finished.
+ * The checkpoint is not counted in the file, and the next movie fragment is written over it, so the file never has
+ * more than one Movie Fragment Random Access Box and no dead space is left by checkpoints.
+ * Since the complete box written at last has all entries of the checkpoint at least, it covers the checkpoint entirely. */
+static int isom_write_random_access_checkpoint( lsmash_file_t *file )
+{
+    assert( file == file->initializer );
+    int ret;
+    if( (ret = isom_update_random_access_time( file )) < 0
+     || (ret = isom_write_random_access_info_box( file )) < 0
+     || (ret = lsmash_bs_flush_buffer( file->bs )) < 0 )
+        return ret;
+    int64_t ret64 = lsmash_bs_write_seek( file->bs, file->mfra->pos, SEEK_SET );
+    return ret64 < 0 ? ret64 : 0;
+}
+
+static int isom_write_fragment_random_access_info( lsmash_file_t *file )
+{
+    assert( file == file->initializer );
+    if( LSMASH_IS_NON_EXISTING_BOX( file->mfra ) )
+        return 0;
+    /* Complete the Movie Fragment Random Access Box. */
+    int ret = isom_update_random_access_time( file );
+    if( ret < 0 )
+        return ret;
+    return isom_write_random_access_info_box( file );
 }
 
 static int isom_update_indexed_material_offset
@@ -274,6 +341,371 @@ static int isom_update_indexed_material_offset
     return 0;
 }
 
+static uint64_t isom_get_total_segment_index_size( lsmash_file_t *file )
+{
+    uint64_t total_sidx_size = 0;
+    for( lsmash_entry_t *entry = file->sidx_list.head; entry; entry = entry->next )
+    {
+        isom_sidx_t *sidx = (isom_sidx_t *)entry->data;
+        if( LSMASH_IS_NON_EXISTING_BOX( sidx ) )
+            continue;
+        total_sidx_size += sidx->size;
+    }
+    return total_sidx_size;
+}
+
+/* Write a Free Space Box as the space reserved for the Segment Index Boxes in front of the first Movie Fragment Box.
+ * Every Segment Index Box is version 1 at most and indexes a track in the initial movie. The reserved space has room for
+ * a Free Space Box at least so that the slack can be always absorbed by it. */
+static int isom_write_reserved_index_space( lsmash_file_t *file )
+{
+    uint64_t max_sidx_size = ISOM_FULLBOX_COMMON_SIZE + 28 + 12 * (uint64_t)file->reserved_subsegment_count;
+    uint64_t reserved_size = ISOM_BASEBOX_COMMON_SIZE + max_sidx_size * file->initializer->moov->trak_list.entry_count;
+    if( reserved_size > UINT32_MAX )
+    {
+        /* Too large to be reserved by a single box. */
+        file->reserved_subsegment_count = 0;
+        return 0;
+    }
+    lsmash_bs_t *bs = file->bs;
+    file->reserved_index_pos  = bs->offset;
+    file->reserved_index_size = reserved_size;
+    lsmash_bs_put_be32( bs, reserved_size );
+    lsmash_bs_put_be32( bs, ISOM_BOX_TYPE_FREE.fourcc );
+    int err = lsmash_bs_flush_buffer( bs );
+    if( err < 0 )
+        return err;
+    uint64_t padding_size = reserved_size - ISOM_BASEBOX_COMMON_SIZE;
+    static const uint8_t zero_bytes[4096] = { 0 };
+    while( padding_size > sizeof(zero_bytes) )
+    {
+        if( (err = lsmash_bs_write_data( bs, zero_bytes, sizeof(zero_bytes) )) < 0 )
+            return err;
+        padding_size -= sizeof(zero_bytes);
+    }
+    if( (err = lsmash_bs_write_data( bs, zero_bytes, padding_size )) < 0 )
+        return err;
+    file->size += reserved_size;
+    return 0;
+}
+
+/* Write the Segment Index Boxes into the reserved space if they fit in it.
+ * Return 1 if written, 0 if not fit, or a negative value if an error occurs. */
+static int isom_write_segment_indexes_in_reserved_space
+(
+    lsmash_file_t *file,
+    uint64_t       total_sidx_size
+)
+{
+    if( total_sidx_size + ISOM_BASEBOX_COMMON_SIZE > file->reserved_index_size )
+        return 0;
+    /* The anchor point is the first byte following the Segment Index Boxes, so the indexed material starts after the
+     * Free Space Box absorbing the slack. */
+    uint64_t free_size = file->reserved_index_size - total_sidx_size;
+    for( lsmash_entry_t *entry = file->sidx_list.head; entry; entry = entry->next )
+    {
+        isom_sidx_t *sidx = (isom_sidx_t *)entry->data;
+        if( LSMASH_IS_NON_EXISTING_BOX( sidx ) )
+            continue;
+        sidx->first_offset += free_size;
+        if( isom_update_box_size( sidx ) == 0 )
+            return LSMASH_ERR_NAMELESS;
+    }
+    /* Give up if the version of any box has been changed by the above. */
+    if( isom_get_total_segment_index_size( file ) != total_sidx_size )
+    {
+        int ret = isom_update_indexed_material_offset( file, (isom_sidx_t *)file->sidx_list.tail->data );
+        return ret < 0 ? ret : 0;
+    }
+    lsmash_bs_t *bs = file->bs;
+    uint64_t current_pos = bs->offset;
+    int err;
+    if( (err = lsmash_bs_write_seek( bs, file->reserved_index_pos, SEEK_SET )) < 0 )
+        return err;
+    for( lsmash_entry_t *entry = file->sidx_list.head; entry; entry = entry->next )
+    {
+        isom_sidx_t *sidx = (isom_sidx_t *)entry->data;
+        if( LSMASH_IS_NON_EXISTING_BOX( sidx ) )
+            continue;
+        if( (err = isom_write_box( bs, (isom_box_t *)sidx )) < 0 )
+            return err;
+    }
+    /* The rest of the reserved space is already filled with zero bytes. */
+    lsmash_bs_put_be32( bs, free_size );
+    lsmash_bs_put_be32( bs, ISOM_BOX_TYPE_FREE.fourcc );
+    if( (err = lsmash_bs_flush_buffer( bs )) < 0
+     || (err = lsmash_bs_write_seek( bs, current_pos, SEEK_SET )) < 0 )
+        return err;
+    return 1;
+}
+
+/* Move the data in [pos, pos + size) forward by shift bytes.
+ * Copy from the tail so that the data not yet moved is never overwritten. */
+static int isom_shift_data_forward
+(
+    lsmash_bs_t *bs,
+    uint8_t     *buf,
+    size_t       buffer_size,
+    uint64_t     pos,
+    uint64_t     size,
+    uint64_t     shift
+)
+{
+    while( size )
+    {
+        size_t   read_num = LSMASH_MIN( size, buffer_size );
+        uint64_t read_pos = pos + size - read_num;
+        int64_t  ret64;
+        if( (ret64 = lsmash_bs_write_seek( bs, read_pos, SEEK_SET )) < 0 )
+            return ret64;
+        size_t request = read_num;
+        int ret = lsmash_bs_read_data( bs, buf, &read_num );
+        if( ret < 0 )
+            return ret;
+        if( read_num != request )
+            return LSMASH_ERR_INVALID_DATA;
+        if( (ret64 = lsmash_bs_write_seek( bs, read_pos + shift, SEEK_SET )) < 0 )
+            return ret64;
+        if( (ret = lsmash_bs_write_data( bs, buf, read_num )) < 0 )
+            return ret;
+        size -= read_num;
+    }
+    return 0;
+}
+
+/* Build a two-level hierarchical index instead of the flat one if the number of subsegments exceeds subsegments_per_index.
+ * Each top-level Segment Index Box, placed in front of the first Movie Fragment Box, references lower-level Segment Index
+ * Boxes of the same track. Each lower-level one is placed in front of the subsegments it indexes, so that a client can
+ * fetch it on demand. The same subsegments must be indexed for every track since lower-level boxes of all tracks for the
+ * same subsegments are daisy-chained.
+ * Return 1 if written, 0 if a flat index is required, or a negative value if an error occurs. */
+static int isom_write_hierarchical_segment_indexes
+(
+    lsmash_file_t        *file,
+    lsmash_adhoc_remux_t *remux
+)
+{
+    uint32_t subsegment_count = ((isom_sidx_t *)file->sidx_list.head->data)->list->entry_count;
+    uint32_t sidx_count       = file->sidx_list.entry_count;
+    if( subsegment_count <= file->subsegments_per_index )
+        return 0;
+    /* Check whether every Segment Index Box references the same subsegments. */
+    for( lsmash_entry_t *entry = file->sidx_list.head; entry; entry = entry->next )
+    {
+        isom_sidx_t *sidx = (isom_sidx_t *)entry->data;
+        if( LSMASH_IS_NON_EXISTING_BOX( sidx )
+         || sidx->list->entry_count != subsegment_count )
+            return 0;
+        lsmash_entry_t *a_entry = ((isom_sidx_t *)file->sidx_list.head->data)->list->head;
+        for( lsmash_entry_t *b_entry = sidx->list->head; b_entry; b_entry = b_entry->next )
+        {
+            isom_sidx_referenced_item_t *a = (isom_sidx_referenced_item_t *)a_entry->data;
+            isom_sidx_referenced_item_t *b = (isom_sidx_referenced_item_t *)b_entry->data;
+            if( !a || !b || a->reference_size != b->reference_size )
+                return 0;
+            a_entry = a_entry->next;
+        }
+    }
+    uint32_t      group_count = (subsegment_count - 1) / file->subsegments_per_index + 1;
+    isom_sidx_t **child       = lsmash_malloc( (uint64_t)group_count * sidx_count * sizeof(isom_sidx_t *) );
+    uint64_t     *group_pos   = lsmash_malloc( (group_count + 1) * sizeof(uint64_t) * 2 );
+    uint8_t      *buf         = NULL;
+    int ret = LSMASH_ERR_MEMORY_ALLOC;
+    if( !child || !group_pos )
+        goto fail;
+    uint64_t *group_size = group_pos + group_count + 1;    /* the total size of lower-level boxes for each group */
+    /* Move references to subsegments into lower-level boxes and make the top-level boxes reference them. */
+    lsmash_entry_t *top_entry = file->sidx_list.head;
+    for( uint32_t i = 0; i < sidx_count; i++ )
+    {
+        isom_sidx_t *top = (isom_sidx_t *)top_entry->data;
+        top_entry = top_entry->next;
+        lsmash_entry_list_t flat;
+        lsmash_list_move_entries( &flat, top->list );
+        top->reference_count = 0;
+        lsmash_entry_t *entry = flat.head;
+        uint64_t pos  = file->fragment->first_moof_pos;
+        uint64_t time = top->earliest_presentation_time;
+        for( uint32_t j = 0; j < group_count; j++ )
+        {
+            isom_sidx_t                 *sidx = isom_add_sidx( file );
+            isom_sidx_referenced_item_t *data = lsmash_malloc( sizeof(isom_sidx_referenced_item_t) );
+            if( LSMASH_IS_NON_EXISTING_BOX( sidx ) || !data || lsmash_list_add_entry( top->list, data ) < 0 )
+            {
+                lsmash_free( data );
+                lsmash_list_remove_entries( &flat );
+                ret = LSMASH_ERR_NAMELESS;
+                goto fail;
+            }
+            child[j * sidx_count + i] = sidx;
+            sidx->reference_ID               = top->reference_ID;
+            sidx->timescale                  = top->timescale;
+            sidx->earliest_presentation_time = time;
+            sidx->reserved                   = 0;
+            if( i == 0 )
+                group_pos[j] = pos;
+            data->reference_type      = 1;  /* index */
+            data->subsegment_duration = 0;
+            data->starts_with_SAP     = 1;
+            for( uint32_t k = 0; k < file->subsegments_per_index && entry; k++ )
+            {
+                isom_sidx_referenced_item_t *item = (isom_sidx_referenced_item_t *)entry->data;
+                if( lsmash_list_add_entry( sidx->list, item ) < 0 )
+                {
+                    lsmash_list_remove_entries( &flat );
+                    goto fail;
+                }
+                entry->data = NULL;
+                entry       = entry->next;
+                if( k == 0 )
+                {
+                    data->SAP_type       = item->SAP_type;
+                    data->SAP_delta_time = item->SAP_delta_time;
+                }
+                data->subsegment_duration += item->subsegment_duration;
+                data->starts_with_SAP     &= item->starts_with_SAP;
+                time += item->subsegment_duration;
+                pos  += item->reference_size;
+            }
+            sidx->reference_count = sidx->list->entry_count;
+        }
+        lsmash_list_remove_entries( &flat );
+        top->reference_count = top->list->entry_count;
+    }
+    group_pos[group_count] = file->size;
+    /* Establish the offsets within each group of lower-level boxes, which are immediately followed by the subsegments. */
+    uint64_t insertion_size = 0;
+    for( uint32_t j = 0; j < group_count; j++ )
+    {
+        group_size[j] = 0;
+        for( uint32_t i = sidx_count; i; i-- )
+        {
+            isom_sidx_t *sidx = child[j * sidx_count + i - 1];
+            sidx->first_offset = group_size[j];
+            if( isom_update_box_size( sidx ) == 0 )
+            {
+                ret = LSMASH_ERR_NAMELESS;
+                goto fail;
+            }
+            group_size[j] += sidx->size;
+        }
+        insertion_size += group_size[j];
+    }
+    /* Establish the top-level boxes. Their sizes don't depend on the offsets unless the offsets exceed 32-bit. */
+    uint64_t top_size = 0;
+    top_entry = file->sidx_list.head;
+    for( uint32_t i = 0; i < sidx_count; i++ )
+    {
+        isom_sidx_t *top = (isom_sidx_t *)top_entry->data;
+        top_entry = top_entry->next;
+        if( isom_update_box_size( top ) == 0 )
+        {
+            ret = LSMASH_ERR_NAMELESS;
+            goto fail;
+        }
+        top_size += top->size;
+    }
+    insertion_size += top_size;
+    uint64_t top_end     = file->fragment->first_moof_pos;
+    uint64_t group_shift = top_size;
+    for( uint32_t j = 0; j < group_count; j++ )
+    {
+        uint64_t child_pos = group_pos[j] + group_shift;
+        top_entry = file->sidx_list.head;
+        for( uint32_t i = 0; i < sidx_count; i++ )
+        {
+            isom_sidx_t                 *top  = (isom_sidx_t *)top_entry->data;
+            isom_sidx_referenced_item_t *data = (isom_sidx_referenced_item_t *)lsmash_list_get_entry_data( top->list, j + 1 );
+            top_entry = top_entry->next;
+            if( j == 0 )
+            {
+                top_end          += top->size;
+                top->first_offset = child_pos - top_end;
+            }
+            /* The distance to the lower-level box of the same track in the next group, or to the end of the segment. */
+            uint64_t next_pos = file->size + insertion_size;
+            if( j + 1 < group_count )
+            {
+                next_pos = group_pos[j + 1] + group_shift + group_size[j];
+                for( uint32_t k = 0; k < i; k++ )
+                    next_pos += child[(j + 1) * sidx_count + k]->size;
+            }
+            data->reference_size = next_pos - child_pos;
+            child_pos += child[j * sidx_count + i]->size;
+        }
+        group_shift += group_size[j];
+    }
+    /* Move subsegments to make room for lower-level boxes and write all Segment Index Boxes. */
+    lsmash_bs_t *bs = file->bs;
+    size_t buffer_size = LSMASH_MAX( remux->buffer_size, 4096 );
+    if( (buf = lsmash_malloc( buffer_size )) == NULL )
+    {
+        ret = LSMASH_ERR_MEMORY_ALLOC;
+        goto fail;
+    }
+    for( uint32_t j = group_count; j; j-- )
+    {
+        group_shift -= group_size[j - 1];
+        uint64_t pos = group_pos[j - 1];
+        if( (ret = isom_shift_data_forward( bs, buf, buffer_size, pos, group_pos[j] - pos, group_shift + group_size[j - 1] )) < 0 )
+            goto fail;
+        int64_t ret64 = lsmash_bs_write_seek( bs, pos + group_shift, SEEK_SET );
+        if( ret64 < 0 )
+        {
+            ret = ret64;
+            goto fail;
+        }
+        for( uint32_t i = 0; i < sidx_count; i++ )
+            if( (ret = isom_write_box( bs, (isom_box_t *)child[(j - 1) * sidx_count + i] )) < 0 )
+                goto fail;
+        if( remux->func )
+            remux->func( remux->param, group_pos[group_count] - pos, group_pos[group_count] - group_pos[0] );
+    }
+    int64_t ret64 = lsmash_bs_write_seek( bs, file->fragment->first_moof_pos, SEEK_SET );
+    if( ret64 < 0 )
+    {
+        ret = ret64;
+        goto fail;
+    }
+    top_entry = file->sidx_list.head;
+    for( uint32_t i = 0; i < sidx_count; i++ )
+    {
+        if( (ret = isom_write_box( bs, (isom_box_t *)top_entry->data )) < 0 )
+            goto fail;
+        top_entry = top_entry->next;
+    }
+    if( (ret64 = lsmash_bs_write_seek( bs, file->size + insertion_size, SEEK_SET )) < 0 )
+    {
+        ret = ret64;
+        goto fail;
+    }
+    file->size += insertion_size;
+    /* Update 'moof_offset' of each entry within the Track Fragment Random Access Boxes. */
+    if( file->mfra )
+        for( lsmash_entry_t *entry = file->mfra->tfra_list.head; entry; entry = entry->next )
+        {
+            isom_tfra_t *tfra = (isom_tfra_t *)entry->data;
+            if( LSMASH_IS_NON_EXISTING_BOX( tfra ) )
+                continue;
+            for( lsmash_entry_t *rap_entry = tfra->list->head; rap_entry; rap_entry = rap_entry->next )
+            {
+                isom_tfra_location_time_entry_t *rap = (isom_tfra_location_time_entry_t *)rap_entry->data;
+                if( !rap || rap->moof_offset < group_pos[0] )
+                    continue;
+                uint64_t shift = top_size;
+                for( uint32_t j = 0; j < group_count && group_pos[j] <= rap->moof_offset; j++ )
+                    shift += group_size[j];
+                rap->moof_offset += shift;
+            }
+        }
+    ret = 1;
+fail:
+    lsmash_free( buf );
+    lsmash_free( group_pos );
+    lsmash_free( child );
+    return ret;
+}
+
 static int isom_write_segment_indexes
 (
     lsmash_file_t        *file,
@@ -282,17 +714,17 @@ static int isom_write_segment_indexes
 {
     /* Update the size of each Segment Index Box and establish the offset from the anchor point to the indexed material. */
     int ret;
+    if( file->subsegments_per_index
+     && (ret = isom_write_hierarchical_segment_indexes( file, remux )) != 0 )
+        return ret < 0 ? ret : 0;
     if( (ret = isom_update_indexed_material_offset( file, (isom_sidx_t *)file->sidx_list.tail->data )) < 0 )
         return ret;
     /* Get the total size of all Segment Index Boxes. */
-    uint64_t total_sidx_size = 0;
-    for( lsmash_entry_t *entry = file->sidx_list.head; entry; entry = entry->next )
-    {
-        isom_sidx_t *sidx = (isom_sidx_t *)entry->data;
-        if( LSMASH_IS_NON_EXISTING_BOX( sidx ) )
-            continue;
-        total_sidx_size += sidx->size;
-    }
+    uint64_t total_sidx_size = isom_get_total_segment_index_size( file );
+    /* Avoid the rearrangement if the Segment Index Boxes fit in the reserved space. */
+    if( file->reserved_index_size
+     && (ret = isom_write_segment_indexes_in_reserved_space( file, total_sidx_size )) != 0 )
+        return ret < 0 ? ret : 0;
     /* The buffer size must be at least total_sidx_size * 2. */
     size_t buffer_size = total_sidx_size * 2;
     if( remux->buffer_size > buffer_size )
@@ -364,7 +796,7 @@ int isom_finish_final_fragment_movie
 {
     /* Output the final movie fragment. */
     int ret;
-    if( (ret = isom_finish_fragment_movie( file )) < 0 )
+    if( (ret = isom_finish_fragment_movie( file, 0 )) < 0 )
         return ret;
     if( file->bs->unseekable )
         return 0;
@@ -502,6 +934,8 @@ static int isom_output_fragment_media_data( lsmash_file_t *file )
     lsmash_list_remove_entries( frag_manager->pool );
     frag_manager->pool_size    = 0;
     frag_manager->sample_count = 0;
+    frag_manager->memory_size  = 0;
+    frag_manager->spill_size   = 0;     /* The temporary file is reused from the beginning. */
     return 0;
 }
 
@@ -622,211 +1056,643 @@ static int isom_compare_sample_flags( isom_sample_flags_t *a, isom_sample_flags_
         || (a->sample_degradation_priority != b->sample_degradation_priority);
 }
 
-static int isom_make_segment_index_entry
+/* Make the index entry of the current subsegment for a track and prepare for the next subsegment. */
+static int isom_make_subsegment_index_entry
 (
     lsmash_file_t *file,
-    isom_moof_t   *moof
+    uint32_t       track_ID,
+    isom_cache_t  *cache
 )
 {
-    /* Make the index of this subsegment. */
-    for( lsmash_entry_t *entry = moof->traf_list.head; entry; entry = entry->next )
+    isom_fragment_t   *track_fragment = cache->fragment;
+    isom_subsegment_t *subsegment     = &track_fragment->subsegment;
+    isom_sidx_t       *sidx           = isom_get_sidx( file,              track_ID );
+    isom_trak_t       *trak           = isom_get_trak( file->initializer, track_ID );
+    if( LSMASH_IS_NON_EXISTING_BOX( trak->mdia->mdhd ) )
+        return LSMASH_ERR_NAMELESS;
+    if( LSMASH_IS_NON_EXISTING_BOX( sidx ) )
     {
-        isom_traf_t       *traf           = (isom_traf_t *)entry->data;
-        isom_tfhd_t       *tfhd           = traf->tfhd;
-        isom_fragment_t   *track_fragment = traf->cache->fragment;
-        isom_subsegment_t *subsegment     = &track_fragment->subsegment;
-        isom_sidx_t       *sidx           = isom_get_sidx( file,              tfhd->track_ID );
-        isom_trak_t       *trak           = isom_get_trak( file->initializer, tfhd->track_ID );
-        if( LSMASH_IS_NON_EXISTING_BOX( trak->mdia->mdhd ) )
-            return LSMASH_ERR_NAMELESS;
-        assert( LSMASH_IS_EXISTING_BOX( traf->tfdt ) );
+        sidx = isom_add_sidx( file );
         if( LSMASH_IS_NON_EXISTING_BOX( sidx ) )
-        {
-            sidx = isom_add_sidx( file );
-            if( LSMASH_IS_NON_EXISTING_BOX( sidx ) )
-                return LSMASH_ERR_NAMELESS;
-            sidx->reference_ID    = tfhd->track_ID;
-            sidx->timescale       = trak->mdia->mdhd->timescale;
-            sidx->reserved        = 0;
-            sidx->reference_count = 0;
-            int ret = isom_update_indexed_material_offset( file, sidx );
-            if( ret < 0 )
-                return ret;
-        }
-        /* One pair of a Movie Fragment Box with an associated Media Box per subsegment. */
-        isom_sidx_referenced_item_t *data = lsmash_malloc( sizeof(isom_sidx_referenced_item_t) );
-        if( !data )
             return LSMASH_ERR_NAMELESS;
-        if( lsmash_list_add_entry( sidx->list, data ) < 0 )
-        {
-            lsmash_free( data );
-            return LSMASH_ERR_MEMORY_ALLOC;
-        }
-        sidx->reference_count = sidx->list->entry_count;
-        data->reference_type = 0;  /* media */
-        data->reference_size = file->size - moof->pos;
-        /* presentation */
-        uint64_t TSAP;
-        uint64_t TDEC;
-        uint64_t TEPT;
-        uint64_t TPTF;
-        uint64_t composition_duration = subsegment->largest_cts - subsegment->smallest_cts;
-        if( subsegment->smallest_cts != LSMASH_TIMESTAMP_UNDEFINED
-         && subsegment->largest_cts  != LSMASH_TIMESTAMP_UNDEFINED )
-            composition_duration += track_fragment->last_duration;
-        if( trak->edts->elst->list )
+        sidx->reference_ID    = track_ID;
+        sidx->timescale       = trak->mdia->mdhd->timescale;
+        sidx->reserved        = 0;
+        sidx->reference_count = 0;
+        int ret = isom_update_indexed_material_offset( file, sidx );
+        if( ret < 0 )
+            return ret;
+    }
+    /* One or more pairs of a Movie Fragment Box with an associated Media Box per subsegment. */
+    isom_sidx_referenced_item_t *data = lsmash_malloc( sizeof(isom_sidx_referenced_item_t) );
+    if( !data )
+        return LSMASH_ERR_NAMELESS;
+    if( lsmash_list_add_entry( sidx->list, data ) < 0 )
+    {
+        lsmash_free( data );
+        return LSMASH_ERR_MEMORY_ALLOC;
+    }
+    sidx->reference_count = sidx->list->entry_count;
+    data->reference_type = 0;  /* media */
+    data->reference_size = file->size - file->fragment->subsegment_pos;
+    /* presentation */
+    uint64_t TSAP;
+    uint64_t TDEC;
+    uint64_t TEPT;
+    uint64_t TPTF;
+    uint64_t composition_duration = subsegment->largest_cts - subsegment->smallest_cts;
+    if( subsegment->smallest_cts != LSMASH_TIMESTAMP_UNDEFINED
+     && subsegment->largest_cts  != LSMASH_TIMESTAMP_UNDEFINED )
+        composition_duration += track_fragment->last_duration;
+    if( trak->edts->elst->list )
+    {
+        /**-- Explicit edits --**/
+        const isom_elst_t       *elst = trak->edts->elst;
+        const isom_elst_entry_t *edit = NULL;
+        uint32_t movie_timescale = file->initializer->moov->mvhd->timescale;
+        uint64_t pts             = subsegment->segment_duration;
+        int subsegment_in_presentation   = 0;   /* If set to 1, TEPT is available. */
+        int first_rp_in_presentation     = 0;   /* If set to 1, both TSAP and TDEC are available. */
+        int first_sample_in_presentation = 0;   /* If set to 1, TPTF is available. */
+        TSAP = LSMASH_TIMESTAMP_UNDEFINED;
+        TDEC = LSMASH_TIMESTAMP_UNDEFINED;
+        TEPT = LSMASH_TIMESTAMP_UNDEFINED;
+        TPTF = LSMASH_TIMESTAMP_UNDEFINED;
+        /* */
+        for( lsmash_entry_t *elst_entry = elst->list->head; elst_entry; elst_entry = elst_entry->next )
         {
-            /**-- Explicit edits --**/
-            const isom_elst_t       *elst = trak->edts->elst;
-            const isom_elst_entry_t *edit = NULL;
-            uint32_t movie_timescale = file->initializer->moov->mvhd->timescale;
-            uint64_t pts             = subsegment->segment_duration;
-            int subsegment_in_presentation   = 0;   /* If set to 1, TEPT is available. */
-            int first_rp_in_presentation     = 0;   /* If set to 1, both TSAP and TDEC are available. */
-            int first_sample_in_presentation = 0;   /* If set to 1, TPTF is available. */
-            TSAP = LSMASH_TIMESTAMP_UNDEFINED;
-            TDEC = LSMASH_TIMESTAMP_UNDEFINED;
-            TEPT = LSMASH_TIMESTAMP_UNDEFINED;
-            TPTF = LSMASH_TIMESTAMP_UNDEFINED;
-            /* */
-            for( lsmash_entry_t *elst_entry = elst->list->head; elst_entry; elst_entry = elst_entry->next )
+            edit = (isom_elst_entry_t *)elst_entry->data;
+            if( !edit )
+                continue;
+            uint64_t edit_end_pts;
+            uint64_t edit_end_cts;
+            if( edit->segment_duration == ISOM_EDIT_DURATION_IMPLICIT
+             || (elst->version == 0 && edit->segment_duration == ISOM_EDIT_DURATION_UNKNOWN32)
+             || (elst->version == 1 && edit->segment_duration == ISOM_EDIT_DURATION_UNKNOWN64) )
             {
-                edit = (isom_elst_entry_t *)elst_entry->data;
-                if( !edit )
-                    continue;
-                uint64_t edit_end_pts;
-                uint64_t edit_end_cts;
-                if( edit->segment_duration == ISOM_EDIT_DURATION_IMPLICIT
-                 || (elst->version == 0 && edit->segment_duration == ISOM_EDIT_DURATION_UNKNOWN32)
-                 || (elst->version == 1 && edit->segment_duration == ISOM_EDIT_DURATION_UNKNOWN64) )
-                {
-                    edit_end_cts = UINT64_MAX;
-                    edit_end_pts = UINT64_MAX;
-                }
-                else
+                edit_end_cts = UINT64_MAX;
+                edit_end_pts = UINT64_MAX;
+            }
+            else
+            {
+                double segment_duration = edit->segment_duration * ((double)sidx->timescale / movie_timescale);
+                edit_end_cts = edit->media_time + (uint64_t)(segment_duration * ((double)edit->media_rate / (1 << 16)));
+                edit_end_pts = pts + (uint64_t)segment_duration;
+            }
+            if( edit->media_time == ISOM_EDIT_MODE_EMPTY )
+            {
+                pts = edit_end_pts;
+                continue;
+            }
+            if( subsegment->smallest_cts != LSMASH_TIMESTAMP_UNDEFINED
+             && subsegment->largest_cts  != LSMASH_TIMESTAMP_UNDEFINED
+             && ((subsegment->smallest_cts >= edit->media_time && subsegment->smallest_cts < edit_end_cts)
+              || (subsegment->largest_cts  >= edit->media_time && subsegment->largest_cts  < edit_end_cts)) )
+            {
+                /* This subsegment is present in this edit. */
+                double rate = (double)edit->media_rate / (1 << 16);
+                uint64_t start_time = LSMASH_MAX( subsegment->smallest_cts, edit->media_time );
+                if( sidx->reference_count == 1 )
+                    sidx->earliest_presentation_time = pts;
+                if( subsegment_in_presentation == 0 )
                 {
-                    double segment_duration = edit->segment_duration * ((double)sidx->timescale / movie_timescale);
-                    edit_end_cts = edit->media_time + (uint64_t)(segment_duration * ((double)edit->media_rate / (1 << 16)));
-                    edit_end_pts = pts + (uint64_t)segment_duration;
+                    subsegment_in_presentation = 1;
+                    if( subsegment->smallest_cts >= edit->media_time )
+                        TEPT = pts + (uint64_t)((subsegment->smallest_cts - start_time) / rate);
+                    else
+                        TEPT = pts;
                 }
-                if( edit->media_time == ISOM_EDIT_MODE_EMPTY )
+                if( first_rp_in_presentation == 0
+                 && subsegment->first_ed_cts != LSMASH_TIMESTAMP_UNDEFINED
+                 && subsegment->first_rp_cts != LSMASH_TIMESTAMP_UNDEFINED
+                 && ((subsegment->first_ed_cts >= edit->media_time && subsegment->first_ed_cts < edit_end_cts)
+                  || (subsegment->first_rp_cts >= edit->media_time && subsegment->first_rp_cts < edit_end_cts)) )
                 {
-                    pts = edit_end_pts;
-                    continue;
+                    /* FIXME: to distinguish TSAP and TDEC, need something to indicate incorrectly decodable sample. */
+                    first_rp_in_presentation = 1;
+                    if( subsegment->first_ed_cts >= edit->media_time && subsegment->first_ed_cts < edit_end_cts )
+                        TSAP = pts + (uint64_t)((subsegment->first_ed_cts - start_time) / rate);
+                    else
+                        TSAP = pts;
+                    TDEC = TSAP;
                 }
-                if( subsegment->smallest_cts != LSMASH_TIMESTAMP_UNDEFINED
-                 && subsegment->largest_cts  != LSMASH_TIMESTAMP_UNDEFINED
-                 && ((subsegment->smallest_cts >= edit->media_time && subsegment->smallest_cts < edit_end_cts)
-                  || (subsegment->largest_cts  >= edit->media_time && subsegment->largest_cts  < edit_end_cts)) )
+                if( first_sample_in_presentation == 0
+                 && subsegment->first_sample_cts != LSMASH_TIMESTAMP_UNDEFINED
+                 && subsegment->first_sample_cts >= edit->media_time && subsegment->first_sample_cts < edit_end_cts )
                 {
-                    /* This subsegment is present in this edit. */
-                    double rate = (double)edit->media_rate / (1 << 16);
-                    uint64_t start_time = LSMASH_MAX( subsegment->smallest_cts, edit->media_time );
-                    if( sidx->reference_count == 1 )
-                        sidx->earliest_presentation_time = pts;
-                    if( subsegment_in_presentation == 0 )
-                    {
-                        subsegment_in_presentation = 1;
-                        if( subsegment->smallest_cts >= edit->media_time )
-                            TEPT = pts + (uint64_t)((subsegment->smallest_cts - start_time) / rate);
-                        else
-                            TEPT = pts;
-                    }
-                    if( first_rp_in_presentation == 0
-                     && subsegment->first_ed_cts != LSMASH_TIMESTAMP_UNDEFINED
-                     && subsegment->first_rp_cts != LSMASH_TIMESTAMP_UNDEFINED
-                     && ((subsegment->first_ed_cts >= edit->media_time && subsegment->first_ed_cts < edit_end_cts)
-                      || (subsegment->first_rp_cts >= edit->media_time && subsegment->first_rp_cts < edit_end_cts)) )
-                    {
-                        /* FIXME: to distinguish TSAP and TDEC, need something to indicate incorrectly decodable sample. */
-                        first_rp_in_presentation = 1;
-                        if( subsegment->first_ed_cts >= edit->media_time && subsegment->first_ed_cts < edit_end_cts )
-                            TSAP = pts + (uint64_t)((subsegment->first_ed_cts - start_time) / rate);
-                        else
-                            TSAP = pts;
-                        TDEC = TSAP;
-                    }
-                    if( first_sample_in_presentation == 0
-                     && subsegment->first_sample_cts != LSMASH_TIMESTAMP_UNDEFINED
-                     && subsegment->first_sample_cts >= edit->media_time && subsegment->first_sample_cts < edit_end_cts )
-                    {
-                        first_sample_in_presentation = 1;
-                        TPTF = pts + (uint64_t)((subsegment->first_sample_cts - start_time) / rate);
-                    }
-                    uint64_t subsegment_end_pts = pts + (uint64_t)(composition_duration / rate);
-                    pts = LSMASH_MIN( edit_end_pts, subsegment_end_pts );
-                    /* Update subsegment_duration. */
-                    data->subsegment_duration = pts - subsegment->segment_duration;
+                    first_sample_in_presentation = 1;
+                    TPTF = pts + (uint64_t)((subsegment->first_sample_cts - start_time) / rate);
                 }
-                else
-                    /* This subsegment is not present in this edit. */
-                    pts = edit_end_pts;
+                uint64_t subsegment_end_pts = pts + (uint64_t)(composition_duration / rate);
+                pts = LSMASH_MIN( edit_end_pts, subsegment_end_pts );
+                /* Update subsegment_duration. */
+                data->subsegment_duration = pts - subsegment->segment_duration;
             }
+            else
+                /* This subsegment is not present in this edit. */
+                pts = edit_end_pts;
         }
-        else
+    }
+    else
+    {
+        /**-- Implicit edit --**/
+        if( sidx->reference_count == 1 )
+            sidx->earliest_presentation_time = subsegment->smallest_cts;
+        data->subsegment_duration = composition_duration;
+        /* FIXME: to distinguish TSAP and TDEC, need something to indicate incorrectly decodable sample. */
+        TSAP = subsegment->first_rp_cts;
+        TDEC = subsegment->first_rp_cts;
+        TEPT = subsegment->smallest_cts;
+        TPTF = subsegment->first_sample_cts;
+    }
+    /* Decide SAP_type. */
+    data->starts_with_SAP = (subsegment->first_ra_number == 1);
+    data->SAP_type        = 0;
+    data->SAP_delta_time  = 0;
+    if( TSAP != LSMASH_TIMESTAMP_UNDEFINED
+     && TDEC != LSMASH_TIMESTAMP_UNDEFINED
+     && TEPT != LSMASH_TIMESTAMP_UNDEFINED )
+    {
+        if( TPTF != LSMASH_TIMESTAMP_UNDEFINED )
+        {
+            if( TEPT == TDEC && TDEC == TSAP && TSAP == TPTF )
+                data->SAP_type = 1;
+            else if( TEPT == TDEC && TDEC == TSAP && TSAP < TPTF )
+                data->SAP_type = 2;
+            else if( TEPT < TDEC && TDEC == TSAP && TSAP <= TPTF )
+                data->SAP_type = 3;
+            else if( TEPT <= TPTF && TPTF < TDEC && TDEC == TSAP )
+                data->SAP_type = 4;
+        }
+        if( data->SAP_type == 0 )
+        {
+            if( TEPT == TDEC && TDEC < TSAP )
+                data->SAP_type = 5;
+            else if( TEPT < TDEC && TDEC < TSAP )
+                data->SAP_type = 6;
+        }
+        if( data->SAP_type != 0 )
+            data->SAP_delta_time = TSAP - TEPT;
+    }
+    /* Prepare for the next subsegment. */
+    subsegment->segment_duration   += data->subsegment_duration;
+    subsegment->largest_cts         = LSMASH_TIMESTAMP_UNDEFINED;
+    subsegment->smallest_cts        = LSMASH_TIMESTAMP_UNDEFINED;
+    subsegment->first_sample_cts    = LSMASH_TIMESTAMP_UNDEFINED;
+    subsegment->first_ed_cts        = LSMASH_TIMESTAMP_UNDEFINED;
+    subsegment->first_rp_cts        = LSMASH_TIMESTAMP_UNDEFINED;
+    subsegment->first_rp_number     = 0;
+    subsegment->first_ra_number     = 0;
+    subsegment->first_ra_flags      = ISOM_SAMPLE_RANDOM_ACCESS_FLAG_NONE;
+    subsegment->decodable           = 0;
+    subsegment->sample_count        = 0;
+    subsegment->output_sample_count = 0;
+    return 0;
+}
+
+/* Make the index of the current subsegment, which consists of the movie fragments written since the last one was indexed. */
+static int isom_make_segment_index_entry
+(
+    lsmash_file_t *file,
+    isom_moof_t   *moof
+)
+{
+    if( !(file->flags & LSMASH_FILE_MODE_INDEX)
+     || file->max_isom_version < 6
+     || file->fragment->subsegment_pos == FIRST_MOOF_POS_UNDETERMINED )
+        return 0;
+    int ret;
+    for( lsmash_entry_t *entry = moof->traf_list.head; entry; entry = entry->next )
+    {
+        isom_traf_t *traf = (isom_traf_t *)entry->data;
+        assert( LSMASH_IS_EXISTING_BOX( traf->tfdt ) );
+        if( (ret = isom_make_subsegment_index_entry( file, traf->tfhd->track_ID, traf->cache )) < 0 )
+            return ret;
+    }
+    /* Index the tracks that have samples in the preceding movie fragments within this subsegment only. */
+    for( lsmash_entry_t *entry = file->initializer->moov->trak_list.head; entry; entry = entry->next )
+    {
+        isom_trak_t *trak = (isom_trak_t *)entry->data;
+        if( LSMASH_IS_EXISTING_BOX( trak )
+         && trak->cache
+         && trak->cache->fragment
+         && trak->cache->fragment->subsegment.sample_count
+         && (ret = isom_make_subsegment_index_entry( file, trak->tkhd->track_ID, trak->cache )) < 0 )
+            return ret;
+    }
+    file->fragment->subsegment_pos = FIRST_MOOF_POS_UNDETERMINED;
+    return 0;
+}
+
+/* Layouts of a track run for compaction
+ * A layout is a combination of the presence of each column of the table in a track run.
+ *   bit 0: sample_duration
+ *   bit 1: sample_size
+ *   bit 2: sample_composition_time_offset
+ *   bit 3-4: 0: no sample_flags, 1: first_sample_flags only, 2: sample_flags */
+#define ISOM_TRUN_LAYOUT_COUNT 24
+#define ISOM_TRUN_LAYOUT_DURATION( layout )     ((layout) & 0x1)
+#define ISOM_TRUN_LAYOUT_SIZE( layout )         (((layout) >> 1) & 0x1)
+#define ISOM_TRUN_LAYOUT_CTS_OFFSET( layout )   (((layout) >> 2) & 0x1)
+#define ISOM_TRUN_LAYOUT_FLAGS( layout )        ((layout) >> 3)
+#define ISOM_TRUN_HEADER_SIZE   20  /* the size, type, version, tr_flags, sample_count and data_offset fields */
+#define ISOM_TRUN_COST_INFINITY UINT64_MAX
+
+typedef struct
+{
+    uint32_t duration;
+    uint32_t size;
+    uint32_t flags;
+} isom_trun_defaults_t;
+
+typedef struct
+{
+    isom_trun_t *source;
+    uint32_t     first;         /* the index of the first sample in the source track run */
+    uint32_t     count;
+    int          layout;
+    int64_t      data_offset;
+    /* the snapshot of the source track run */
+    uint8_t              version;
+    uint32_t             flags;
+    isom_sample_flags_t  first_flags;
+    lsmash_entry_list_t *optional;
+} isom_trun_piece_t;
+
+static uint32_t isom_pack_sample_flags( const isom_sample_flags_t *flags )
+{
+    return (flags->reserved                  << 28)
+         | (flags->is_leading                << 26)
+         | (flags->sample_depends_on         << 24)
+         | (flags->sample_is_depended_on     << 22)
+         | (flags->sample_has_redundancy     << 20)
+         | (flags->sample_padding_value      << 17)
+         | (flags->sample_is_non_sync_sample << 16)
+         |  flags->sample_degradation_priority;
+}
+
+static int isom_compare_uint32( const uint32_t *a, const uint32_t *b )
+{
+    return *a > *b ? 1 : (*a == *b ? 0 : -1);
+}
+
+/* Get the most frequent value. Note that the values are sorted by this function. */
+static uint32_t isom_get_most_frequent_value( uint32_t *values, uint32_t count )
+{
+    qsort( values, count, sizeof(uint32_t), (int(*)( const void *, const void * ))isom_compare_uint32 );
+    uint32_t mode       = values[0];
+    uint32_t mode_count = 0;
+    for( uint32_t i = 0; i < count; )
+    {
+        uint32_t j = i + 1;
+        while( j < count && values[j] == values[i] )
+            ++j;
+        if( j - i > mode_count )
         {
-            /**-- Implicit edit --**/
-            if( sidx->reference_count == 1 )
-                sidx->earliest_presentation_time = subsegment->smallest_cts;
-            data->subsegment_duration = composition_duration;
-            /* FIXME: to distinguish TSAP and TDEC, need something to indicate incorrectly decodable sample. */
-            TSAP = subsegment->first_rp_cts;
-            TDEC = subsegment->first_rp_cts;
-            TEPT = subsegment->smallest_cts;
-            TPTF = subsegment->first_sample_cts;
+            mode       = values[i];
+            mode_count = j - i;
         }
-        /* Decide SAP_type. */
-        data->starts_with_SAP = (subsegment->first_ra_number == 1);
-        data->SAP_type        = 0;
-        data->SAP_delta_time  = 0;
-        if( TSAP != LSMASH_TIMESTAMP_UNDEFINED
-         && TDEC != LSMASH_TIMESTAMP_UNDEFINED
-         && TEPT != LSMASH_TIMESTAMP_UNDEFINED )
+        i = j;
+    }
+    return mode;
+}
+
+static int isom_trun_layout_accepts
+(
+    int                         layout,
+    isom_trun_optional_row_t   *row,
+    int                         first,
+    const isom_trun_defaults_t *defaults
+)
+{
+    int flags_mode = ISOM_TRUN_LAYOUT_FLAGS( layout );
+    return (ISOM_TRUN_LAYOUT_DURATION( layout )   || row->sample_duration == defaults->duration)
+        && (ISOM_TRUN_LAYOUT_SIZE( layout )       || row->sample_size     == defaults->size)
+        && (ISOM_TRUN_LAYOUT_CTS_OFFSET( layout ) || row->sample_composition_time_offset == 0)
+        && (flags_mode == 2 || (flags_mode == 1 && first) || isom_pack_sample_flags( &row->sample_flags ) == defaults->flags);
+}
+
+static uint64_t isom_trun_layout_row_size( int layout )
+{
+    return 4 * (ISOM_TRUN_LAYOUT_DURATION( layout )
+              + ISOM_TRUN_LAYOUT_SIZE( layout )
+              + ISOM_TRUN_LAYOUT_CTS_OFFSET( layout )
+              + (ISOM_TRUN_LAYOUT_FLAGS( layout ) == 2));
+}
+
+static uint64_t isom_trun_layout_header_size( int layout )
+{
+    return ISOM_TRUN_HEADER_SIZE + (ISOM_TRUN_LAYOUT_FLAGS( layout ) == 1 ? 4 : 0);
+}
+
+/* Find the partition of the samples of a track run into track runs and their layouts with the least encoded size.
+ * The path of the decision for each sample is stored in 'path': the layout of the previous sample, or-ed with 0x80 if
+ * the sample starts a new track run. The layout of the last sample is stored in 'last_layout' if it isn't NULL.
+ * Return the encoded size. */
+static uint64_t isom_find_best_trun_partition
+(
+    isom_trun_optional_row_t  **rows,
+    uint32_t                    count,
+    const isom_trun_defaults_t *defaults,
+    uint8_t                    *path,
+    int                        *last_layout
+)
+{
+    uint64_t cost[ISOM_TRUN_LAYOUT_COUNT];
+    for( int layout = 0; layout < ISOM_TRUN_LAYOUT_COUNT; layout++ )
+    {
+        cost[layout] = isom_trun_layout_accepts( layout, rows[0], 1, defaults )
+                     ? isom_trun_layout_header_size( layout ) + isom_trun_layout_row_size( layout )
+                     : ISOM_TRUN_COST_INFINITY;
+        path[layout] = 0x80;
+    }
+    for( uint32_t i = 1; i < count; i++ )
+    {
+        int best = 0;
+        for( int layout = 1; layout < ISOM_TRUN_LAYOUT_COUNT; layout++ )
+            if( cost[layout] < cost[best] )
+                best = layout;
+        uint64_t next_cost[ISOM_TRUN_LAYOUT_COUNT];
+        uint8_t *next_path = path + i * ISOM_TRUN_LAYOUT_COUNT;
+        for( int layout = 0; layout < ISOM_TRUN_LAYOUT_COUNT; layout++ )
         {
-            if( TPTF != LSMASH_TIMESTAMP_UNDEFINED )
+            uint64_t row_size = isom_trun_layout_row_size( layout );
+            uint64_t extended = cost[layout] != ISOM_TRUN_COST_INFINITY && isom_trun_layout_accepts( layout, rows[i], 0, defaults )
+                              ? cost[layout] + row_size
+                              : ISOM_TRUN_COST_INFINITY;
+            uint64_t started  = isom_trun_layout_accepts( layout, rows[i], 1, defaults )
+                              ? cost[best] + isom_trun_layout_header_size( layout ) + row_size
+                              : ISOM_TRUN_COST_INFINITY;
+            if( started < extended )
+            {
+                next_cost[layout] = started;
+                next_path[layout] = 0x80 | best;
+            }
+            else
+            {
+                next_cost[layout] = extended;
+                next_path[layout] = layout;
+            }
+        }
+        memcpy( cost, next_cost, sizeof(cost) );
+    }
+    int best = 0;
+    for( int layout = 1; layout < ISOM_TRUN_LAYOUT_COUNT; layout++ )
+        if( cost[layout] < cost[best] )
+            best = layout;
+    if( last_layout )
+        *last_layout = best;
+    return cost[best];
+}
+
+/* Choose the default values in the Track Fragment Header Box, and split track runs and choose the fields present in
+ * each of them so that the encoded size of the track fragment becomes the least.
+ * Both duration and size are chosen from the value in the Track Extends Box and the most frequent one in this track
+ * fragment. sample_flags are done in the same way. For each combination of them, the best partition of each track
+ * run is found by dynamic programming over layouts of track runs. */
+static int isom_compact_track_fragment
+(
+    isom_traf_t *traf,
+    isom_trex_t *trex
+)
+{
+    isom_tfhd_t *tfhd         = traf->tfhd;
+    uint32_t     sample_count = 0;
+    for( lsmash_entry_t *entry = traf->trun_list.head; entry; entry = entry->next )
+    {
+        isom_trun_t *trun = (isom_trun_t *)entry->data;
+        if( LSMASH_IS_NON_EXISTING_BOX( trun ) || trun->sample_count == 0 )
+            return LSMASH_ERR_NAMELESS;
+        /* Make a row for every sample. Rows not made yet have the default values in the Track Fragment Header Box. */
+        isom_trun_optional_row_t *row = isom_request_trun_optional_row( trun, tfhd, trun->sample_count );
+        if( !row || trun->optional->entry_count != trun->sample_count )
+            return LSMASH_ERR_NAMELESS;
+        ((isom_trun_optional_row_t *)trun->optional->head->data)->sample_flags = trun->first_sample_flags;
+        sample_count += trun->sample_count;
+    }
+    isom_trun_optional_row_t **rows   = lsmash_malloc( sample_count * (sizeof(isom_trun_optional_row_t *) + sizeof(uint32_t)) );
+    uint8_t                   *path   = lsmash_malloc( sample_count * ISOM_TRUN_LAYOUT_COUNT );
+    isom_trun_piece_t         *pieces = lsmash_malloc( sample_count * sizeof(isom_trun_piece_t) );
+    int err = LSMASH_ERR_MEMORY_ALLOC;
+    if( !rows || !path || !pieces )
+        goto fail;
+    uint32_t *values = (uint32_t *)(rows + sample_count);
+    uint32_t  i      = 0;
+    for( lsmash_entry_t *entry = traf->trun_list.head; entry; entry = entry->next )
+        for( lsmash_entry_t *row_entry = ((isom_trun_t *)entry->data)->optional->head; row_entry; row_entry = row_entry->next )
+            if( (rows[i++] = (isom_trun_optional_row_t *)row_entry->data) == NULL )
             {
-                if( TEPT == TDEC && TDEC == TSAP && TSAP == TPTF )
-                    data->SAP_type = 1;
-                else if( TEPT == TDEC && TDEC == TSAP && TSAP < TPTF )
-                    data->SAP_type = 2;
-                else if( TEPT < TDEC && TDEC == TSAP && TSAP <= TPTF )
-                    data->SAP_type = 3;
-                else if( TEPT <= TPTF && TPTF < TDEC && TDEC == TSAP )
-                    data->SAP_type = 4;
+                err = LSMASH_ERR_NAMELESS;
+                goto fail;
             }
-            if( data->SAP_type == 0 )
+    /* Pick the candidates of default values. */
+    isom_trun_defaults_t candidates[2];
+    candidates[0].duration = trex->default_sample_duration;
+    candidates[0].size     = trex->default_sample_size;
+    candidates[0].flags    = isom_pack_sample_flags( &trex->default_sample_flags );
+    for( i = 0; i < sample_count; i++ )
+        values[i] = rows[i]->sample_duration;
+    candidates[1].duration = isom_get_most_frequent_value( values, sample_count );
+    for( i = 0; i < sample_count; i++ )
+        values[i] = rows[i]->sample_size;
+    candidates[1].size = isom_get_most_frequent_value( values, sample_count );
+    for( i = 0; i < sample_count; i++ )
+        values[i] = isom_pack_sample_flags( &rows[i]->sample_flags );
+    candidates[1].flags = isom_get_most_frequent_value( values, sample_count );
+    /* Find the best combination. */
+    isom_trun_defaults_t best;
+    uint64_t best_cost = ISOM_TRUN_COST_INFINITY;
+    for( int combination = 0; combination < 8; combination++ )
+    {
+        isom_trun_defaults_t defaults;
+        defaults.duration = candidates[ combination       & 1].duration;
+        defaults.size     = candidates[(combination >> 1) & 1].size;
+        defaults.flags    = candidates[(combination >> 2) & 1].flags;
+        uint64_t cost = 4 * ((defaults.duration != candidates[0].duration)
+                           + (defaults.size     != candidates[0].size)
+                           + (defaults.flags    != candidates[0].flags));
+        i = 0;
+        for( lsmash_entry_t *entry = traf->trun_list.head; entry; entry = entry->next )
+        {
+            isom_trun_t *trun = (isom_trun_t *)entry->data;
+            cost += isom_find_best_trun_partition( rows + i, trun->sample_count, &defaults, path, NULL );
+            i += trun->sample_count;
+        }
+        if( cost < best_cost )
+        {
+            best      = defaults;
+            best_cost = cost;
+        }
+    }
+    /* Decide the track runs. */
+    uint32_t piece_count = 0;
+    int      uses_default_duration = 0;
+    int      uses_default_size     = 0;
+    int      uses_default_flags    = 0;
+    i = 0;
+    for( lsmash_entry_t *entry = traf->trun_list.head; entry; entry = entry->next )
+    {
+        isom_trun_t *trun = (isom_trun_t *)entry->data;
+        int layout;
+        isom_find_best_trun_partition( rows + i, trun->sample_count, &best, path, &layout );
+        /* Trace back the best path. The track runs are found in reverse order. */
+        uint32_t first_piece = piece_count;
+        uint32_t end         = trun->sample_count;
+        for( uint32_t k = trun->sample_count; k; k-- )
+        {
+            uint8_t decision = path[(k - 1) * ISOM_TRUN_LAYOUT_COUNT + layout];
+            if( decision & 0x80 )
             {
-                if( TEPT == TDEC && TDEC < TSAP )
-                    data->SAP_type = 5;
-                else if( TEPT < TDEC && TDEC < TSAP )
-                    data->SAP_type = 6;
+                isom_trun_piece_t *piece = &pieces[piece_count++];
+                piece->source = trun;
+                piece->first  = i + k - 1;
+                piece->count  = end - (k - 1);
+                piece->layout = layout;
+                end = k - 1;
             }
-            if( data->SAP_type != 0 )
-                data->SAP_delta_time = TSAP - TEPT;
+            layout = decision & 0x7f;
+        }
+        for( uint32_t a = first_piece, b = piece_count - 1; a < b; a++, b-- )
+        {
+            isom_trun_piece_t temp = pieces[a];
+            pieces[a] = pieces[b];
+            pieces[b] = temp;
+        }
+        /* The data of each track run follows that of the previous one within the source track run. */
+        int64_t data_offset = trun->data_offset;
+        for( uint32_t j = first_piece; j < piece_count; j++ )
+        {
+            isom_trun_piece_t *piece = &pieces[j];
+            piece->data_offset = data_offset;
+            for( uint32_t k = 0; k < piece->count; k++ )
+                data_offset += rows[piece->first + k]->sample_size;
+            int flags_mode = ISOM_TRUN_LAYOUT_FLAGS( piece->layout );
+            uses_default_duration |= !ISOM_TRUN_LAYOUT_DURATION( piece->layout );
+            uses_default_size     |= !ISOM_TRUN_LAYOUT_SIZE( piece->layout );
+            uses_default_flags    |= (flags_mode == 0) || (flags_mode == 1 && piece->count > 1);
+        }
+        i += trun->sample_count;
+    }
+    /* Make the lists of rows for the new track runs. */
+    for( uint32_t j = 0; j < piece_count; j++ )
+        pieces[j].optional = NULL;
+    for( uint32_t j = 0; j < piece_count; j++ )
+    {
+        isom_trun_piece_t *piece = &pieces[j];
+        piece->optional = lsmash_list_create_simple();
+        if( !piece->optional )
+            goto fail_list;
+        for( uint32_t k = 0; k < piece->count; k++ )
+            if( lsmash_list_add_entry( piece->optional, rows[piece->first + k] ) < 0 )
+                goto fail_list;
+        piece->version     = piece->source->version;
+        piece->flags       = piece->source->flags & ISOM_TR_FLAGS_DATA_OFFSET_PRESENT;
+        piece->first_flags = rows[piece->first]->sample_flags;
+    }
+    /* Add track runs and set them up. */
+    for( uint32_t j = traf->trun_list.entry_count; j < piece_count; j++ )
+        if( LSMASH_IS_BOX_ADDITION_FAILURE( isom_add_trun( traf ) ) )
+        {
+            err = LSMASH_ERR_NAMELESS;
+            goto fail_list;
+        }
+    for( lsmash_entry_t *entry = traf->trun_list.head; entry; entry = entry->next )
+    {
+        isom_trun_t *trun = (isom_trun_t *)entry->data;
+        if( trun->optional )
+        {
+            /* The rows have been moved into the new lists. */
+            for( lsmash_entry_t *row_entry = trun->optional->head; row_entry; row_entry = row_entry->next )
+                row_entry->data = NULL;
+            lsmash_list_destroy( trun->optional );
+            trun->optional = NULL;
         }
-        /* Prepare for the next subsegment. */
-        subsegment->segment_duration += data->subsegment_duration;
-        subsegment->largest_cts       = LSMASH_TIMESTAMP_UNDEFINED;
-        subsegment->smallest_cts      = LSMASH_TIMESTAMP_UNDEFINED;
-        subsegment->first_sample_cts  = LSMASH_TIMESTAMP_UNDEFINED;
-        subsegment->first_ed_cts      = LSMASH_TIMESTAMP_UNDEFINED;
-        subsegment->first_rp_cts      = LSMASH_TIMESTAMP_UNDEFINED;
-        subsegment->first_rp_number   = 0;
-        subsegment->first_ra_number   = 0;
-        subsegment->first_ra_flags    = ISOM_SAMPLE_RANDOM_ACCESS_FLAG_NONE;
-        subsegment->decodable         = 0;
     }
+    i = 0;
+    for( lsmash_entry_t *entry = traf->trun_list.head; entry; entry = entry->next )
+    {
+        isom_trun_t       *trun   = (isom_trun_t *)entry->data;
+        isom_trun_piece_t *piece  = &pieces[i++];
+        int                layout = piece->layout;
+        trun->version            = piece->version;
+        trun->flags              = piece->flags;
+        trun->sample_count       = piece->count;
+        trun->data_offset        = piece->data_offset;
+        trun->first_sample_flags = piece->first_flags;
+        trun->optional           = piece->optional;
+        if( trun->data_offset )
+            trun->flags |= ISOM_TR_FLAGS_DATA_OFFSET_PRESENT;
+        if( ISOM_TRUN_LAYOUT_DURATION( layout ) )
+            trun->flags |= ISOM_TR_FLAGS_SAMPLE_DURATION_PRESENT;
+        if( ISOM_TRUN_LAYOUT_SIZE( layout ) )
+            trun->flags |= ISOM_TR_FLAGS_SAMPLE_SIZE_PRESENT;
+        if( ISOM_TRUN_LAYOUT_CTS_OFFSET( layout ) )
+            trun->flags |= ISOM_TR_FLAGS_SAMPLE_COMPOSITION_TIME_OFFSET_PRESENT;
+        if( ISOM_TRUN_LAYOUT_FLAGS( layout ) == 1 )
+            trun->flags |= ISOM_TR_FLAGS_FIRST_SAMPLE_FLAGS_PRESENT;
+        else if( ISOM_TRUN_LAYOUT_FLAGS( layout ) == 2 )
+            trun->flags |= ISOM_TR_FLAGS_SAMPLE_FLAGS_PRESENT;
+    }
+    /* Set up the default values in the Track Fragment Header Box. */
+    tfhd->flags &= ~(ISOM_TF_FLAGS_DEFAULT_SAMPLE_DURATION_PRESENT
+                   | ISOM_TF_FLAGS_DEFAULT_SAMPLE_SIZE_PRESENT
+                   | ISOM_TF_FLAGS_DEFAULT_SAMPLE_FLAGS_PRESENT);
+    tfhd->default_sample_duration = trex->default_sample_duration;
+    tfhd->default_sample_size     = trex->default_sample_size;
+    tfhd->default_sample_flags    = trex->default_sample_flags;
+    if( uses_default_duration && best.duration != candidates[0].duration )
+    {
+        tfhd->flags |= ISOM_TF_FLAGS_DEFAULT_SAMPLE_DURATION_PRESENT;
+        tfhd->default_sample_duration = best.duration;
+    }
+    if( uses_default_size && best.size != candidates[0].size )
+    {
+        tfhd->flags |= ISOM_TF_FLAGS_DEFAULT_SAMPLE_SIZE_PRESENT;
+        tfhd->default_sample_size = best.size;
+    }
+    if( uses_default_flags && best.flags != candidates[0].flags )
+    {
+        tfhd->flags |= ISOM_TF_FLAGS_DEFAULT_SAMPLE_FLAGS_PRESENT;
+        for( i = 0; i < sample_count; i++ )
+            if( isom_pack_sample_flags( &rows[i]->sample_flags ) == best.flags )
+            {
+                tfhd->default_sample_flags = rows[i]->sample_flags;
+                break;
+            }
+    }
+    lsmash_free( pieces );
+    lsmash_free( path );
+    lsmash_free( rows );
     return 0;
+fail_list:
+    /* The rows are still owned by the source track runs. */
+    for( uint32_t j = 0; j < piece_count && pieces[j].optional; j++ )
+    {
+        for( lsmash_entry_t *row_entry = pieces[j].optional->head; row_entry; row_entry = row_entry->next )
+            row_entry->data = NULL;
+        lsmash_list_destroy( pieces[j].optional );
+    }
+fail:
+    lsmash_free( pieces );
+    lsmash_free( path );
+    lsmash_free( rows );
+    return err;
 }
 
 static int isom_finish_fragment_movie
 (
-    lsmash_file_t *file
+    lsmash_file_t *file,
+    int            chunk    /* If set to 1, keep the current subsegment open. */
 )
 {
     if( !file->fragment
      || !file->fragment->pool )
         return LSMASH_ERR_NAMELESS;
+    /* Settle the pending split before finishing. */
+    int ret;
+    if( file->fragment->held
+     && (ret = isom_split_fragment_movie( file, 1 )) < 0 )
+        return ret;
     isom_moof_t *moof = file->fragment->movie;
     if( LSMASH_IS_NON_EXISTING_BOX( moof ) )
     {
@@ -839,7 +1705,7 @@ static int isom_finish_fragment_movie
      * This is a requirement of DASH Media Segment. */
     if( !moof->traf_list.head
      || !moof->traf_list.head->data )
-        return 0;
+        return chunk ? 0 : isom_make_segment_index_entry( file, moof );
     /* Calculate appropriate default_sample_flags of each Track Fragment Header Box.
      * And check whether that default_sample_flags is useful or not. */
     for( lsmash_entry_t *entry = moof->traf_list.head; entry; entry = entry->next )
@@ -853,6 +1719,13 @@ static int isom_finish_fragment_movie
         isom_trex_t *trex = isom_get_trex( file->initializer->moov->mvex, tfhd->track_ID );
         if( LSMASH_IS_NON_EXISTING_BOX( trex ) )
             return LSMASH_ERR_NAMELESS;
+        if( file->compact_movie_fragment )
+        {
+            int err = isom_compact_track_fragment( traf, trex );
+            if( err < 0 )
+                return err;
+            continue;
+        }
         struct sample_flags_stats_t
         {
             uint32_t is_leading               [4];
@@ -972,7 +1845,6 @@ static int isom_finish_fragment_movie
             tfhd->flags &= ~ISOM_TF_FLAGS_DEFAULT_SAMPLE_FLAGS_PRESENT;
     }
     /* Complete the last sample groups in the previous track fragments. */
-    int ret;
     for( lsmash_entry_t *entry = moof->traf_list.head; entry; entry = entry->next )
     {
         isom_traf_t *traf = (isom_traf_t *)entry->data;
@@ -1088,6 +1960,8 @@ static int isom_finish_fragment_movie
         return ret;
     if( file->fragment->first_moof_pos == FIRST_MOOF_POS_UNDETERMINED )
         file->fragment->first_moof_pos = moof->pos;
+    if( file->fragment->subsegment_pos == FIRST_MOOF_POS_UNDETERMINED )
+        file->fragment->subsegment_pos = moof->pos;
     file->size += moof->size;
     /* Output samples. */
     if( (ret = isom_output_fragment_media_data( file )) < 0 )
@@ -1100,9 +1974,13 @@ static int isom_finish_fragment_movie
         if( traf->cache->fragment )
             isom_fragment_reset_sample_counts( traf->cache );
     }
-    if( !(file->flags & LSMASH_FILE_MODE_INDEX) || file->max_isom_version < 6 )
-        return 0;
-    return isom_make_segment_index_entry( file, moof );
+    /* Write the random access information as a checkpoint per the specified number of movie fragments. */
+    if( file->mfra_checkpoint_interval
+     && LSMASH_IS_EXISTING_BOX( file->mfra )
+     && moof->mfhd->sequence_number % file->mfra_checkpoint_interval == 0
+     && (ret = isom_write_random_access_checkpoint( file )) < 0 )
+        return ret;
+    return chunk ? 0 : isom_make_segment_index_entry( file, moof );
 }
 
 #undef GET_MOST_USED
@@ -1187,6 +2065,53 @@ int lsmash_create_fragment_empty_duration
     return 0;
 }
 
+int lsmash_set_fragment_sequence_number
+(
+    lsmash_root_t *root,
+    uint32_t       sequence_number
+)
+{
+    if( isom_check_initializer_present( root ) < 0 || sequence_number == 0 )
+        return LSMASH_ERR_FUNCTION_PARAM;
+    lsmash_file_t *file = root->file;
+    if( !file->fragment )
+        return LSMASH_ERR_NAMELESS;
+    isom_moof_t *moof = file->fragment->movie;
+    if( LSMASH_IS_EXISTING_BOX( moof ) && !(moof->manager & LSMASH_WRITTEN_BOX) )
+    {
+        /* The current movie fragment is already numbered.
+         * Renumber it unless any sample is appended into it. */
+        if( moof->traf_list.entry_count )
+            return LSMASH_ERR_NAMELESS;
+        moof->mfhd->sequence_number = sequence_number;
+        file->fragment_count        = sequence_number;
+    }
+    else
+        file->fragment_count = sequence_number - 1;
+    return 0;
+}
+
+int lsmash_set_segment_presentation_time
+(
+    lsmash_root_t *root,
+    uint32_t       track_ID,
+    uint64_t       presentation_time
+)
+{
+    if( isom_check_initializer_present( root ) < 0 )
+        return LSMASH_ERR_FUNCTION_PARAM;
+    isom_trak_t *trak = isom_get_trak( root->file->initializer, track_ID );
+    if( LSMASH_IS_NON_EXISTING_BOX( trak )
+     || !trak->cache
+     || !trak->cache->fragment )
+        return LSMASH_ERR_NAMELESS;
+    isom_subsegment_t *subsegment = &trak->cache->fragment->subsegment;
+    if( subsegment->sample_count )
+        return LSMASH_ERR_NAMELESS;
+    subsegment->segment_duration = presentation_time;
+    return 0;
+}
+
 int isom_set_fragment_last_duration
 (
     isom_traf_t *traf,
@@ -1242,13 +2167,33 @@ int isom_append_fragment_track_run
     if( !chunk->pool || chunk->pool->size == 0 )
         return 0;
     isom_fragment_manager_t *frag_manager = file->fragment;
+    isom_sample_pool_t      *pool         = chunk->pool;
+    /* A pool holding references to samples doesn't need the buffer for their data. */
+    uint64_t next_pool_alloc = pool->src ? 0 : pool->size;
+    /* Spill the data in the pool out to the temporary file if holding it exceeds the memory limit. */
+    if( !pool->src )
+    {
+        if( file->max_fragment_memory
+         && frag_manager->memory_size + pool->size > file->max_fragment_memory )
+        {
+            if( !frag_manager->spill
+             && !(frag_manager->spill = isom_create_temporary_stream()) )
+                return LSMASH_ERR_IO;
+            int err = isom_spill_sample_pool( pool, frag_manager->spill, frag_manager->spill_size );
+            if( err < 0 )
+                return err;
+            frag_manager->spill_size += pool->size;
+        }
+        else
+            frag_manager->memory_size += pool->size;
+    }
     /* Move data in the pool of the current track fragment to the pool of the current movie fragment.
      * Empty the pool of current track. We don't delete data of samples here. */
-    if( lsmash_list_add_entry( frag_manager->pool, chunk->pool ) < 0 )
+    if( lsmash_list_add_entry( frag_manager->pool, pool ) < 0 )
         return LSMASH_ERR_MEMORY_ALLOC;
-    frag_manager->sample_count += chunk->pool->sample_count;
-    frag_manager->pool_size    += chunk->pool->size;
-    chunk->pool = isom_create_sample_pool( chunk->pool->size );
+    frag_manager->sample_count += pool->sample_count;
+    frag_manager->pool_size    += pool->size;
+    chunk->pool = isom_create_sample_pool( next_pool_alloc );
     return chunk->pool ? 0 : LSMASH_ERR_MEMORY_ALLOC;
 }
 
@@ -1302,18 +2247,13 @@ static int isom_output_fragment_cache( isom_traf_t *traf )
     return 0;
 }
 
-int isom_flush_fragment_pooled_samples
+static int isom_flush_track_fragment
 (
     lsmash_file_t *file,
-    uint32_t       track_ID,
+    isom_traf_t   *traf,
     uint32_t       last_sample_duration
 )
 {
-    isom_traf_t *traf = isom_get_traf( file->fragment->movie, track_ID );
-    if( LSMASH_IS_NON_EXISTING_BOX( traf ) )
-        /* No samples. We don't return as an error here since user might call the flushing function even if the
-         * current movie fragment has no track fragment with this track_ID. */
-        return 0;
     if( !traf->cache
      || !traf->cache->fragment )
         return LSMASH_ERR_NAMELESS;
@@ -1331,7 +2271,10 @@ int isom_flush_fragment_pooled_samples
     int ret = isom_output_fragment_cache( traf );
     if( ret < 0 )
         return ret;
-    return isom_set_fragment_last_duration( traf, last_sample_duration );
+    if( (ret = isom_set_fragment_last_duration( traf, last_sample_duration )) < 0 )
+        return ret;
+    traf->cache->fragment->flushed = 1;
+    return 0;
 }
 
 /* This function doesn't update sample_duration of the last sample in the previous movie fragment.
@@ -1415,14 +2358,16 @@ static void isom_fragment_update_cache_for_sap
 {
     isom_subsegment_t *subsegment = &cache->fragment->subsegment;
     int non_output_sample = (sample->cts == LSMASH_TIMESTAMP_UNDEFINED);
+    subsegment->sample_count        += 1;
+    subsegment->output_sample_count += non_output_sample ? 0 : 1;
     if( !non_output_sample )
     {
-        if( cache->fragment->sample_count == 1 )
+        if( subsegment->sample_count == 1 )
         {
             assert( subsegment->first_sample_cts == LSMASH_TIMESTAMP_UNDEFINED );
             subsegment->first_sample_cts = sample->cts;
         }
-        if( cache->fragment->output_sample_count > 1 )
+        if( subsegment->output_sample_count > 1 )
         {
             assert( subsegment->largest_cts  != LSMASH_TIMESTAMP_UNDEFINED
                  && subsegment->smallest_cts != LSMASH_TIMESTAMP_UNDEFINED );
@@ -1433,7 +2378,7 @@ static void isom_fragment_update_cache_for_sap
         {
             assert( subsegment->largest_cts  == LSMASH_TIMESTAMP_UNDEFINED
                  && subsegment->smallest_cts == LSMASH_TIMESTAMP_UNDEFINED );
-            if( cache->fragment->output_sample_count == 1 )
+            if( subsegment->output_sample_count == 1 )
             {
 
                 subsegment->largest_cts  = sample->cts;
@@ -1446,7 +2391,7 @@ static void isom_fragment_update_cache_for_sap
     {
         assert( subsegment->first_ra_number == 0 );
         subsegment->first_ra_flags  = sample->prop.ra_flags;
-        subsegment->first_ra_number = cache->fragment->sample_count;
+        subsegment->first_ra_number = subsegment->sample_count;
         if( sample->prop.ra_flags & (ISOM_SAMPLE_RANDOM_ACCESS_FLAG_SYNC | ISOM_SAMPLE_RANDOM_ACCESS_FLAG_RAP) )
             subsegment->is_first_recovery_point = 1;
     }
@@ -1671,6 +2616,15 @@ static int isom_fragment_update_sample_tables( isom_traf_t *traf, lsmash_sample_
     return delimit;
 }
 
+/* Add a sample into the pool of the current track fragment.
+ * The sample given by lsmash_append_sample_by_reference() is pooled as a reference to its data in the source stream. */
+static int isom_pool_fragment_sample( isom_cache_t *cache, lsmash_sample_t *sample, uint32_t samples_per_packet )
+{
+    if( cache->fragment->src )
+        return isom_pool_sample_reference( cache->chunk.pool, cache->fragment->src, sample, samples_per_packet );
+    return isom_pool_sample( cache->chunk.pool, sample, samples_per_packet );
+}
+
 static int isom_append_fragment_sample_internal_initial
 (
     isom_trak_t         *trak,
@@ -1688,7 +2642,7 @@ static int isom_append_fragment_sample_internal_initial
         isom_append_fragment_track_run( trak->file, &trak->cache->chunk );
     isom_fragment_update_cache( trak->cache, sample, trak->file );
     /* Add a new sample into the pool of this track fragment. */
-    if( (ret = isom_pool_sample( trak->cache->chunk.pool, sample, samples_per_packet )) < 0 )
+    if( (ret = isom_pool_fragment_sample( trak->cache, sample, samples_per_packet )) < 0 )
         return ret;
     return 0;
 }
@@ -1709,11 +2663,176 @@ static int isom_append_fragment_sample_internal
         isom_append_fragment_track_run( traf->file, &traf->cache->chunk );
     isom_fragment_update_cache( traf->cache, sample, traf->file );
     /* Add a new sample into the pool of this track fragment. */
-    if( (ret = isom_pool_sample( traf->cache->chunk.pool, sample, 1 )) < 0 )
+    if( (ret = isom_pool_fragment_sample( traf->cache, sample, 1 )) < 0 )
         return ret;
     return 0;
 }
 
+/* Get the total size of samples in the current movie fragment including the ones not delimited into track runs yet. */
+static uint64_t isom_get_fragment_media_size( lsmash_file_t *file )
+{
+    uint64_t media_size = file->fragment->pool_size;
+    for( lsmash_entry_t *entry = file->fragment->movie->traf_list.head; entry; entry = entry->next )
+    {
+        isom_traf_t *traf = (isom_traf_t *)entry->data;
+        if( LSMASH_IS_EXISTING_BOX( traf ) && traf->cache && traf->cache->chunk.pool )
+            media_size += traf->cache->chunk.pool->size;
+    }
+    return media_size;
+}
+
+/* A sample or a flush request held until the current movie fragment is split automatically. */
+typedef struct
+{
+    isom_trak_t         *trak;
+    lsmash_sample_t     *sample;            /* NULL means a flush request */
+    isom_sample_entry_t *sample_entry;
+    lsmash_bs_t         *src;               /* source stream of the sample appended by reference, or NULL */
+    uint32_t             last_duration;     /* the last sample duration given by a flush request */
+} isom_held_sample_t;
+
+static void isom_remove_held_sample( isom_held_sample_t *held )
+{
+    if( !held )
+        return;
+    lsmash_delete_sample( held->sample );
+    lsmash_free( held );
+}
+
+static int isom_has_held_samples( isom_fragment_manager_t *fragment, uint32_t track_ID )
+{
+    if( !fragment->held )
+        return 0;
+    for( lsmash_entry_t *entry = fragment->held->head; entry; entry = entry->next )
+    {
+        isom_held_sample_t *held = (isom_held_sample_t *)entry->data;
+        if( held && held->trak->tkhd->track_ID == track_ID )
+            return 1;
+    }
+    return 0;
+}
+
+/* Finish and write the current movie fragment, and then start a new one with the held samples,
+ * if the durations of the last samples of all track fragments in the current one are decided.
+ * If 'force' is set to 1, the undecided durations are taken over from the previous samples. */
+static int isom_split_fragment_movie
+(
+    lsmash_file_t *file,
+    int            force
+)
+{
+    isom_fragment_manager_t *fragment = file->fragment;
+    for( lsmash_entry_t *entry = fragment->movie->traf_list.head; entry; entry = entry->next )
+    {
+        isom_traf_t *traf = (isom_traf_t *)entry->data;
+        if( LSMASH_IS_NON_EXISTING_BOX( traf )
+         || !traf->cache
+         || !traf->cache->fragment )
+            return LSMASH_ERR_NAMELESS;
+        if( traf->cache->fragment->flushed )
+            continue;
+        if( !force )
+            return 0;
+        int ret = isom_flush_track_fragment( file, traf, traf->cache->fragment->last_duration );
+        if( ret < 0 )
+            return ret;
+    }
+    /* Take the held ones out before starting a new movie fragment since they might be held again. */
+    lsmash_entry_list_t *held_list = fragment->held;
+    fragment->held = NULL;
+    int ret = lsmash_create_fragment_chunk( file->root );
+    for( lsmash_entry_t *entry = held_list->head; entry && ret == 0; entry = entry->next )
+    {
+        isom_held_sample_t *held = (isom_held_sample_t *)entry->data;
+        if( !held->sample )
+        {
+            ret = isom_flush_fragment_pooled_samples( file, held->trak->tkhd->track_ID, held->last_duration );
+            continue;
+        }
+        held->trak->cache->fragment->src = held->src;
+        ret = isom_append_fragment_sample( file, held->trak, held->sample, held->sample_entry );
+        held->trak->cache->fragment->src = NULL;
+        if( ret == 0 )
+            held->sample = NULL;    /* The sample has been owned again. */
+    }
+    lsmash_list_destroy( held_list );
+    return ret;
+}
+
+/* Hold a sample or a flush request (if 'sample' is NULL) until the current movie fragment is split.
+ * The first sample held for each track decides the duration of the last sample in its track fragment. */
+static int isom_hold_fragment_sample
+(
+    lsmash_file_t       *file,
+    isom_trak_t         *trak,
+    lsmash_sample_t     *sample,
+    isom_sample_entry_t *sample_entry,
+    uint32_t             last_duration
+)
+{
+    isom_fragment_manager_t *fragment = file->fragment;
+    if( !fragment->held
+     && (fragment->held = lsmash_list_create( isom_remove_held_sample )) == NULL )
+        return LSMASH_ERR_MEMORY_ALLOC;
+    isom_traf_t *traf = isom_get_traf( fragment->movie, trak->tkhd->track_ID );
+    if( sample
+     && LSMASH_IS_EXISTING_BOX( traf )
+     && traf->cache
+     && traf->cache->fragment
+     && !traf->cache->fragment->flushed )
+    {
+        uint64_t prev_dts = traf->cache->timestamp.dts;
+        if( sample->dts <= prev_dts
+         || sample->dts >  prev_dts + UINT32_MAX )
+            return LSMASH_ERR_INVALID_DATA;
+        int ret = isom_flush_track_fragment( file, traf, sample->dts - prev_dts );
+        if( ret < 0 )
+            return ret;
+    }
+    isom_held_sample_t *held = lsmash_malloc( sizeof(isom_held_sample_t) );
+    if( !held )
+        return LSMASH_ERR_MEMORY_ALLOC;
+    held->trak          = trak;
+    held->sample        = sample;
+    held->sample_entry  = sample_entry;
+    held->src           = trak->cache->fragment->src;
+    held->last_duration = last_duration;
+    if( lsmash_list_add_entry( fragment->held, held ) < 0 )
+    {
+        lsmash_free( held );
+        return LSMASH_ERR_MEMORY_ALLOC;
+    }
+    return isom_split_fragment_movie( file, 0 );
+}
+
+int isom_flush_fragment_pooled_samples
+(
+    lsmash_file_t *file,
+    uint32_t       track_ID,
+    uint32_t       last_sample_duration
+)
+{
+    isom_fragment_manager_t *fragment = file->fragment;
+    if( fragment->held && isom_has_held_samples( fragment, track_ID ) )
+    {
+        /* The samples of this track after the split are held, so is this request. */
+        isom_trak_t *trak = isom_get_trak( file->initializer, track_ID );
+        if( LSMASH_IS_NON_EXISTING_BOX( trak ) || !trak->cache || !trak->cache->fragment )
+            return LSMASH_ERR_NAMELESS;
+        return isom_hold_fragment_sample( file, trak, NULL, NULL, last_sample_duration );
+    }
+    isom_traf_t *traf = isom_get_traf( fragment->movie, track_ID );
+    if( LSMASH_IS_NON_EXISTING_BOX( traf ) )
+        /* No samples. We don't return as an error here since user might call the flushing function even if the
+         * current movie fragment has no track fragment with this track_ID. */
+        return 0;
+    int ret = isom_flush_track_fragment( file, traf, last_sample_duration );
+    if( ret < 0 )
+        return ret;
+    /* This might decide the duration of the last track fragment undecided for the pending split. */
+    return fragment->held ? isom_split_fragment_movie( file, 0 ) : 0;
+}
+
 int isom_append_fragment_sample
 (
     lsmash_file_t       *file,
@@ -1740,6 +2859,21 @@ int isom_append_fragment_sample
             file->size += styp->size;
         }
     }
+    /* Reserve the space for the Segment Index Boxes in front of the first Movie Fragment Box if required. */
+    if( file->reserved_subsegment_count
+     && file->reserved_index_size == 0
+     && (file->flags & LSMASH_FILE_MODE_MEDIA)
+     && (file->flags & LSMASH_FILE_MODE_INDEX)
+     && (file->flags & LSMASH_FILE_MODE_SEGMENT)
+     && file->max_isom_version >= 6
+     && !file->bs->unseekable
+     && LSMASH_IS_EXISTING_BOX( fragment->movie )
+     && fragment->first_moof_pos == FIRST_MOOF_POS_UNDETERMINED )
+    {
+        int ret = isom_write_reserved_index_space( file );
+        if( ret < 0 )
+            return ret;
+    }
     int (*func_append_sample)( void *, lsmash_sample_t *, isom_sample_entry_t * ) = NULL;
     void *track_fragment;
     if( LSMASH_IS_NON_EXISTING_BOX( fragment->movie ) )
@@ -1757,6 +2891,18 @@ int isom_append_fragment_sample
          * as a safety, reject non-output samples here. */
         if( sample->cts == LSMASH_TIMESTAMP_UNDEFINED )
             return LSMASH_ERR_INVALID_DATA;
+        /* Split the current movie fragment at a sync sample if its media data would exceed the limit by this sample.
+         * The durations of the last samples in the current movie fragment are decided by the next samples,
+         * so hold samples until the next sample of every track fragment comes. */
+        if( fragment->held )
+            return isom_hold_fragment_sample( file, trak, sample, sample_entry, 0 );
+        if( file->max_fragment_size
+         && (sample->prop.ra_flags & ISOM_SAMPLE_RANDOM_ACCESS_FLAG_SYNC) )
+        {
+            uint64_t media_size = isom_get_fragment_media_size( file );
+            if( media_size && media_size + sample->length > file->max_fragment_size )
+                return isom_hold_fragment_sample( file, trak, sample, sample_entry, 0 );
+        }
         isom_traf_t *traf = isom_get_traf( fragment->movie, trak->tkhd->track_ID );
         if( LSMASH_IS_NON_EXISTING_BOX( traf ) )
         {
@@ -1778,6 +2924,7 @@ int isom_append_fragment_sample
             return LSMASH_ERR_NAMELESS;
         func_append_sample = (int (*)( void *, lsmash_sample_t *, isom_sample_entry_t * ))isom_append_fragment_sample_internal;
         track_fragment = traf;
+        traf->cache->fragment->flushed = 0;
     }
     return isom_append_sample_by_type( track_fragment, sample, sample_entry, func_append_sample );
 }
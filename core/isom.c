@@ -372,13 +372,21 @@ static int isom_convert_stco_to_co64( isom_stbl_t *stbl )
         err = LSMASH_ERR_NAMELESS;
         goto fail;
     }
-    /* move chunk_offset to co64 from stco */
+    /* Widen each chunk_offset in place and hand over the entries to co64 from stco.
+     * Reallocating the entry data is much cheaper than reconstructing the whole list. */
     for( lsmash_entry_t *entry = stco->list->head; entry; entry = entry->next )
     {
-        isom_stco_entry_t *data = (isom_stco_entry_t*)entry->data;
-        if( (err = isom_add_co64_entry( stbl, data->chunk_offset )) < 0 )
+        uint32_t           chunk_offset = ((isom_stco_entry_t *)entry->data)->chunk_offset;
+        isom_co64_entry_t *data         = lsmash_realloc( entry->data, sizeof(isom_co64_entry_t) );
+        if( !data )
+        {
+            err = LSMASH_ERR_MEMORY_ALLOC;
             goto fail;
+        }
+        data->chunk_offset = chunk_offset;
+        entry->data        = data;
     }
+    lsmash_list_move_entries( stbl->stco->list, stco->list );
 fail:
     isom_remove_box_by_itself( stco );
     return err;
@@ -1231,6 +1239,13 @@ int isom_setup_handler_reference( isom_hdlr_t *hdlr, uint32_t media_type )
     return 0;
 }
 
+/* Whether 64-bit chunk offsets are expected to be required from the beginning. */
+static int isom_requires_large_offset( lsmash_file_t *file )
+{
+    return file->expected_output_size > UINT32_MAX
+        || (LSMASH_IS_EXISTING_BOX( file->mdat ) && file->mdat->reserved_size > UINT32_MAX);
+}
+
 isom_trak_t *isom_track_create( lsmash_file_t *file, lsmash_media_type media_type )
 {
     /* Don't allow to create a new track if the initial movie is already written. */
@@ -1250,7 +1265,9 @@ isom_trak_t *isom_track_create( lsmash_file_t *file, lsmash_media_type media_typ
      || LSMASH_IS_BOX_ADDITION_FAILURE( isom_add_stsd( trak->mdia->minf->stbl ) )
      || LSMASH_IS_BOX_ADDITION_FAILURE( isom_add_stts( trak->mdia->minf->stbl ) )
      || LSMASH_IS_BOX_ADDITION_FAILURE( isom_add_stsc( trak->mdia->minf->stbl ) )
-     || LSMASH_IS_BOX_ADDITION_FAILURE( isom_add_stco( trak->mdia->minf->stbl ) )
+     || LSMASH_IS_BOX_ADDITION_FAILURE( isom_requires_large_offset( file )
+                                        ? isom_add_co64( trak->mdia->minf->stbl )
+                                        : isom_add_stco( trak->mdia->minf->stbl ) )
      || LSMASH_IS_BOX_ADDITION_FAILURE( isom_add_stsz( trak->mdia->minf->stbl ) ) )
         goto fail;
     if( LSMASH_IS_BOX_ADDITION_FAILURE( isom_add_hdlr( trak->mdia ) )
@@ -2245,9 +2262,90 @@ int lsmash_reserve_media_data_size
     if( LSMASH_IS_BOX_ADDITION_FAILURE( isom_add_mdat( file ) ) )
         return LSMASH_ERR_NAMELESS;
     file->mdat->reserved_size = media_data_size;
+    if( isom_requires_large_offset( file ) )
+        /* Switch the existing tracks to 64-bit chunk offsets while they have no chunk yet. */
+        for( lsmash_entry_t *entry = file->moov->trak_list.head; entry; entry = entry->next )
+        {
+            isom_stbl_t *stbl = ((isom_trak_t *)entry->data)->mdia->minf->stbl;
+            int err;
+            if( !stbl->stco->large_presentation
+             && (err = isom_convert_stco_to_co64( stbl )) < 0 )
+                return err;
+        }
     return 0;
 }
 
+int lsmash_reserve_movie_size
+(
+    lsmash_root_t        *root,
+    uint64_t              movie_size
+)
+{
+    if( isom_check_initializer_present( root ) < 0
+     || movie_size < ISOM_BASEBOX_COMMON_SIZE
+     || movie_size > UINT32_MAX )
+        return LSMASH_ERR_FUNCTION_PARAM;
+    lsmash_file_t *file = root->file->initializer;
+    if( (LSMASH_IS_EXISTING_BOX( file->mdat ) && (file->mdat->manager & LSMASH_INCOMPLETE_BOX))    /* whether the Media Data Box is already written or not */
+     || file->fragment )                                                                        /* For fragmented movies, this function makes no sense. */
+        return LSMASH_ERR_NAMELESS;
+    file->reserved_movie_size = movie_size;
+    return 0;
+}
+
+/* Write a Free Space Box as the space reserved for the Movie Box. */
+static int isom_write_reserved_movie_space( lsmash_file_t *file )
+{
+    lsmash_bs_t *bs = file->bs;
+    file->reserved_movie_pos = bs->offset;
+    lsmash_bs_put_be32( bs, file->reserved_movie_size );
+    lsmash_bs_put_be32( bs, ISOM_BOX_TYPE_FREE.fourcc );
+    int err = lsmash_bs_flush_buffer( bs );
+    if( err < 0 )
+        return err;
+    uint64_t padding_size = file->reserved_movie_size - ISOM_BASEBOX_COMMON_SIZE;
+    static const uint8_t zero_bytes[4096] = { 0 };
+    while( padding_size > sizeof(zero_bytes) )
+    {
+        if( (err = lsmash_bs_write_data( bs, zero_bytes, sizeof(zero_bytes) )) < 0 )
+            return err;
+        padding_size -= sizeof(zero_bytes);
+    }
+    if( (err = lsmash_bs_write_data( bs, zero_bytes, padding_size )) < 0 )
+        return err;
+    file->size += file->reserved_movie_size;
+    return 0;
+}
+
+/* Write the Movie Box and a Meta Box into the reserved space if they fit in it.
+ * Return 1 if written, 0 if not fit, or a negative value if an error occurs. */
+static int isom_write_movie_in_reserved_space( lsmash_file_t *file, uint64_t mtf_size )
+{
+    lsmash_bs_t *bs = file->bs;
+    uint64_t free_size = file->reserved_movie_size - LSMASH_MIN( mtf_size, file->reserved_movie_size );
+    if( bs->unseekable
+     || mtf_size > file->reserved_movie_size
+     || (free_size > 0 && free_size < ISOM_BASEBOX_COMMON_SIZE) )
+        return 0;
+    uint64_t current_pos = bs->offset;
+    int err;
+    if( (err = lsmash_bs_write_seek( bs, file->reserved_movie_pos, SEEK_SET )) < 0
+     || (err = isom_write_box( bs, (isom_box_t *)file->moov ))                < 0
+     || (err = isom_write_box( bs, (isom_box_t *)file->meta ))                < 0 )
+        return err;
+    if( free_size )
+    {
+        /* The rest of the reserved space is already filled with zero bytes. */
+        lsmash_bs_put_be32( bs, free_size );
+        lsmash_bs_put_be32( bs, ISOM_BOX_TYPE_FREE.fourcc );
+        if( (err = lsmash_bs_flush_buffer( bs )) < 0 )
+            return err;
+    }
+    if( (err = lsmash_bs_write_seek( bs, current_pos, SEEK_SET )) < 0 )
+        return err;
+    return 1;
+}
+
 static int isom_scan_trak_profileLevelIndication
 (
     isom_trak_t                         *trak,
@@ -2475,6 +2573,106 @@ int isom_establish_movie( lsmash_file_t *file )
     return 0;
 }
 
+/* Write the Movie Box and a Meta Box at the position of the Media Data Box after moving it forward by 'shift' bytes.
+ * 'head_size' bytes preceding the position are rewritten from 'head' in advance if present. */
+static int isom_write_movie_in_front_of_media_data
+(
+    lsmash_file_t *file,
+    uint64_t       shift,
+    uint8_t       *head,
+    uint64_t       head_size
+)
+{
+    lsmash_bs_t *bs       = file->bs;
+    isom_mdat_t *mdat     = file->mdat;
+    uint64_t     mtf_size = file->moov->size + (LSMASH_IS_EXISTING_BOX( file->meta ) ? file->meta->size : 0);
+    isom_add_preceding_box_size( file->moov, shift );
+    int err;
+    if( (err = lsmash_bs_write_seek( bs, mdat->pos - head_size, SEEK_SET )) < 0
+     || (head_size && (err = lsmash_bs_write_data( bs, head, head_size )) < 0)
+     || (err = isom_write_box( bs, (isom_box_t *)file->moov ))            < 0
+     || (err = isom_write_box( bs, (isom_box_t *)file->meta ))            < 0 )
+        return err;
+    if( shift > mtf_size )
+    {
+        /* Fill the gap with a Free Space Box. */
+        lsmash_bs_put_be32( bs, shift - mtf_size );
+        lsmash_bs_put_be32( bs, ISOM_BOX_TYPE_FREE.fourcc );
+        if( (err = lsmash_bs_flush_buffer( bs )) < 0 )
+            return err;
+    }
+    mdat->pos  += shift;
+    file->size += shift;
+    return lsmash_bs_write_seek( bs, file->size, SEEK_SET ) < 0 ? LSMASH_ERR_IO : 0;
+}
+
+/* Move the Movie Box and a Meta Box to the front of the Media Data Box with the help of the kernel.
+ * First, try to insert blocks in front of the Media Data Box, which requires no data copy at all. The gap between
+ * the boxes moved to front and the Media Data Box is filled with a Free Space Box. If unavailable, try to move the
+ * Media Data Box without copying the data through user space.
+ * Return LSMASH_ERR_PATCH_WELCOME if neither is available, and then nothing is modified. */
+static int isom_move_movie_to_front_by_kernel
+(
+    lsmash_file_t        *file,
+    lsmash_adhoc_remux_t *remux,
+    uint64_t              meta_size
+)
+{
+    isom_moov_t *moov = file->moov;
+    isom_mdat_t *mdat = file->mdat;
+    uint64_t block_size = isom_get_file_block_size( file );
+    if( block_size == 0 )
+        return LSMASH_ERR_PATCH_WELCOME;
+    int err;
+    /* The shift must be a multiple of the block size and leave enough room for the Free Space Box if any gap. */
+    uint64_t mtf_size;
+    uint64_t shift;
+    uint64_t moov_size;
+    do
+    {
+        moov_size = moov->size;
+        mtf_size  = moov->size + meta_size;
+        shift     = (mtf_size + block_size - 1) / block_size * block_size;
+        if( shift > mtf_size && shift - mtf_size < ISOM_BASEBOX_COMMON_SIZE )
+            shift += block_size;
+        if( (err = isom_check_large_offset_requirement( moov, meta_size + shift - mtf_size )) < 0 )
+            return err;
+    } while( moov->size != moov_size );
+    /* The bytes preceding the Media Data Box in the first block are shifted together.
+     * Back them up to restore at the original position. */
+    uint64_t block_pos = mdat->pos / block_size * block_size;
+    uint64_t head_size = mdat->pos - block_pos;
+    uint8_t *head      = NULL;
+    if( head_size )
+    {
+        if( (head = lsmash_malloc( head_size )) == NULL )
+            return LSMASH_ERR_MEMORY_ALLOC;
+        size_t read_size = head_size;
+        if( (err = lsmash_bs_write_seek( file->bs, block_pos, SEEK_SET )) < 0
+         || (err = lsmash_bs_read_data( file->bs, head, &read_size )) < 0 )
+            goto fail;
+        if( read_size != head_size )
+        {
+            err = LSMASH_ERR_IO;
+            goto fail;
+        }
+    }
+    if( (err = isom_insert_file_range( file, block_pos, shift )) == 0 )
+        err = isom_write_movie_in_front_of_media_data( file, shift, head, head_size );
+    else if( err == LSMASH_ERR_PATCH_WELCOME )
+    {
+        /* Move the Media Data Box by the exact size of the boxes moved to front. */
+        shift = mtf_size;
+        if( (err = isom_shift_file_data( file, remux, mdat->pos, shift )) == 0 )
+            err = isom_write_movie_in_front_of_media_data( file, shift, NULL, 0 );
+    }
+    if( err == 0 && remux->func )
+        remux->func( remux->param, file->size, file->size );
+fail:
+    lsmash_free( head );
+    return err;
+}
+
 int lsmash_finish_movie
 (
     lsmash_root_t        *root,
@@ -2542,8 +2740,18 @@ int lsmash_finish_movie
     file->mdat->manager &= ~LSMASH_INCOMPLETE_BOX;
     if( (err = isom_write_box( bs, (isom_box_t *)file->mdat )) < 0 )
         return err;
-    /* Write the Movie Box and a Meta Box if no optimization for progressive download. */
     uint64_t meta_size = LSMASH_IS_EXISTING_BOX( file->meta ) ? file->meta->size : 0;
+    /* Write the Movie Box and a Meta Box into the reserved space if any.
+     * In this case, any chunk offset does not change. */
+    if( file->reserved_movie_size )
+    {
+        if( (err = isom_write_movie_in_reserved_space( file, moov->size + meta_size )) < 0 )
+            return err;
+        if( err == 1 )
+            return 0;
+        lsmash_log( NULL, LSMASH_LOG_WARNING, "the reserved space is too small for the Movie Box.\n" );
+    }
+    /* Write the Movie Box and a Meta Box if no optimization for progressive download. */
     if( !remux )
     {
         if( (err = isom_write_box( bs, (isom_box_t *)file->moov )) < 0
@@ -2555,6 +2763,9 @@ int lsmash_finish_movie
     /* stco->co64 conversion, depending on last chunk's offset */
     if( (err = isom_check_large_offset_requirement( moov, meta_size )) < 0 )
         return err;
+    /* Let the kernel move the data if possible. */
+    if( (err = isom_move_movie_to_front_by_kernel( file, remux, meta_size )) != LSMASH_ERR_PATCH_WELCOME )
+        return err;
     /* now the amount of offset is fixed. */
     uint64_t mtf_size = moov->size + meta_size;     /* sum of size of boxes moved to front */
     /* buffer size must be at least mtf_size * 2 */
@@ -2664,11 +2875,9 @@ int lsmash_set_last_sample_delta( lsmash_root_t *root, uint32_t track_ID, uint32
             isom_stts_entry_t *stts_data = (isom_stts_entry_t *)entry->data;
             if( !stts_data )
                 return LSMASH_ERR_INVALID_DATA;
-            for( uint32_t k = exclude_last_sample; k < stts_data->sample_count && j > 1; k++ )
-            {
-                sample_delta -= stts_data->sample_delta;
-                --j;
-            }
+            uint32_t k = LSMASH_MIN( stts_data->sample_count > exclude_last_sample ? stts_data->sample_count - exclude_last_sample : 0, j - 1 );
+            sample_delta -= (uint64_t)k * stts_data->sample_delta;
+            j            -= k;
             exclude_last_sample = 0;
         }
     }
@@ -2911,6 +3120,7 @@ void isom_remove_sample_pool( isom_sample_pool_t *pool )
     if( !pool )
         return;
     lsmash_free( pool->data );
+    lsmash_free( pool->extents );
     lsmash_free( pool );
 }
 
@@ -3055,6 +3265,75 @@ static int isom_add_timestamp( isom_stbl_t *stbl, isom_cache_t *cache, lsmash_fi
     return 0;
 }
 
+/* Add the sizes of samples having the same size. */
+static int isom_add_constant_sizes( isom_stbl_t *stbl, uint32_t sample_size, uint32_t sample_count )
+{
+    isom_stsz_t *stsz = stbl->stsz;
+    if( LSMASH_IS_EXISTING_BOX( stsz )
+     && !stsz->list
+     &&  stsz->sample_count > 0
+     &&  stsz->sample_size == sample_size )
+    {
+        /* Still constant sample size. */
+        stsz->sample_count += sample_count;
+        return 0;
+    }
+    for( uint32_t i = 0; i < sample_count; i++ )
+    {
+        int err = isom_add_stsz_entry( stbl, sample_size );
+        if( err < 0 )
+            return err;
+    }
+    return 0;
+}
+
+/* Add the timestamps of samples following the last sample at regular intervals of 'sample_delta'.
+ * 'dts' and 'cts' are the timestamps of the first sample among them.
+ * The last sample must have been added with the same composition offset and the DTS which is 'sample_delta' less than 'dts'.
+ * Then, each sample has the same sample_delta and the same sample_offset as the last one, and therefore any compatibility
+ * and any composition to decode timeline shift are the same as the last one.
+ * Note that the sizes of these samples must be added before calling this function. */
+static int isom_add_regular_timestamps
+(
+    isom_stbl_t  *stbl,
+    isom_cache_t *cache,
+    uint64_t      dts,
+    uint64_t      cts,
+    uint32_t      sample_delta,
+    uint32_t      sample_count
+)
+{
+    if( !cache
+     || !stbl->stts->list
+     || !stbl->stts->list->tail
+     || sample_delta == 0 )
+        return LSMASH_ERR_INVALID_DATA;
+    int err;
+    isom_stts_entry_t *stts_data = (isom_stts_entry_t *)stbl->stts->list->tail->data;
+    if( stts_data->sample_delta == sample_delta )
+        stts_data->sample_count += sample_count;
+    else
+    {
+        if( (err = isom_add_stts_entry( stbl, sample_delta )) < 0 )
+            return err;
+        ((isom_stts_entry_t *)stbl->stts->list->tail->data)->sample_count = sample_count;
+    }
+    if( LSMASH_IS_EXISTING_BOX( stbl->ctts ) )
+    {
+        if( !stbl->ctts->list || !stbl->ctts->list->tail )
+            return LSMASH_ERR_INVALID_DATA;
+        uint32_t           sample_offset = cts - dts;
+        isom_ctts_entry_t *ctts_data     = (isom_ctts_entry_t *)stbl->ctts->list->tail->data;
+        if( ctts_data->sample_offset == sample_offset )
+            ctts_data->sample_count += sample_count;
+        else if( (err = isom_add_ctts_entry( stbl, sample_count, sample_offset )) < 0 )
+            return err;
+    }
+    uint64_t last_delta = (uint64_t)sample_delta * (sample_count - 1);
+    isom_update_cache_timestamp( cache, dts + last_delta, cts + last_delta, cache->timestamp.ctd_shift, sample_delta, 0 );
+    return 0;
+}
+
 static int isom_add_sync_point( isom_stbl_t *stbl, isom_cache_t *cache, uint32_t sample_number, lsmash_sample_property_t *prop )
 {
     if( !(prop->ra_flags & ISOM_SAMPLE_RANDOM_ACCESS_FLAG_SYNC) )   /* no null check for prop */
@@ -3709,7 +3988,8 @@ static int isom_write_pooled_samples( lsmash_file_t *file, isom_sample_pool_t *p
     return 0;
 }
 
-int isom_update_sample_tables
+/* Add the entries of the sample tables for a given sample except for the chunk relative ones. */
+static int isom_add_sample_table_entries
 (
     isom_trak_t         *trak,
     lsmash_sample_t     *sample,
@@ -3731,7 +4011,9 @@ int isom_update_sample_tables
         uint64_t sample_dts = sample->dts;
         uint64_t sample_cts = sample->cts;
         isom_stbl_t *stbl = trak->mdia->minf->stbl;
-        for( uint32_t i = 0; i < audio->samplesPerPacket; i++ )
+        uint32_t i = 0;
+        /* Add the first samples one by one until the timestamps settle into the regular intervals. */
+        for( ; i < audio->samplesPerPacket && (i == 0 || stbl->stts->list->entry_count == 0); i++ )
         {
             /* Add a size of uncomressed audio and increment sample_count.
              * This points to individual uncompressed audio samples, each one byte in size, within the compressed frames. */
@@ -3744,6 +4026,12 @@ int isom_update_sample_tables
             sample_dts += sample_duration;
             sample_cts += sample_duration;
         }
+        /* The rest of uncompressed samples just extend the last runs in the sample table. */
+        uint32_t rest = audio->samplesPerPacket - i;
+        if( rest
+         && ((err = isom_add_constant_sizes( stbl, 1, rest )) < 0
+          || (err = isom_add_regular_timestamps( stbl, trak->cache, sample_dts, sample_cts, sample_duration, rest )) < 0) )
+            return err;
         *samples_per_packet = audio->samplesPerPacket;
     }
     else
@@ -3774,6 +4062,20 @@ int isom_update_sample_tables
             return err;
         *samples_per_packet = 1;
     }
+    return 0;
+}
+
+int isom_update_sample_tables
+(
+    isom_trak_t         *trak,
+    lsmash_sample_t     *sample,
+    uint32_t            *samples_per_packet,
+    isom_sample_entry_t *sample_entry
+)
+{
+    int err = isom_add_sample_table_entries( trak, sample, samples_per_packet, sample_entry );
+    if( err < 0 )
+        return err;
     /* Add a chunk if needed. */
     return isom_add_sample_to_chunk( trak, sample );
 }
@@ -3807,9 +4109,8 @@ static int isom_output_cached_chunk( isom_trak_t *trak )
     return isom_write_pooled_samples( file, chunk->pool );
 }
 
-int isom_pool_sample( isom_sample_pool_t *pool, lsmash_sample_t *sample, uint32_t samples_per_packet )
+static int isom_reserve_pool( isom_sample_pool_t *pool, uint64_t pool_size )
 {
-    uint64_t pool_size = pool->size + sample->length;
     if( pool->alloc < pool_size )
     {
         uint8_t *data;
@@ -3823,36 +4124,143 @@ int isom_pool_sample( isom_sample_pool_t *pool, lsmash_sample_t *sample, uint32_
         pool->data  = data;
         pool->alloc = alloc;
     }
-    memcpy( pool->data + pool->size, sample->data, sample->length );
+    return 0;
+}
+
+static int isom_pool_data( isom_sample_pool_t *pool, uint8_t *data, uint64_t size, uint32_t sample_count )
+{
+    if( pool->src )
+        /* Samples pooled by reference and by copy can't be mixed. */
+        return LSMASH_ERR_FUNCTION_PARAM;
+    uint64_t pool_size = pool->size + size;
+    int err = isom_reserve_pool( pool, pool_size );
+    if( err < 0 )
+        return err;
+    memcpy( pool->data + pool->size, data, size );
     pool->size          = pool_size;
+    pool->sample_count += sample_count;
+    return 0;
+}
+
+int isom_pool_sample( isom_sample_pool_t *pool, lsmash_sample_t *sample, uint32_t samples_per_packet )
+{
+    int err = isom_pool_data( pool, sample->data, sample->length, samples_per_packet );
+    if( err < 0 )
+        return err;
+    lsmash_delete_sample( sample );
+    return 0;
+}
+
+/* Pool a reference to the data of a sample placed at sample->pos in a source stream instead of a copy of the data. */
+int isom_pool_sample_reference( isom_sample_pool_t *pool, lsmash_bs_t *src, lsmash_sample_t *sample, uint32_t samples_per_packet )
+{
+    if( (pool->size && pool->src != src) || !src )
+        /* Samples pooled by reference and by copy can't be mixed. So can't samples in different streams. */
+        return LSMASH_ERR_FUNCTION_PARAM;
+    pool->src = src;
+    isom_pool_extent_t *extent = pool->extent_count ? &pool->extents[pool->extent_count - 1] : NULL;
+    if( extent && extent->pos + extent->size == sample->pos )
+        extent->size += sample->length;
+    else
+    {
+        if( pool->extent_count == pool->extent_alloc )
+        {
+            uint32_t alloc = pool->extent_alloc ? 2 * pool->extent_alloc : 16;
+            isom_pool_extent_t *extents = lsmash_realloc( pool->extents, alloc * sizeof(isom_pool_extent_t) );
+            if( !extents )
+                return LSMASH_ERR_MEMORY_ALLOC;
+            pool->extents      = extents;
+            pool->extent_alloc = alloc;
+        }
+        extent = &pool->extents[ pool->extent_count ++ ];
+        extent->pos  = sample->pos;
+        extent->size = sample->length;
+    }
+    pool->size         += sample->length;
     pool->sample_count += samples_per_packet;
     lsmash_delete_sample( sample );
     return 0;
 }
 
-static int isom_append_sample_internal
-(
-    isom_trak_t         *trak,
-    lsmash_sample_t     *sample,
-    isom_sample_entry_t *sample_entry
-)
+/* Write the data of the samples in a pool.
+ * The data of samples pooled by reference is copied from the source stream inside the kernel if possible,
+ * otherwise with large reads and writes. */
+int isom_write_sample_pool( lsmash_bs_t *bs, isom_sample_pool_t *pool )
 {
-    uint32_t samples_per_packet;
-    int ret = isom_update_sample_tables( trak, sample, &samples_per_packet, sample_entry );
-    if( ret < 0 )
-        return ret;
-    /* ret == 1 means pooled samples must be flushed. */
-    isom_sample_pool_t *current_pool = trak->cache->chunk.pool;
-    if( ret == 1 )
-    {
-        /* The sample_description_index in the cache is one of the next written chunk.
-         * Therefore, it cannot be referenced here. */
-        lsmash_entry_list_t *stsc_list      = trak->mdia->minf->stbl->stsc->list;
-        isom_stsc_entry_t   *last_stsc_data = (isom_stsc_entry_t *)stsc_list->tail->data;
-        lsmash_file_t       *file           = isom_get_written_media_file( trak, last_stsc_data->sample_description_index );
-        if( (ret = isom_write_pooled_samples( file, current_pool )) < 0 )
-            return ret;
+    if( !pool->src )
+    {
+        lsmash_bs_put_bytes( bs, pool->size, pool->data );
+        return 0;
+    }
+    uint8_t *buf      = NULL;
+    size_t   buf_size = 0;
+    int      err      = 0;
+    for( uint32_t i = 0; i < pool->extent_count && err == 0; i++ )
+    {
+        isom_pool_extent_t *extent = &pool->extents[i];
+        if( extent->size == 0 )
+            continue;
+        err = buf ? LSMASH_ERR_PATCH_WELCOME : isom_copy_stream_data( bs, pool->src, extent->pos, extent->size );
+        if( err != LSMASH_ERR_PATCH_WELCOME )
+            continue;
+        if( !buf )
+        {
+            for( uint32_t j = i; j < pool->extent_count; j++ )
+                buf_size = LSMASH_MAX( buf_size, pool->extents[j].size );
+            buf_size = LSMASH_MIN( buf_size, ISOM_MEDIA_DATA_COPY_SIZE );
+            buf      = lsmash_malloc( buf_size );
+            if( !buf )
+                return LSMASH_ERR_MEMORY_ALLOC;
+        }
+        err = lsmash_bs_copy_data( bs, pool->src, extent->pos, extent->size, buf, buf_size );
+    }
+    lsmash_free( buf );
+    return err;
+}
+
+/* Move the data of the samples in a pool to the position 'pos' in a stream 'spill',
+ * and then hold them by reference instead. */
+int isom_spill_sample_pool( isom_sample_pool_t *pool, lsmash_bs_t *spill, uint64_t pos )
+{
+    if( pool->src )
+        return LSMASH_ERR_FUNCTION_PARAM;
+    if( pool->size == 0 )
+        return 0;
+    isom_pool_extent_t *extent = lsmash_malloc( sizeof(isom_pool_extent_t) );
+    if( !extent )
+        return LSMASH_ERR_MEMORY_ALLOC;
+    int64_t ret = lsmash_bs_write_seek( spill, pos, SEEK_SET );
+    int     err = ret < 0 ? (int)ret : lsmash_bs_write_data( spill, pool->data, pool->size );
+    if( err < 0 )
+    {
+        lsmash_free( extent );
+        return err;
     }
+    extent->pos  = pos;
+    extent->size = pool->size;
+    lsmash_freep( &pool->data );
+    pool->alloc        = 0;
+    pool->src          = spill;
+    pool->extents      = extent;
+    pool->extent_count = 1;
+    pool->extent_alloc = 1;
+    return 0;
+}
+
+/* Write the pooled samples of the chunk fixed by isom_update_sample_tables() returning 1. */
+static int isom_write_fixed_chunk( isom_trak_t *trak )
+{
+    /* The sample_description_index in the cache is one of the next written chunk.
+     * Therefore, it cannot be referenced here. */
+    lsmash_entry_list_t *stsc_list      = trak->mdia->minf->stbl->stsc->list;
+    isom_stsc_entry_t   *last_stsc_data = (isom_stsc_entry_t *)stsc_list->tail->data;
+    lsmash_file_t       *file           = isom_get_written_media_file( trak, last_stsc_data->sample_description_index );
+    return isom_write_pooled_samples( file, trak->cache->chunk.pool );
+}
+
+static int isom_output_async_cached_chunks( isom_trak_t *trak, lsmash_sample_t *sample )
+{
+    int ret;
     /* Arbitration system between tracks with extremely scattering dts.
      * Here, we check whether asynchronization between the tracks exceeds the tolerance.
      * If a track has too old "first DTS" in its cached chunk than current sample's DTS, then its pooled samples must be flushed.
@@ -3887,8 +4295,92 @@ static int isom_append_sample_internal
          * To completely avoid this, we need to observe at least whether the current sample will be placed
          * right next to the previous chunk of the same track or not. */
     }
+    return 0;
+}
+
+static int isom_append_sample_internal
+(
+    isom_trak_t         *trak,
+    lsmash_sample_t     *sample,
+    isom_sample_entry_t *sample_entry
+)
+{
+    uint32_t samples_per_packet;
+    int ret = isom_update_sample_tables( trak, sample, &samples_per_packet, sample_entry );
+    if( ret < 0 )
+        return ret;
+    /* ret == 1 means pooled samples must be flushed. */
+    if( ret == 1 && (ret = isom_write_fixed_chunk( trak )) < 0 )
+        return ret;
+    if( (ret = isom_output_async_cached_chunks( trak, sample )) < 0 )
+        return ret;
     /* anyway the current sample must be pooled. */
-    return isom_pool_sample( current_pool, sample, samples_per_packet );
+    return isom_pool_sample( trak->cache->chunk.pool, sample, samples_per_packet );
+}
+
+/* Append the LPCMFrames in a sample to a track in a non-fragmented movie without creating a sample for each frame.
+ * A frame starting a run goes through the usual update of the sample tables. The following frames put into the same chunk
+ * just extend the runs in the sample tables and are pooled at once as long as they need no other per-sample entry. */
+static int isom_append_lpcm_frames
+(
+    isom_trak_t         *trak,
+    lsmash_sample_t     *sample,
+    isom_sample_entry_t *sample_entry,
+    uint32_t             frame_size
+)
+{
+    if( sample->length % frame_size )
+        return LSMASH_ERR_INVALID_DATA;
+    isom_stbl_t    *stbl        = trak->mdia->minf->stbl;
+    isom_cache_t   *cache       = trak->cache;
+    uint32_t        frame_count = sample->length / frame_size;
+    lsmash_sample_t frame       = *sample;
+    frame.length = frame_size;
+    for( uint32_t i = 0; i < frame_count; )
+    {
+        frame.data = sample->data + (uint64_t)i * frame_size;
+        frame.dts  = sample->dts + i;
+        frame.cts  = sample->cts + i;
+        uint32_t samples_per_packet;
+        int err = isom_update_sample_tables( trak, &frame, &samples_per_packet, sample_entry );
+        if( err < 0 )
+            return err;
+        /* err == 1 means pooled samples must be flushed. */
+        if( err == 1 && (err = isom_write_fixed_chunk( trak )) < 0 )
+            return err;
+        /* Count the following frames put into the current chunk. */
+        isom_chunk_t  *chunk      = &cache->chunk;
+        lsmash_file_t *media_file = isom_get_written_media_file( trak, chunk->sample_description_index );
+        uint64_t       chunk_size = chunk->pool->size + frame_size;
+        uint32_t       run        = 1;
+        int            sync       = !!(frame.prop.ra_flags & ISOM_SAMPLE_RANDOM_ACCESS_FLAG_SYNC);
+        if( samples_per_packet == 1
+         && sync == cache->all_sync
+         && !(frame.prop.ra_flags & QT_SAMPLE_RANDOM_ACCESS_FLAG_PARTIAL_SYNC)
+         && LSMASH_IS_NON_EXISTING_BOX( stbl->sdtp )
+         && !stbl->sbgp_list.head
+         &&  stbl->stts->list->tail )
+            while( i + run < frame_count
+                && media_file->max_chunk_duration >= ((double)(frame.dts + run - chunk->first_dts) / trak->mdia->mdhd->timescale)
+                && media_file->max_chunk_size     >= chunk_size + frame_size )
+            {
+                chunk_size += frame_size;
+                ++run;
+            }
+        if( run > 1
+         && ((err = isom_add_constant_sizes( stbl, frame_size, run - 1 )) < 0
+          || (err = isom_add_regular_timestamps( stbl, cache, frame.dts + 1, frame.cts + 1, 1, run - 1 )) < 0) )
+            return err;
+        /* Check the asynchronization with the other tracks at the last frame in the run. */
+        frame.dts += run - 1;
+        if( (err = isom_output_async_cached_chunks( trak, &frame )) < 0 )
+            return err;
+        if( (err = isom_pool_data( chunk->pool, frame.data, (uint64_t)run * frame_size, run * samples_per_packet )) < 0 )
+            return err;
+        i += run;
+    }
+    lsmash_delete_sample( sample );
+    return 0;
 }
 
 int isom_append_sample_by_type
@@ -3957,14 +4449,27 @@ int isom_append_sample_by_type
     return func_append_sample( track, sample, sample_entry );
 }
 
-/* This function is for non-fragmented movie. */
-static int isom_append_sample
+/* Append a sample to a track in a non-fragmented movie.
+ * The LPCMFrames in a sample of LPCM audio are appended at once instead of being splitted into each sample. */
+static int isom_append_trak_sample
 (
-    lsmash_file_t       *file,
     isom_trak_t         *trak,
     lsmash_sample_t     *sample,
     isom_sample_entry_t *sample_entry
 )
+{
+    if( isom_is_lpcm_audio( sample_entry ) )
+    {
+        uint32_t frame_size = ((isom_audio_entry_t *)sample_entry)->constBytesPerAudioPacket;
+        if( sample->length > frame_size
+         && sample->cts   != LSMASH_TIMESTAMP_UNDEFINED )
+            return isom_append_lpcm_frames( trak, sample, sample_entry, frame_size );
+    }
+    return isom_append_sample_by_type( trak, sample, sample_entry, (int (*)( void *, lsmash_sample_t *, isom_sample_entry_t * ))isom_append_sample_internal );
+}
+
+/* This function is for non-fragmented movie. */
+static int isom_prepare_media_data_box( lsmash_file_t *file )
 {
     /* If there is no available Media Data Box to write samples, add and write a new one before any chunk offset is decided. */
     int err;
@@ -3973,12 +4478,29 @@ static int isom_append_sample
     {
         if( mdat_absent && LSMASH_IS_BOX_ADDITION_FAILURE( isom_add_mdat( file ) ) )
             return LSMASH_ERR_NAMELESS;
+        if( file->reserved_movie_size && (err = isom_write_reserved_movie_space( file )) < 0 )
+            return err;
         file->mdat->manager |= LSMASH_PLACEHOLDER;
         if( (err = isom_write_box( file->bs, (isom_box_t *)file->mdat )) < 0 )
             return err;
         file->size += file->mdat->size;
     }
-    return isom_append_sample_by_type( trak, sample, sample_entry, (int (*)( void *, lsmash_sample_t *, isom_sample_entry_t * ))isom_append_sample_internal );
+    return 0;
+}
+
+/* This function is for non-fragmented movie. */
+static int isom_append_sample
+(
+    lsmash_file_t       *file,
+    isom_trak_t         *trak,
+    lsmash_sample_t     *sample,
+    isom_sample_entry_t *sample_entry
+)
+{
+    int err = isom_prepare_media_data_box( file );
+    if( err < 0 )
+        return err;
+    return isom_append_trak_sample( trak, sample, sample_entry );
 }
 
 static int isom_output_cache( isom_trak_t *trak )
@@ -4038,6 +4560,9 @@ int lsmash_flush_pooled_samples( lsmash_root_t *root, uint32_t track_ID, uint32_
 {
     if( isom_check_initializer_present( root ) < 0 )
         return LSMASH_ERR_FUNCTION_PARAM;
+    int err = lsmash_flush_interleaved_samples( root );
+    if( err < 0 )
+        return err;
     lsmash_file_t *file = root->file;
     if( file->fragment
      && file->fragment->movie )
@@ -4049,20 +4574,13 @@ int lsmash_flush_pooled_samples( lsmash_root_t *root, uint32_t track_ID, uint32_
      || !trak->cache
      || !trak->mdia->minf->stbl->stsc->list )
         return LSMASH_ERR_NAMELESS;
-    int err = isom_output_cache( trak );
-    if( err < 0 )
+    if( (err = isom_output_cache( trak )) < 0 )
         return err;
     return lsmash_set_last_sample_delta( root, track_ID, last_sample_delta );
 }
 
-int lsmash_append_sample( lsmash_root_t *root, uint32_t track_ID, lsmash_sample_t *sample )
+static int isom_get_appendable_trak( lsmash_root_t *root, uint32_t track_ID, isom_trak_t **trak_out )
 {
-    if( isom_check_initializer_present( root ) < 0
-     || track_ID     == 0
-     || sample       == NULL
-     || sample->data == NULL
-     || sample->dts  == LSMASH_TIMESTAMP_UNDEFINED )
-        return LSMASH_ERR_FUNCTION_PARAM;
     lsmash_file_t *file = root->file;
     /* We think max_chunk_duration == 0, which means all samples will be cached on memory, should be prevented.
      * This means removal of a feature that we used to have, but anyway very alone chunk does not make sense. */
@@ -4090,19 +4608,527 @@ int lsmash_append_sample( lsmash_root_t *root, uint32_t track_ID, lsmash_sample_
      || !trak->cache
      || !trak->mdia->minf->stbl->stsc->list )
         return LSMASH_ERR_NAMELESS;
+    *trak_out = trak;
+    return 0;
+}
+
+static int isom_is_fragment_appendable( lsmash_file_t *file )
+{
+    return (file->flags & LSMASH_FILE_MODE_FRAGMENTED)
+        && file->fragment
+        && file->fragment->pool;
+}
+
+int lsmash_append_sample( lsmash_root_t *root, uint32_t track_ID, lsmash_sample_t *sample )
+{
+    if( isom_check_initializer_present( root ) < 0
+     || track_ID     == 0
+     || sample       == NULL
+     || sample->data == NULL
+     || sample->dts  == LSMASH_TIMESTAMP_UNDEFINED )
+        return LSMASH_ERR_FUNCTION_PARAM;
+    isom_trak_t *trak;
+    int err = isom_get_appendable_trak( root, track_ID, &trak );
+    if( err < 0 )
+        return err;
+    lsmash_file_t *file = root->file;
     isom_sample_entry_t *sample_entry = (isom_sample_entry_t *)lsmash_list_get_entry_data( &trak->mdia->minf->stbl->stsd->list, sample->index );
     if( LSMASH_IS_NON_EXISTING_BOX( sample_entry ) )
         return LSMASH_ERR_NAMELESS;
     /* Append a sample. */
-    if( (file->flags & LSMASH_FILE_MODE_FRAGMENTED)
-     && file->fragment
-     && file->fragment->pool )
+    if( isom_is_fragment_appendable( file ) )
         return isom_append_fragment_sample( file, trak, sample, sample_entry );
     if( file != file->initializer )
         return LSMASH_ERR_INVALID_DATA;
     return isom_append_sample( file, trak, sample, sample_entry );
 }
 
+int lsmash_append_sample_by_reference( lsmash_root_t *root, uint32_t track_ID, lsmash_sample_t *sample, lsmash_file_t *src )
+{
+    if( isom_check_initializer_present( root ) < 0
+     || track_ID    == 0
+     || sample      == NULL
+     || sample->dts == LSMASH_TIMESTAMP_UNDEFINED
+     || !src
+     || !src->bs
+     ||  src->bs->unseekable
+     || !(src->flags & LSMASH_FILE_MODE_READ) )
+        return LSMASH_ERR_FUNCTION_PARAM;
+    isom_trak_t *trak;
+    int err = isom_get_appendable_trak( root, track_ID, &trak );
+    if( err < 0 )
+        return err;
+    lsmash_file_t *file = root->file;
+    if( !isom_is_fragment_appendable( file ) )
+        return LSMASH_ERR_FUNCTION_PARAM;
+    isom_sample_entry_t *sample_entry = (isom_sample_entry_t *)lsmash_list_get_entry_data( &trak->mdia->minf->stbl->stsd->list, sample->index );
+    if( LSMASH_IS_NON_EXISTING_BOX( sample_entry ) )
+        return LSMASH_ERR_NAMELESS;
+    /* Any sample whose data must be inspected or split on appending is not supported. */
+    if( lsmash_check_codec_type_identical( sample_entry->type, ISOM_CODEC_TYPE_RTP_HINT  )
+     || lsmash_check_codec_type_identical( sample_entry->type, ISOM_CODEC_TYPE_RRTP_HINT )
+     || (isom_is_lpcm_audio( sample_entry ) && sample->length != ((isom_audio_entry_t *)sample_entry)->constBytesPerAudioPacket) )
+        return LSMASH_ERR_PATCH_WELCOME;
+    /* Append a reference to the sample. */
+    trak->cache->fragment->src = src->bs;
+    err = isom_append_fragment_sample( file, trak, sample, sample_entry );
+    trak->cache->fragment->src = NULL;
+    return err;
+}
+
+/* Copy the payload of the samples counted at the end of the pool but not copied yet. */
+static int isom_fill_pool( isom_sample_pool_t *pool, uint8_t *payload, uint64_t size )
+{
+    if( size == 0 )
+        return 0;
+    int err = isom_reserve_pool( pool, pool->size );
+    if( err < 0 )
+        return err;
+    memcpy( pool->data + pool->size - size, payload, size );
+    return 0;
+}
+
+/* Append a copy of a sample given by lsmash_append_samples() in the same way as lsmash_append_sample(). */
+static int isom_append_sample_copy
+(
+    lsmash_file_t       *file,
+    isom_trak_t         *trak,
+    lsmash_sample_t     *sample,
+    isom_sample_entry_t *sample_entry
+)
+{
+    lsmash_sample_t *copy = lsmash_create_sample( sample->length );
+    if( !copy )
+        return LSMASH_ERR_MEMORY_ALLOC;
+    uint8_t *data = copy->data;
+    *copy = *sample;
+    copy->data = data;
+    memcpy( copy->data, sample->data, sample->length );
+    int err;
+    if( isom_is_fragment_appendable( file ) )
+        err = isom_append_fragment_sample( file, trak, copy, sample_entry );
+    else
+        err = isom_append_trak_sample( trak, copy, sample_entry );
+    if( err < 0 )
+        lsmash_delete_sample( copy );
+    return err;
+}
+
+int lsmash_append_samples( lsmash_root_t *root, uint32_t track_ID, lsmash_sample_t *samples, uint32_t sample_count )
+{
+    if( isom_check_initializer_present( root ) < 0
+     || track_ID     == 0
+     || samples      == NULL
+     || sample_count == 0 )
+        return LSMASH_ERR_FUNCTION_PARAM;
+    for( uint32_t i = 0; i < sample_count; i++ )
+        if( samples[i].data == NULL
+         || samples[i].dts  == LSMASH_TIMESTAMP_UNDEFINED )
+            return LSMASH_ERR_FUNCTION_PARAM;
+    isom_trak_t *trak;
+    int err = isom_get_appendable_trak( root, track_ID, &trak );
+    if( err < 0 )
+        return err;
+    lsmash_file_t *file       = root->file;
+    int            fragmented = isom_is_fragment_appendable( file );
+    if( !fragmented )
+    {
+        if( file != file->initializer )
+            return LSMASH_ERR_INVALID_DATA;
+        if( (err = isom_prepare_media_data_box( file )) < 0 )
+            return err;
+    }
+    /* Consecutive samples placed contiguously in the payload and put into the same chunk are pooled by a single copy.
+     * The pool counts the samples of the current run before their payload is copied into it
+     * since the chunk decision in isom_update_sample_tables() refers to the size and the number of the pooled samples.
+     * So every exit, including failures, has to copy the payload of the current run into the pool. */
+    isom_sample_entry_t *sample_entry = NULL;
+    uint8_t             *run_data     = NULL;
+    uint64_t             run_size     = 0;
+    uint32_t             run_count    = 0;
+    for( uint32_t i = 0; i < sample_count; i++ )
+    {
+        lsmash_sample_t *sample = &samples[i];
+        if( !sample_entry || sample->index != samples[i - 1].index )
+        {
+            sample_entry = (isom_sample_entry_t *)lsmash_list_get_entry_data( &trak->mdia->minf->stbl->stsd->list, sample->index );
+            if( LSMASH_IS_NON_EXISTING_BOX( sample_entry ) )
+            {
+                err = LSMASH_ERR_NAMELESS;
+                goto fail;
+            }
+        }
+        if( fragmented
+         || isom_is_lpcm_audio( sample_entry )
+         || lsmash_check_codec_type_identical( sample_entry->type, ISOM_CODEC_TYPE_RTP_HINT  )
+         || lsmash_check_codec_type_identical( sample_entry->type, ISOM_CODEC_TYPE_RRTP_HINT ) )
+        {
+            /* These need per sample handling which can't share a copy with other samples. */
+            if( (err = isom_fill_pool( trak->cache->chunk.pool, run_data, run_size )) < 0 )
+                goto fail;
+            run_size  = 0;
+            run_count = 0;
+            if( (err = isom_append_sample_copy( file, trak, sample, sample_entry )) < 0 )
+                return err;
+            continue;
+        }
+        uint32_t samples_per_packet;
+        if( (err = isom_update_sample_tables( trak, sample, &samples_per_packet, sample_entry )) < 0 )
+            goto fail;
+        isom_sample_pool_t *pool = trak->cache->chunk.pool;
+        /* err == 1 means pooled samples must be flushed. */
+        int flush = (err == 1);
+        if( flush || run_size == 0 || run_data + run_size != sample->data )
+        {
+            if( (err = isom_fill_pool( pool, run_data, run_size )) < 0 )
+                goto fail;
+            run_data  = sample->data;
+            run_size  = 0;
+            run_count = 0;
+        }
+        if( (flush && (err = isom_write_fixed_chunk( trak )) < 0)
+         || (err = isom_output_async_cached_chunks( trak, sample )) < 0 )
+            goto fail;
+        run_size           += sample->length;
+        run_count          += samples_per_packet;
+        pool->size         += sample->length;
+        pool->sample_count += samples_per_packet;
+    }
+    return isom_fill_pool( trak->cache->chunk.pool, run_data, run_size );
+fail:
+    /* Keep the payload of the samples already counted in the pool. If it can't be copied, uncount them instead. */
+    if( isom_fill_pool( trak->cache->chunk.pool, run_data, run_size ) < 0 )
+    {
+        isom_sample_pool_t *pool = trak->cache->chunk.pool;
+        pool->size         -= run_size;
+        pool->sample_count -= run_count;
+    }
+    return err;
+}
+
+/* A source track of lsmash_append_samples_from_media_timelines(). */
+typedef struct
+{
+    isom_trak_t    *trak;           /* destination track */
+    uint32_t        track_ID;       /* source track_ID */
+    uint32_t        sample_count;   /* number of samples in the source media timeline */
+    uint32_t        sample_number;  /* number of the next sample to be appended */
+    lsmash_sample_t sample;         /* info of the next sample to be appended */
+} isom_timeline_run_t;
+
+/* Copy a range of media data in the source stream to the end of the media data in the destination file. */
+static int isom_copy_media_data( lsmash_file_t *file, lsmash_bs_t *src_bs, uint8_t *buf, uint64_t pos, uint64_t size )
+{
+    int err = lsmash_bs_copy_data( file->bs, src_bs, pos, size, buf, ISOM_MEDIA_DATA_COPY_SIZE );
+    if( err < 0 )
+        return err;
+    file->mdat->media_size += size;
+    file->size             += size;
+    return 0;
+}
+
+/* Append physically consecutive samples sharing a sample description from the next sample of a source track
+ * as a chunk placed at a given offset, and get the size of the chunk. */
+static int isom_append_timeline_run( lsmash_root_t *src, isom_timeline_run_t *run, uint64_t offset, uint64_t *size )
+{
+    isom_trak_t     *trak   = run->trak;
+    isom_stbl_t     *stbl   = trak->mdia->minf->stbl;
+    isom_chunk_t    *chunk  = &trak->cache->chunk;
+    lsmash_sample_t *sample = &run->sample;
+    isom_sample_entry_t *sample_entry = (isom_sample_entry_t *)lsmash_list_get_entry_data( &stbl->stsd->list, sample->index );
+    if( LSMASH_IS_NON_EXISTING_BOX( sample_entry ) )
+        return LSMASH_ERR_NAMELESS;
+    chunk->chunk_number            += 1;
+    chunk->sample_description_index = sample->index;
+    chunk->first_dts                = sample->dts;
+    uint64_t pos               = sample->pos;
+    uint32_t samples_per_chunk = 0;
+    int      err;
+    *size = 0;
+    do
+    {
+        uint32_t samples_per_packet;
+        if( (err = isom_add_sample_table_entries( trak, sample, &samples_per_packet, sample_entry )) < 0 )
+            return err;
+        samples_per_chunk += samples_per_packet;
+        *size             += sample->length;
+        if( ++ run->sample_number > run->sample_count )
+            break;
+        if( (err = lsmash_get_sample_info_from_media_timeline( src, run->track_ID, run->sample_number, sample )) < 0 )
+            return err;
+    } while( sample->index == chunk->sample_description_index && sample->pos == pos + *size );
+    /* Add the chunk relative properties. */
+    isom_stsc_entry_t *last_stsc_data = stbl->stsc->list->tail ? (isom_stsc_entry_t *)stbl->stsc->list->tail->data : NULL;
+    if( (!last_stsc_data
+      || samples_per_chunk               != last_stsc_data->samples_per_chunk
+      || chunk->sample_description_index != last_stsc_data->sample_description_index)
+     && (err = isom_add_stsc_entry( stbl, chunk->chunk_number, samples_per_chunk, chunk->sample_description_index )) < 0 )
+        return err;
+    return isom_add_stco_entry( stbl, offset );
+}
+
+int lsmash_append_samples_from_media_timelines
+(
+    lsmash_root_t  *dst,
+    const uint32_t *dst_track_IDs,
+    lsmash_root_t  *src,
+    const uint32_t *src_track_IDs,
+    uint32_t        track_count
+)
+{
+    if( isom_check_initializer_present( dst ) < 0
+     || isom_check_initializer_present( src ) < 0
+     || !dst_track_IDs
+     || !src_track_IDs
+     || track_count == 0 )
+        return LSMASH_ERR_FUNCTION_PARAM;
+    lsmash_file_t *file   = dst->file;
+    lsmash_bs_t   *src_bs = src->file->bs;
+    if( isom_is_fragment_appendable( file )
+     || file != file->initializer
+     || !src_bs
+     || !(src->file->flags & LSMASH_FILE_MODE_READ) )
+        return LSMASH_ERR_INVALID_DATA;
+    int err;
+    /* Check all tracks before appending anything, so that nothing is modified if any of them is not supported. */
+    for( uint32_t i = 0; i < track_count; i++ )
+    {
+        isom_trak_t *trak;
+        if( (err = isom_get_appendable_trak( dst, dst_track_IDs[i], &trak )) < 0 )
+            return err;
+        /* The statistics of PDUs of hint tracks require access to each sample data. */
+        for( lsmash_entry_t *entry = trak->mdia->minf->stbl->stsd->list.head; entry; entry = entry->next )
+        {
+            isom_sample_entry_t *sample_entry = (isom_sample_entry_t *)entry->data;
+            if( LSMASH_IS_NON_EXISTING_BOX( sample_entry ) )
+                return LSMASH_ERR_NAMELESS;
+            if( lsmash_check_codec_type_identical( sample_entry->type, ISOM_CODEC_TYPE_RTP_HINT  )
+             || lsmash_check_codec_type_identical( sample_entry->type, ISOM_CODEC_TYPE_RRTP_HINT ) )
+                return LSMASH_ERR_PATCH_WELCOME;
+        }
+        /* Only media data in the source file can be copied. */
+        isom_timeline_t *timeline = isom_get_timeline( src, src_track_IDs[i] );
+        if( !timeline )
+            return LSMASH_ERR_NAMELESS;
+        if( !isom_timeline_is_in_file( timeline, src->file ) )
+            return LSMASH_ERR_PATCH_WELCOME;
+    }
+    isom_timeline_run_t *runs = lsmash_malloc_zero( track_count * sizeof(isom_timeline_run_t) );
+    if( !runs )
+        return LSMASH_ERR_MEMORY_ALLOC;
+    uint8_t *buf = NULL;
+    for( uint32_t i = 0; i < track_count; i++ )
+    {
+        isom_timeline_run_t *run = &runs[i];
+        if( (err = isom_get_appendable_trak( dst, dst_track_IDs[i], &run->trak )) < 0 )
+            goto fail;
+        run->track_ID      = src_track_IDs[i];
+        run->sample_count  = lsmash_get_sample_count_in_media_timeline( src, src_track_IDs[i] );
+        run->sample_number = 1;
+        if( run->sample_count
+         && (err = lsmash_get_sample_info_from_media_timeline( src, run->track_ID, 1, &run->sample )) < 0 )
+            goto fail;
+        /* Put the samples pooled until now before the copied media data. */
+        isom_chunk_t *chunk = &run->trak->cache->chunk;
+        if( chunk->pool
+         && chunk->pool->sample_count
+         && (err = isom_output_cached_chunk( run->trak )) < 0 )
+            goto fail;
+    }
+    if( (err = isom_prepare_media_data_box( file )) < 0 )
+        goto fail;
+    buf = lsmash_malloc( ISOM_MEDIA_DATA_COPY_SIZE );
+    if( !buf )
+    {
+        err = LSMASH_ERR_MEMORY_ALLOC;
+        goto fail;
+    }
+    /* Append runs of samples over all tracks in the order of their positions in the source.
+     * Each run becomes a chunk, and the media data of consecutive runs is copied at once. */
+    uint64_t copy_pos  = 0;
+    uint64_t copy_size = 0;
+    while( 1 )
+    {
+        isom_timeline_run_t *next = NULL;
+        for( uint32_t i = 0; i < track_count; i++ )
+            if( runs[i].sample_number <= runs[i].sample_count
+             && (!next || runs[i].sample.pos < next->sample.pos) )
+                next = &runs[i];
+        if( !next )
+            break;
+        uint64_t run_pos = next->sample.pos;
+        uint64_t run_size;
+        if( (err = isom_append_timeline_run( src, next, file->size + copy_size, &run_size )) < 0 )
+            goto fail;
+        if( copy_pos + copy_size != run_pos )
+        {
+            if( (err = isom_copy_media_data( file, src_bs, buf, copy_pos, copy_size )) < 0 )
+                goto fail;
+            copy_pos  = run_pos;
+            copy_size = 0;
+        }
+        copy_size += run_size;
+    }
+    err = isom_copy_media_data( file, src_bs, buf, copy_pos, copy_size );
+fail:
+    lsmash_free( buf );
+    lsmash_free( runs );
+    return err;
+}
+
+/* Decide chunk boundaries over all tracks for the interleaver.
+ * Once the next sample is later than the oldest cached chunk over all tracks by more than the maximum chunk duration,
+ * fix the cached chunks of all tracks started within the window of the oldest one at once and write them in decoding time order,
+ * so that chunks are laid out in the global time order instead of being cut per track. */
+static int isom_output_interleaved_chunks( lsmash_file_t *file, double next_time )
+{
+    int    fixed      = 0;
+    double window_end = 0;
+    while( 1 )
+    {
+        isom_trak_t *oldest      = NULL;
+        double       oldest_time = 0;
+        for( lsmash_entry_t *entry = file->moov->trak_list.head; entry; entry = entry->next )
+        {
+            isom_trak_t  *trak  = (isom_trak_t *)entry->data;
+            isom_chunk_t *chunk = &trak->cache->chunk;
+            if( !chunk->pool || chunk->pool->sample_count == 0 )
+                continue;
+            double first_time = (double)chunk->first_dts / trak->mdia->mdhd->timescale;
+            if( !oldest || first_time < oldest_time )
+            {
+                oldest      = trak;
+                oldest_time = first_time;
+            }
+        }
+        if( !oldest )
+            return 0;
+        if( !fixed )
+        {
+            if( next_time - oldest_time <= file->max_chunk_duration )
+                return 0;
+            window_end = oldest_time + file->max_chunk_duration;
+            fixed      = 1;
+        }
+        else if( oldest_time > window_end )
+            /* Chunks started after the window of the oldest one are left to the next window. */
+            return 0;
+        int err = isom_output_cached_chunk( oldest );
+        if( err < 0 )
+            return err;
+    }
+}
+
+/* Append the oldest queued sample over all tracks repeatedly while it is determined to be the next one.
+ * If 'flush' is set, append all queued samples. */
+static int isom_append_interleaved_samples( lsmash_root_t *root, int flush )
+{
+    lsmash_file_t *file      = root->file->initializer;
+    double         tolerance = root->file->max_async_tolerance;
+    while( 1 )
+    {
+        isom_trak_t *oldest      = NULL;
+        double       oldest_time = 0;
+        double       newest_time = 0;
+        int          all_queued  = 1;
+        for( lsmash_entry_t *entry = file->moov->trak_list.head; entry; entry = entry->next )
+        {
+            isom_trak_t *trak = (isom_trak_t *)entry->data;
+            if( LSMASH_IS_NON_EXISTING_BOX( trak )
+             || !trak->cache )
+                return LSMASH_ERR_INVALID_DATA;
+            lsmash_entry_list_t *queue = &trak->cache->interleave;
+            if( !queue->head )
+            {
+                all_queued = 0;
+                continue;
+            }
+            /* The timescale is checked when queueing samples. */
+            double timescale = trak->mdia->mdhd->timescale;
+            double head_time = ((lsmash_sample_t *)queue->head->data)->dts / timescale;
+            double tail_time = ((lsmash_sample_t *)queue->tail->data)->dts / timescale;
+            if( !oldest || head_time < oldest_time )
+            {
+                oldest      = trak;
+                oldest_time = head_time;
+            }
+            newest_time = LSMASH_MAX( newest_time, tail_time );
+        }
+        if( !oldest )
+            return 0;
+        /* Unless all tracks have queued samples, a sample older than the oldest one might come from a track without
+         * any queued sample. Wait for it as long as the asynchronization doesn't exceed the tolerance. */
+        if( !flush && !all_queued && newest_time - oldest_time <= tolerance )
+            return 0;
+        int err;
+        if( !root->file->fragment
+         && (err = isom_output_interleaved_chunks( file, oldest_time )) < 0 )
+            return err;
+        lsmash_entry_list_t *queue  = &oldest->cache->interleave;
+        lsmash_sample_t     *sample = (lsmash_sample_t *)queue->head->data;
+        queue->head->data = NULL;
+        lsmash_list_remove_entry_direct( queue, queue->head );
+        err = lsmash_append_sample( root, oldest->tkhd->track_ID, sample );
+        if( err < 0 )
+        {
+            lsmash_delete_sample( sample );
+            return err;
+        }
+    }
+}
+
+int lsmash_interleave_sample( lsmash_root_t *root, uint32_t track_ID, lsmash_sample_t *sample )
+{
+    /* The sample is owned by the library once given, so delete it on failure. */
+    int err;
+    if( isom_check_initializer_present( root ) < 0
+     || track_ID     == 0
+     || sample       == NULL
+     || sample->data == NULL
+     || sample->dts  == LSMASH_TIMESTAMP_UNDEFINED )
+    {
+        err = LSMASH_ERR_FUNCTION_PARAM;
+        goto fail;
+    }
+    lsmash_file_t *file = root->file;
+    if( file->max_async_tolerance == 0 )
+    {
+        err = LSMASH_ERR_NAMELESS;
+        goto fail;
+    }
+    isom_trak_t *trak = isom_get_trak( file->initializer, track_ID );
+    if( LSMASH_IS_NON_EXISTING_BOX( trak->tkhd )
+     ||  trak->mdia->mdhd->timescale == 0
+     || !trak->cache )
+    {
+        err = LSMASH_ERR_NAMELESS;
+        goto fail;
+    }
+    lsmash_entry_list_t *queue = &trak->cache->interleave;
+    if( queue->tail && sample->dts < ((lsmash_sample_t *)queue->tail->data)->dts )
+    {
+        err = LSMASH_ERR_INVALID_DATA;
+        goto fail;
+    }
+    if( lsmash_list_add_entry( queue, sample ) < 0 )
+    {
+        err = LSMASH_ERR_MEMORY_ALLOC;
+        goto fail;
+    }
+    /* From here, the sample is deleted together with the queue even if appending fails. */
+    return isom_append_interleaved_samples( root, 0 );
+fail:
+    lsmash_delete_sample( sample );
+    return err;
+}
+
+int lsmash_flush_interleaved_samples( lsmash_root_t *root )
+{
+    if( isom_check_initializer_present( root ) < 0 )
+        return LSMASH_ERR_FUNCTION_PARAM;
+    return isom_append_interleaved_samples( root, 1 );
+}
+
 /*---- misc functions ----*/
 
 int lsmash_delete_explicit_timeline_map( lsmash_root_t *root, uint32_t track_ID )
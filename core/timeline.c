@@ -48,6 +48,19 @@ typedef struct
     lsmash_sample_property_t prop;
 } isom_sample_info_t;
 
+/* Sample info is stored in pages of fixed length.
+ * If the memory for sample info is limited, the least recently used pages beyond the limit are spilled out
+ * into a temporary file and loaded again on demand. */
+#define ISOM_SAMPLE_INFO_PAGE_LENGTH 4096
+#define ISOM_SAMPLE_INFO_PAGE_SIZE   (ISOM_SAMPLE_INFO_PAGE_LENGTH * sizeof(isom_sample_info_t))
+
+typedef struct
+{
+    isom_sample_info_t *info;       /* sample info on memory; NULL if spilled out */
+    uint32_t            last_used;  /* the value of the page clock at the last access */
+    uint8_t             dirty;      /* whether the sample info on memory has no same copy in the spill file */
+} isom_sample_info_page_t;
+
 static const lsmash_class_t lsmash_timeline_class =
 {
     "timeline"
@@ -73,8 +86,16 @@ struct isom_timeline_tag
     uint64_t last_accessed_lpcm_bunch_dts;
     lsmash_entry_list_t edit_list [1];  /* list of edits */
     lsmash_entry_list_t chunk_list[1];  /* list of chunks */
-    lsmash_entry_list_t info_list [1];  /* list of sample info */
     lsmash_entry_list_t bunch_list[1];  /* list of LPCM bunch */
+    uint32_t info_count;                        /* number of sample info */
+    uint32_t info_page_count;                   /* number of pages of sample info */
+    uint32_t info_page_alloc;                   /* number of allocated page descriptors */
+    uint32_t info_page_clock;                   /* counter incremented at each page access */
+    uint32_t max_resident_page_count;           /* max number of pages on memory; 0 means no limit */
+    uint32_t resident_page_count;               /* number of pages on memory */
+    uint32_t                *resident_pages;    /* page numbers of pages on memory if limited */
+    isom_sample_info_page_t *info_pages;        /* pages of sample info */
+    FILE                    *spill;             /* temporary file to which pages of sample info are spilled out */
     int (*get_dts)( isom_timeline_t *timeline, uint32_t sample_number, uint64_t *dts );
     int (*get_cts)( isom_timeline_t *timeline, uint32_t sample_number, uint64_t *cts );
     int (*get_sample_duration)( isom_timeline_t *timeline, uint32_t sample_number, uint32_t *sample_duration );
@@ -109,7 +130,6 @@ isom_timeline_t *isom_timeline_create( void )
     timeline->class = &lsmash_timeline_class;
     lsmash_list_init_simple( timeline->edit_list );
     lsmash_list_init_simple( timeline->chunk_list );
-    lsmash_list_init_simple( timeline->info_list );
     lsmash_list_init_simple( timeline->bunch_list );
     return timeline;
 }
@@ -120,8 +140,13 @@ void isom_timeline_destroy( isom_timeline_t *timeline )
         return;
     lsmash_list_remove_entries( timeline->edit_list );
     lsmash_list_remove_entries( timeline->chunk_list ); /* chunk data must be already freed. */
-    lsmash_list_remove_entries( timeline->info_list );
     lsmash_list_remove_entries( timeline->bunch_list );
+    for( uint32_t i = 0; i < timeline->info_page_count; i++ )
+        lsmash_free( timeline->info_pages[i].info );
+    lsmash_free( timeline->info_pages );
+    lsmash_free( timeline->resident_pages );
+    if( timeline->spill )
+        fclose( timeline->spill );
     lsmash_free( timeline );
 }
 
@@ -132,6 +157,18 @@ void isom_remove_timelines( lsmash_file_t *file )
     lsmash_list_destroy( file->timeline );
 }
 
+/* Return 1 if the media data of all chunks in a timeline is in a given file, 0 otherwise. */
+int isom_timeline_is_in_file( isom_timeline_t *timeline, lsmash_file_t *file )
+{
+    for( lsmash_entry_t *entry = timeline->chunk_list->head; entry; entry = entry->next )
+    {
+        isom_portable_chunk_t *chunk = (isom_portable_chunk_t *)entry->data;
+        if( !chunk || chunk->file != file )
+            return 0;
+    }
+    return 1;
+}
+
 void lsmash_destruct_timeline( lsmash_root_t *root, uint32_t track_ID )
 {
     if( LSMASH_IS_NON_EXISTING_BOX( root )
@@ -279,17 +316,142 @@ static int isom_is_qt_fixed_compressed_audio
     return (((isom_audio_entry_t *)description)->compression_ID != QT_AUDIO_COMPRESSION_ID_VARIABLE_COMPRESSION);
 }
 
+/* Limit the memory for sample info of the timeline.
+ * At least two pages are kept on memory so that two sample info in different pages can be referenced at the same time. */
+static void isom_timeline_set_max_info_memory
+(
+    isom_timeline_t *timeline,
+    uint64_t         max_info_memory
+)
+{
+    if( max_info_memory == 0 )
+        timeline->max_resident_page_count = 0;
+    else
+        timeline->max_resident_page_count = LSMASH_MAX( max_info_memory / ISOM_SAMPLE_INFO_PAGE_SIZE, 2 );
+}
+
+/* Spill out the least recently used page on memory except for the page of a given number,
+ * then make the slot of the spilled page available for the page of a given number. */
+static int isom_spill_sample_info_page( isom_timeline_t *timeline, uint32_t page_number )
+{
+    if( !timeline->spill )
+    {
+        timeline->spill = tmpfile();
+        if( !timeline->spill )
+            return LSMASH_ERR_IO;
+    }
+    uint32_t slot = 0;
+    for( uint32_t i = 1; i < timeline->resident_page_count; i++ )
+        if( timeline->info_pages[ timeline->resident_pages[i] ].last_used < timeline->info_pages[ timeline->resident_pages[slot] ].last_used )
+            slot = i;
+    assert( timeline->resident_pages[slot] != page_number );
+    isom_sample_info_page_t *page = &timeline->info_pages[ timeline->resident_pages[slot] ];
+    /* A clean page is the same as its copy in the spill file, so just drop it. */
+    if( page->dirty
+     && (lsmash_fseek( timeline->spill, (int64_t)timeline->resident_pages[slot] * ISOM_SAMPLE_INFO_PAGE_SIZE, SEEK_SET ) != 0
+      || fwrite( page->info, 1, ISOM_SAMPLE_INFO_PAGE_SIZE, timeline->spill ) != ISOM_SAMPLE_INFO_PAGE_SIZE) )
+        return LSMASH_ERR_IO;
+    page->dirty = 0;
+    timeline->info_pages[page_number].info = page->info;
+    page->info = NULL;
+    timeline->resident_pages[slot] = page_number;
+    return 0;
+}
+
+/* Make a page of a given number resident on memory.
+ * Return the address of the page if successful.
+ * Return NULL otherwise. */
+static isom_sample_info_page_t *isom_get_sample_info_page( isom_timeline_t *timeline, uint32_t page_number )
+{
+    isom_sample_info_page_t *page = &timeline->info_pages[page_number];
+    page->last_used = ++ timeline->info_page_clock;
+    if( page->info )
+        return page;
+    if( timeline->max_resident_page_count == 0
+     || timeline->resident_page_count < timeline->max_resident_page_count )
+    {
+        page->info = lsmash_malloc( ISOM_SAMPLE_INFO_PAGE_SIZE );
+        if( !page->info )
+            return NULL;
+        if( timeline->max_resident_page_count )
+            timeline->resident_pages[ timeline->resident_page_count ] = page_number;
+        ++ timeline->resident_page_count;
+    }
+    else if( isom_spill_sample_info_page( timeline, page_number ) < 0 )
+        return NULL;
+    /* Load the page from the spill file if it already has any sample info.
+     * Note that the last page may be spilled out before it is filled. */
+    page->dirty = 1;
+    if( timeline->spill
+     && (uint64_t)page_number * ISOM_SAMPLE_INFO_PAGE_LENGTH < timeline->info_count )
+    {
+        if( lsmash_fseek( timeline->spill, (int64_t)page_number * ISOM_SAMPLE_INFO_PAGE_SIZE, SEEK_SET ) != 0
+         || fread( page->info, 1, ISOM_SAMPLE_INFO_PAGE_SIZE, timeline->spill ) != ISOM_SAMPLE_INFO_PAGE_SIZE )
+            return NULL;
+        page->dirty = 0;
+    }
+    return page;
+}
+
+/* Get the sample info of a given sample number.
+ * The returned address is valid until sample info in the other two pages is requested.
+ * Return NULL if not found. */
+static isom_sample_info_t *isom_get_sample_info( isom_timeline_t *timeline, uint32_t sample_number )
+{
+    if( sample_number == 0 || sample_number > timeline->info_count )
+        return NULL;
+    uint32_t index = sample_number - 1;
+    isom_sample_info_page_t *page = isom_get_sample_info_page( timeline, index / ISOM_SAMPLE_INFO_PAGE_LENGTH );
+    return page ? &page->info[ index % ISOM_SAMPLE_INFO_PAGE_LENGTH ] : NULL;
+}
+
+/* Same as isom_get_sample_info(), but the returned sample info is going to be modified. */
+static isom_sample_info_t *isom_get_sample_info_to_update( isom_timeline_t *timeline, uint32_t sample_number )
+{
+    if( sample_number == 0 || sample_number > timeline->info_count )
+        return NULL;
+    uint32_t index = sample_number - 1;
+    isom_sample_info_page_t *page = isom_get_sample_info_page( timeline, index / ISOM_SAMPLE_INFO_PAGE_LENGTH );
+    if( !page )
+        return NULL;
+    page->dirty = 1;
+    return &page->info[ index % ISOM_SAMPLE_INFO_PAGE_LENGTH ];
+}
+
 static int isom_add_sample_info_entry( isom_timeline_t *timeline, isom_sample_info_t *src_info )
 {
-    isom_sample_info_t *dst_info = lsmash_malloc( sizeof(isom_sample_info_t) );
-    if( !dst_info )
-        return LSMASH_ERR_MEMORY_ALLOC;
-    if( lsmash_list_add_entry( timeline->info_list, dst_info ) < 0 )
+    if( timeline->info_count == UINT32_MAX )
+        return LSMASH_ERR_NAMELESS;
+    uint32_t index = timeline->info_count % ISOM_SAMPLE_INFO_PAGE_LENGTH;
+    if( index == 0 )
     {
-        lsmash_free( dst_info );
-        return LSMASH_ERR_MEMORY_ALLOC;
+        /* Add a new page. */
+        if( timeline->info_page_count == timeline->info_page_alloc )
+        {
+            uint32_t alloc = timeline->info_page_alloc ? 2 * timeline->info_page_alloc : 16;
+            isom_sample_info_page_t *pages = lsmash_realloc( timeline->info_pages, alloc * sizeof(isom_sample_info_page_t) );
+            if( !pages )
+                return LSMASH_ERR_MEMORY_ALLOC;
+            timeline->info_pages      = pages;
+            timeline->info_page_alloc = alloc;
+        }
+        if( timeline->max_resident_page_count && !timeline->resident_pages )
+        {
+            timeline->resident_pages = lsmash_malloc( timeline->max_resident_page_count * sizeof(uint32_t) );
+            if( !timeline->resident_pages )
+                return LSMASH_ERR_MEMORY_ALLOC;
+        }
+        timeline->info_pages[ timeline->info_page_count ].info      = NULL;
+        timeline->info_pages[ timeline->info_page_count ].last_used = 0;
+        timeline->info_pages[ timeline->info_page_count ].dirty     = 0;
+        ++ timeline->info_page_count;
     }
-    *dst_info = *src_info;
+    isom_sample_info_page_t *page = isom_get_sample_info_page( timeline, timeline->info_page_count - 1 );
+    if( !page )
+        return LSMASH_ERR_MEMORY_ALLOC;
+    page->info[index] = *src_info;
+    page->dirty       = 1;
+    ++ timeline->info_count;
     return 0;
 }
 
@@ -393,34 +555,30 @@ static int isom_get_dts_from_info_list( isom_timeline_t *timeline, uint32_t samp
         *dts = 0;
     else if( sample_number == timeline->last_accessed_sample_number + 1 )
     {
-        isom_sample_info_t *info = (isom_sample_info_t *)lsmash_list_get_entry_data( timeline->info_list, timeline->last_accessed_sample_number );
+        isom_sample_info_t *info = isom_get_sample_info( timeline, timeline->last_accessed_sample_number );
         if( !info )
             return LSMASH_ERR_NAMELESS;
         *dts = timeline->last_accessed_sample_dts + info->duration;
     }
     else if( sample_number == timeline->last_accessed_sample_number - 1 )
     {
-        isom_sample_info_t *info = (isom_sample_info_t *)lsmash_list_get_entry_data( timeline->info_list, timeline->last_accessed_sample_number - 1 );
+        isom_sample_info_t *info = isom_get_sample_info( timeline, timeline->last_accessed_sample_number - 1 );
         if( !info )
             return LSMASH_ERR_NAMELESS;
         *dts = timeline->last_accessed_sample_dts - info->duration;
     }
     else
     {
+        if( sample_number > timeline->info_count )
+            return LSMASH_ERR_NAMELESS;
         *dts = 0;
-        uint32_t distance = sample_number - 1;
-        lsmash_entry_t *entry;
-        for( entry = timeline->info_list->head; entry; entry = entry->next )
+        for( uint32_t i = 1; i < sample_number; i++ )
         {
-            isom_sample_info_t *info = (isom_sample_info_t *)entry->data;
+            isom_sample_info_t *info = isom_get_sample_info( timeline, i );
             if( !info )
                 return LSMASH_ERR_NAMELESS;
-            if( distance-- == 0 )
-                break;
             *dts += info->duration;
         }
-        if( !entry )
-            return LSMASH_ERR_NAMELESS;
     }
     /* Note: last_accessed_sample_number is always updated together with last_accessed_sample_dts, and vice versa. */
     timeline->last_accessed_sample_dts    = *dts;
@@ -433,7 +591,7 @@ static int isom_get_cts_from_info_list( isom_timeline_t *timeline, uint32_t samp
     int ret = isom_get_dts_from_info_list( timeline, sample_number, cts );
     if( ret < 0 )
         return ret;
-    isom_sample_info_t *info = (isom_sample_info_t *)lsmash_list_get_entry_data( timeline->info_list, sample_number );
+    isom_sample_info_t *info = isom_get_sample_info( timeline, sample_number );
     if( !info )
         return LSMASH_ERR_NAMELESS;
     *cts = isom_make_cts( *cts, info->offset, timeline->ctd_shift );
@@ -460,7 +618,7 @@ static int isom_get_cts_from_bunch_list( isom_timeline_t *timeline, uint32_t sam
 
 static int isom_get_sample_duration_from_info_list( isom_timeline_t *timeline, uint32_t sample_number, uint32_t *sample_duration )
 {
-    isom_sample_info_t *info = (isom_sample_info_t *)lsmash_list_get_entry_data( timeline->info_list, sample_number );
+    isom_sample_info_t *info = isom_get_sample_info( timeline, sample_number );
     if( !info )
         return LSMASH_ERR_NAMELESS;
     *sample_duration = info->duration;
@@ -478,7 +636,7 @@ static int isom_get_sample_duration_from_bunch_list( isom_timeline_t *timeline,
 
 static int isom_check_sample_existence_in_info_list( isom_timeline_t *timeline, uint32_t sample_number )
 {
-    isom_sample_info_t *info = (isom_sample_info_t *)lsmash_list_get_entry_data( timeline->info_list, sample_number );
+    isom_sample_info_t *info = isom_get_sample_info( timeline, sample_number );
     if( !info || !info->chunk )
         return 0;
     return !!info->chunk->file;
@@ -543,7 +701,7 @@ static lsmash_sample_t *isom_get_sample_from_media_timeline( isom_timeline_t *ti
     uint64_t dts;
     if( isom_get_dts_from_info_list( timeline, sample_number, &dts ) < 0 )
         return NULL;
-    isom_sample_info_t *info = (isom_sample_info_t *)lsmash_list_get_entry_data( timeline->info_list, sample_number );
+    isom_sample_info_t *info = isom_get_sample_info( timeline, sample_number );
     if( !info
      || !info->chunk )
         return NULL;
@@ -582,7 +740,7 @@ static int isom_get_sample_info_from_media_timeline( isom_timeline_t *timeline,
     int ret = isom_get_dts_from_info_list( timeline, sample_number, &dts );
     if( ret < 0 )
         return ret;
-    isom_sample_info_t *info = (isom_sample_info_t *)lsmash_list_get_entry_data( timeline->info_list, sample_number );
+    isom_sample_info_t *info = isom_get_sample_info( timeline, sample_number );
     if( !info )
         return LSMASH_ERR_NAMELESS;
     sample->dts    = dts;
@@ -603,7 +761,7 @@ static int isom_get_lpcm_sample_property_from_media_timeline( isom_timeline_t *t
 
 static int isom_get_sample_property_from_media_timeline( isom_timeline_t *timeline, uint32_t sample_number, lsmash_sample_property_t *prop )
 {
-    isom_sample_info_t *info = (isom_sample_info_t *)lsmash_list_get_entry_data( timeline->info_list, sample_number );
+    isom_sample_info_t *info = isom_get_sample_info( timeline, sample_number );
     if( !info )
         return LSMASH_ERR_NAMELESS;
     *prop = info->prop;
@@ -758,6 +916,9 @@ int isom_timeline_construct( lsmash_root_t *root, uint32_t track_ID )
     if( LSMASH_IS_NON_EXISTING_BOX( file->moov->mvhd )
      ||  file->moov->mvhd->timescale == 0 )
         return LSMASH_ERR_INVALID_DATA;
+    /* Nothing to do if the timeline is already present, e.g. loaded from the timeline cache. */
+    if( isom_get_timeline( root, track_ID ) )
+        return 0;
     /* Get track by track_ID. */
     isom_trak_t *trak = isom_get_trak( file, track_ID );
     if( LSMASH_IS_NON_EXISTING_BOX( trak->tkhd )
@@ -782,6 +943,7 @@ int isom_timeline_construct( lsmash_root_t *root, uint32_t track_ID )
     timeline->movie_timescale = file->moov->mvhd->timescale;
     timeline->media_timescale = trak->mdia->mdhd->timescale;
     timeline->track_duration  = trak->tkhd->duration;
+    isom_timeline_set_max_info_memory( timeline, file->max_timeline_memory );
     /* Preparation for construction. */
     isom_elst_t *elst = trak->edts->elst;
     isom_minf_t *minf = trak->mdia->minf;
@@ -1104,7 +1266,7 @@ int isom_timeline_construct( lsmash_root_t *root, uint32_t track_ID )
         }
         else if( (err = isom_add_sample_info_entry( timeline, &info )) < 0 )
             goto fail;
-        if( timeline->info_list->entry_count && timeline->bunch_list->entry_count )
+        if( timeline->info_count && timeline->bunch_list->entry_count )
         {
             lsmash_log( timeline, LSMASH_LOG_ERROR, "LPCM + non-LPCM track is not supported.\n" );
             err = LSMASH_ERR_PATCH_WELCOME;
@@ -1371,7 +1533,7 @@ int isom_timeline_construct( lsmash_root_t *root, uint32_t track_ID )
                                 else
                                     ++ bunch.sample_count;
                             }
-                            if( timeline-> info_list->entry_count
+                            if( timeline->info_count
                              && timeline->bunch_list->entry_count )
                             {
                                 lsmash_log( timeline, LSMASH_LOG_ERROR, "LPCM + non-LPCM track is not supported.\n" );
@@ -1401,7 +1563,7 @@ int isom_timeline_construct( lsmash_root_t *root, uint32_t track_ID )
         goto fail;
     /* Finish timeline construction. */
     timeline->sample_count = sample_count;
-    if( timeline->info_list->entry_count )
+    if( timeline->info_count )
         isom_timeline_set_sample_getter_funcs( timeline );
     else
         isom_timeline_set_lpcm_sample_getter_funcs( timeline );
@@ -1445,6 +1607,121 @@ int lsmash_construct_timeline( lsmash_root_t *root, uint32_t track_ID )
     return lsmash_importer_construct_timeline( root->file->importer, track_number );
 }
 
+int lsmash_append_sample_to_media_timeline( lsmash_root_t *root, uint32_t track_ID, lsmash_sample_t *sample )
+{
+    if( LSMASH_IS_NON_EXISTING_BOX( root )
+     || LSMASH_IS_NON_EXISTING_BOX( root->file )
+     || track_ID == 0
+     || !sample
+     || sample->index == 0 )
+        return LSMASH_ERR_FUNCTION_PARAM;
+    lsmash_file_t *file = root->file;
+    isom_trak_t   *trak = isom_get_trak( file, track_ID );
+    if( LSMASH_IS_NON_EXISTING_BOX( file->moov->mvhd )
+     || LSMASH_IS_NON_EXISTING_BOX( trak->tkhd )
+     || LSMASH_IS_NON_EXISTING_BOX( trak->mdia->mdhd )
+     || LSMASH_IS_NON_EXISTING_BOX( trak->mdia->minf->stbl->stsd )
+     ||  file->moov->mvhd->timescale  == 0
+     ||  trak->mdia->mdhd->timescale == 0 )
+        return LSMASH_ERR_INVALID_DATA;
+    isom_timeline_t *timeline = isom_get_timeline( root, track_ID );
+    if( !timeline )
+    {
+        /* Create an empty timeline. */
+        if( !file->timeline )
+        {
+            file->timeline = lsmash_list_create( isom_timeline_destroy );
+            if( !file->timeline )
+                return LSMASH_ERR_MEMORY_ALLOC;
+        }
+        timeline = isom_timeline_create();
+        if( !timeline )
+            return LSMASH_ERR_MEMORY_ALLOC;
+        if( lsmash_list_add_entry( file->timeline, timeline ) < 0 )
+        {
+            isom_timeline_destroy( timeline );
+            return LSMASH_ERR_MEMORY_ALLOC;
+        }
+        timeline->track_ID        = track_ID;
+        timeline->movie_timescale = file->moov->mvhd->timescale;
+        timeline->media_timescale = trak->mdia->mdhd->timescale;
+        timeline->track_duration  = trak->tkhd->duration;
+        isom_timeline_set_max_info_memory( timeline, file->max_timeline_memory );
+        isom_timeline_set_sample_getter_funcs( timeline );
+    }
+    else if( timeline->bunch_list->entry_count )
+    {
+        lsmash_log( timeline, LSMASH_LOG_ERROR, "Appending samples to LPCM track is not supported.\n" );
+        return LSMASH_ERR_PATCH_WELCOME;
+    }
+    /* Get DTS of the last sample. */
+    isom_sample_info_t *last_info = isom_get_sample_info( timeline, timeline->info_count );
+    uint64_t last_dts = last_info ? timeline->media_duration - last_info->duration : 0;
+    if( last_info ? (sample->dts <= last_dts || sample->dts - last_dts > UINT32_MAX) : (sample->dts != 0) )
+        return LSMASH_ERR_INVALID_DATA;
+    /* Make the sample offset. */
+    isom_sample_info_t info;
+    if( sample->cts == LSMASH_TIMESTAMP_UNDEFINED )
+        info.offset = ISOM_NON_OUTPUT_SAMPLE_OFFSET;
+    else
+    {
+        int64_t sample_offset = (int64_t)(sample->cts - sample->dts);
+        if( timeline->ctd_shift ? (sample_offset <= INT32_MIN || sample_offset > INT32_MAX)
+                                : (sample->cts < sample->dts || sample_offset >= ISOM_NON_OUTPUT_SAMPLE_OFFSET) )
+            return LSMASH_ERR_INVALID_DATA;
+        info.offset = (uint32_t)sample_offset;
+    }
+    /* Reference media data. */
+    isom_sample_entry_t *description = (isom_sample_entry_t *)lsmash_list_get_entry_data( &trak->mdia->minf->stbl->stsd->list, sample->index );
+    if( LSMASH_IS_NON_EXISTING_BOX( description ) )
+        return LSMASH_ERR_INVALID_DATA;
+    isom_dref_entry_t *dref_entry = (isom_dref_entry_t *)lsmash_list_get_entry_data( &trak->mdia->minf->dinf->dref->list, description->data_reference_index );
+    lsmash_file_t     *ref_file   = (!dref_entry || LSMASH_IS_NON_EXISTING_BOX( dref_entry->ref_file )) ? NULL : dref_entry->ref_file;
+    /* Physically consecutive samples are considered as one chunk. */
+    isom_portable_chunk_t *chunk = lsmash_list_get_entry_data( timeline->chunk_list, timeline->chunk_list->entry_count );
+    if( !chunk || chunk->data_offset + chunk->length != sample->pos || chunk->file != ref_file )
+    {
+        isom_portable_chunk_t new_chunk;
+        new_chunk.data_offset = sample->pos;
+        new_chunk.length      = 0;
+        new_chunk.number      = chunk ? chunk->number + 1 : 1;
+        new_chunk.file        = ref_file;
+        int err = isom_add_portable_chunk_entry( timeline, &new_chunk );
+        if( err < 0 )
+            return err;
+        chunk = lsmash_list_get_entry_data( timeline->chunk_list, timeline->chunk_list->entry_count );
+    }
+    info.pos      = sample->pos;
+    info.duration = last_info ? (uint32_t)(sample->dts - last_dts) : 0;
+    info.length   = sample->length;
+    info.index    = sample->index;
+    info.chunk    = chunk;
+    info.prop     = sample->prop;
+    uint32_t last_duration = info.duration;
+    int err = isom_add_sample_info_entry( timeline, &info );
+    if( err < 0 )
+        return err;
+    chunk->length += sample->length;
+    /* Revise the duration of the previous last sample.
+     * Get it again since the sample info may be spilled out by the addition. */
+    if( (last_info = isom_get_sample_info_to_update( timeline, timeline->info_count - 1 )) )
+        last_info->duration = last_duration;
+    timeline->media_duration  = sample->dts + last_duration;
+    timeline->sample_count    = timeline->info_count;
+    timeline->max_sample_size = LSMASH_MAX( timeline->max_sample_size, sample->length );
+    /* The file may have grown after the end of the stream was reached.
+     * If the sample lies beyond the end, forget the end and read the stream again. */
+    lsmash_bs_t *bs = ref_file ? ref_file->bs : NULL;
+    if( bs && bs->eof && !bs->unseekable && sample->pos + sample->length > bs->offset )
+    {
+        uint64_t pos = lsmash_bs_get_stream_pos( bs );
+        lsmash_bs_empty( bs );
+        if( lsmash_bs_read_seek( bs, pos, SEEK_SET ) < 0 )
+            return LSMASH_ERR_IO;
+    }
+    return 0;
+}
+
 int lsmash_get_dts_from_media_timeline( lsmash_root_t *root, uint32_t track_ID, uint32_t sample_number, uint64_t *dts )
 {
     if( !sample_number || !dts )
@@ -1500,41 +1777,31 @@ int lsmash_get_composition_to_decode_shift_from_media_timeline( lsmash_root_t *r
 
 static int isom_get_closest_past_random_accessible_point_from_media_timeline( isom_timeline_t *timeline, uint32_t sample_number, uint32_t *rap_number )
 {
-    lsmash_entry_t *entry = lsmash_list_get_entry( timeline->info_list, sample_number-- );
-    if( !entry
-     || !entry->data )
+    isom_sample_info_t *info = isom_get_sample_info( timeline, sample_number );
+    if( !info )
         return LSMASH_ERR_NAMELESS;
-    isom_sample_info_t *info = (isom_sample_info_t *)entry->data;
     while( info->prop.ra_flags == ISOM_SAMPLE_RANDOM_ACCESS_FLAG_NONE )
     {
-        entry = entry->prev;
-        if( !entry
-         || !entry->data )
+        info = isom_get_sample_info( timeline, --sample_number );
+        if( !info )
             return LSMASH_ERR_NAMELESS;
-        info = (isom_sample_info_t *)entry->data;
-        --sample_number;
     }
-    *rap_number = sample_number + 1;
+    *rap_number = sample_number;
     return 0;
 }
 
 static inline int isom_get_closest_future_random_accessible_point_from_media_timeline( isom_timeline_t *timeline, uint32_t sample_number, uint32_t *rap_number )
 {
-    lsmash_entry_t *entry = lsmash_list_get_entry( timeline->info_list, sample_number++ );
-    if( !entry
-     || !entry->data )
+    isom_sample_info_t *info = isom_get_sample_info( timeline, sample_number );
+    if( !info )
         return LSMASH_ERR_NAMELESS;
-    isom_sample_info_t *info = (isom_sample_info_t *)entry->data;
     while( info->prop.ra_flags == ISOM_SAMPLE_RANDOM_ACCESS_FLAG_NONE )
     {
-        entry = entry->next;
-        if( !entry
-         || !entry->data )
+        info = isom_get_sample_info( timeline, ++sample_number );
+        if( !info )
             return LSMASH_ERR_NAMELESS;
-        info = (isom_sample_info_t *)entry->data;
-        ++sample_number;
     }
-    *rap_number = sample_number - 1;
+    *rap_number = sample_number;
     return 0;
 }
 
@@ -1556,7 +1823,7 @@ int lsmash_get_closest_random_accessible_point_from_media_timeline( lsmash_root_
     isom_timeline_t *timeline = isom_get_timeline( root, track_ID );
     if( !timeline )
         return LSMASH_ERR_NAMELESS;
-    if( timeline->info_list->entry_count == 0 )
+    if( timeline->info_count == 0 )
     {
         *rap_number = sample_number;    /* All LPCM is sync sample. */
         return 0;
@@ -1572,7 +1839,7 @@ int lsmash_get_closest_random_accessible_point_detail_from_media_timeline( lsmas
     isom_timeline_t *timeline = isom_get_timeline( root, track_ID );
     if( !timeline )
         return LSMASH_ERR_NAMELESS;
-    if( timeline->info_list->entry_count == 0 )
+    if( timeline->info_count == 0 )
     {
         /* All LPCM is sync sample. */
         *rap_number = sample_number;
@@ -1587,7 +1854,7 @@ int lsmash_get_closest_random_accessible_point_detail_from_media_timeline( lsmas
     int ret = isom_get_closest_random_accessible_point_from_media_timeline_internal( timeline, sample_number, rap_number );
     if( ret < 0 )
         return ret;
-    isom_sample_info_t *info = (isom_sample_info_t *)lsmash_list_get_entry_data( timeline->info_list, *rap_number );
+    isom_sample_info_t *info = isom_get_sample_info( timeline, *rap_number );
     if( !info )
         return LSMASH_ERR_NAMELESS;
     if( ra_flags )
@@ -1614,7 +1881,7 @@ int lsmash_get_closest_random_accessible_point_detail_from_media_timeline( lsmas
                 dts += info->duration;
                 if( rap_cts <= dts )
                     break;  /* leading samples of this random accessible point must not be present more. */
-                info = (isom_sample_info_t *)lsmash_list_get_entry_data( timeline->info_list, current_sample_number++ );
+                info = isom_get_sample_info( timeline, current_sample_number++ );
                 if( !info )
                     break;
                 uint64_t cts = isom_make_cts_adjust( dts, info->offset, timeline->ctd_shift );
@@ -1631,7 +1898,7 @@ int lsmash_get_closest_random_accessible_point_detail_from_media_timeline( lsmas
             if( isom_get_closest_past_random_accessible_point_from_media_timeline( timeline, prev_rap_number - 1, &prev_rap_number ) < 0 )
                 /* The previous random accessible point is not present. */
                 return 0;
-            info = (isom_sample_info_t *)lsmash_list_get_entry_data( timeline->info_list, prev_rap_number );
+            info = isom_get_sample_info( timeline, prev_rap_number );
             if( !info )
                 return LSMASH_ERR_NAMELESS;
             if( !(info->prop.ra_flags & ISOM_SAMPLE_RANDOM_ACCESS_FLAG_GDR) )
@@ -1704,7 +1971,7 @@ int lsmash_get_closest_random_accessible_point_detail_from_media_timeline( lsmas
         if( isom_get_closest_past_random_accessible_point_from_media_timeline( timeline, prev_rap_number - 1, &prev_rap_number ) < 0 )
             /* The previous random accessible point is not present. */
             return 0;
-        info = (isom_sample_info_t *)lsmash_list_get_entry_data( timeline->info_list, prev_rap_number );
+        info = isom_get_sample_info( timeline, prev_rap_number );
         if( !info )
             return LSMASH_ERR_NAMELESS;
         if( !(info->prop.ra_flags & ISOM_SAMPLE_RANDOM_ACCESS_FLAG_GDR) || sample_number >= info->prop.post_roll.complete )
@@ -1902,12 +2169,12 @@ int lsmash_set_media_timestamps( lsmash_root_t *root, uint32_t track_ID, lsmash_
     isom_timeline_t *timeline = isom_get_timeline( root, track_ID );
     if( !timeline )
         return LSMASH_ERR_NAMELESS;
-    if( timeline->info_list->entry_count == 0 )
+    if( timeline->info_count == 0 )
     {
         lsmash_log( timeline, LSMASH_LOG_ERROR, "Changing timestamps of LPCM track is not supported.\n" );
         return LSMASH_ERR_PATCH_WELCOME;
     }
-    if( ts_list->sample_count != timeline->info_list->entry_count )
+    if( ts_list->sample_count != timeline->info_count )
         return LSMASH_ERR_INVALID_DATA; /* Number of samples must be same. */
     lsmash_media_ts_t *ts = ts_list->timestamp;
     if( ts[0].dts )
@@ -1915,40 +2182,45 @@ int lsmash_set_media_timestamps( lsmash_root_t *root, uint32_t track_ID, lsmash_
     /* Update DTSs. */
     uint32_t sample_count  = ts_list->sample_count;
     uint32_t i;
-    if( timeline->info_list->entry_count > 1 )
+    if( timeline->info_count > 1 )
     {
         i = 1;
-        lsmash_entry_t *entry = timeline->info_list->head;
         isom_sample_info_t *info = NULL;
         while( i < sample_count )
         {
-            info = (isom_sample_info_t *)entry->data;
+            info = isom_get_sample_info_to_update( timeline, i );
             if( !info || (ts[i].dts < ts[i - 1].dts) )
                 return LSMASH_ERR_INVALID_DATA;
             info->duration = ts[i].dts - ts[i - 1].dts;
-            entry = entry->next;
             ++i;
         }
         if( i > 1 )
         {
-            if( !entry
-             || !entry->data )
+            uint32_t last_duration = info->duration;
+            info = isom_get_sample_info_to_update( timeline, i );
+            if( !info )
                 return LSMASH_ERR_INVALID_DATA;
             /* Copy the previous duration. */
-            ((isom_sample_info_t *)entry->data)->duration = info->duration;
+            info->duration = last_duration;
         }
         else
             return LSMASH_ERR_INVALID_DATA; /* Irregular case: sample_count this timeline has is incorrect. */
     }
     else    /* still image */
-        ((isom_sample_info_t *)timeline->info_list->head->data)->duration = UINT32_MAX;
+    {
+        isom_sample_info_t *info = isom_get_sample_info_to_update( timeline, 1 );
+        if( !info )
+            return LSMASH_ERR_NAMELESS;
+        info->duration = UINT32_MAX;
+    }
     /* Update CTSs.
      * ToDo: hint track must not have any sample_offset. */
-    i = 0;
     timeline->ctd_shift = 0;
-    for( lsmash_entry_t *entry = timeline->info_list->head; entry; entry = entry->next )
+    for( i = 0; i < sample_count; i++ )
     {
-        isom_sample_info_t *info = (isom_sample_info_t *)entry->data;
+        isom_sample_info_t *info = isom_get_sample_info_to_update( timeline, i + 1 );
+        if( !info )
+            return LSMASH_ERR_NAMELESS;
         if( ts[i].cts != LSMASH_TIMESTAMP_UNDEFINED )
         {
             if( (ts[i].cts + timeline->ctd_shift) < ts[i].dts )
@@ -1957,7 +2229,6 @@ int lsmash_set_media_timestamps( lsmash_root_t *root, uint32_t track_ID, lsmash_
         }
         else
             info->offset = ISOM_NON_OUTPUT_SAMPLE_OFFSET;
-        ++i;
     }
     if( timeline->ctd_shift && (!root->file->qt_compatible || root->file->max_isom_version < 4) )
         return LSMASH_ERR_INVALID_DATA; /* Don't allow composition to decode timeline shift. */
@@ -1971,7 +2242,7 @@ int lsmash_get_media_timestamps( lsmash_root_t *root, uint32_t track_ID, lsmash_
     isom_timeline_t *timeline = isom_get_timeline( root, track_ID );
     if( !timeline )
         return LSMASH_ERR_NAMELESS;
-    uint32_t sample_count = timeline->info_list->entry_count;
+    uint32_t sample_count = timeline->info_count;
     if( sample_count == 0 )
     {
         ts_list->sample_count = 0;
@@ -1983,10 +2254,10 @@ int lsmash_get_media_timestamps( lsmash_root_t *root, uint32_t track_ID, lsmash_
         return LSMASH_ERR_MEMORY_ALLOC;
     uint64_t dts = 0;
     uint32_t i = 0;
-    if( timeline->info_list->entry_count )
-        for( lsmash_entry_t *entry = timeline->info_list->head; entry; entry = entry->next )
+    if( timeline->info_count )
+        for( i = 0; i < sample_count; i++ )
         {
-            isom_sample_info_t *info = (isom_sample_info_t *)entry->data;
+            isom_sample_info_t *info = isom_get_sample_info( timeline, i + 1 );
             if( !info )
             {
                 lsmash_free( ts );
@@ -1995,7 +2266,6 @@ int lsmash_get_media_timestamps( lsmash_root_t *root, uint32_t track_ID, lsmash_
             ts[i].dts = dts;
             ts[i].cts = isom_make_cts( dts, info->offset, timeline->ctd_shift );
             dts += info->duration;
-            ++i;
         }
     else
         for( lsmash_entry_t *entry = timeline->bunch_list->head; entry; entry = entry->next )
@@ -2079,3 +2349,461 @@ int lsmash_get_max_sample_delay( lsmash_media_ts_list_t *ts_list, uint32_t *max_
     ts_list->timestamp = orig_ts;
     return 0;
 }
+
+/*---- timeline cache ----*/
+/* The timeline cache is a sidecar file holding the constructed timelines of a file so that
+ * the construction, which walks every entry of the sample tables and the movie fragments, can be skipped
+ * when the same file is opened again.
+ * All fields are big-endian and each kind of record has the fixed size, therefore the image of the cache
+ * can be accessed directly once loaded on memory.
+ *
+ *   header : magic, version, size and last modification time of the media file, number of timelines
+ *   per timeline :
+ *     track_ID, movie/media timescale, sample_count, max_sample_size, ctd_shift,
+ *     media/track duration, number of edits, chunks, sample info and LPCM bunches
+ *     edits, chunks, sample info and LPCM bunches as arrays of fixed size records
+ *
+ * Chunks are referenced by the chunk number in each timeline.
+ * The referenced file of each chunk is stored as the data_reference_index of the track. */
+#define ISOM_TIMELINE_CACHE_MAGIC       LSMASH_4CC( 'L', 'S', 'T', 'C' )
+#define ISOM_TIMELINE_CACHE_VERSION     2
+#define ISOM_TIMELINE_CACHE_HEADER_SIZE 28
+#define ISOM_TIMELINE_CACHE_TRACK_SIZE  56
+#define ISOM_TIMELINE_CACHE_EDIT_SIZE   20
+#define ISOM_TIMELINE_CACHE_CHUNK_SIZE  20
+#define ISOM_TIMELINE_CACHE_PROP_SIZE   24
+#define ISOM_TIMELINE_CACHE_INFO_SIZE   (28 + ISOM_TIMELINE_CACHE_PROP_SIZE)
+#define ISOM_TIMELINE_CACHE_BUNCH_SIZE  (ISOM_TIMELINE_CACHE_INFO_SIZE + 4)
+
+static void isom_put_cached_sample_property( lsmash_bs_t *bs, lsmash_sample_property_t *prop )
+{
+    lsmash_bs_put_be32( bs, prop->ra_flags );
+    lsmash_bs_put_be32( bs, prop->post_roll.identifier );
+    lsmash_bs_put_be32( bs, prop->post_roll.complete );
+    lsmash_bs_put_be32( bs, prop->pre_roll.distance );
+    lsmash_bs_put_byte( bs, prop->allow_earlier );
+    lsmash_bs_put_byte( bs, prop->leading );
+    lsmash_bs_put_byte( bs, prop->independent );
+    lsmash_bs_put_byte( bs, prop->disposable );
+    lsmash_bs_put_byte( bs, prop->redundant );
+    lsmash_bs_put_bytes( bs, 3, prop->reserved );
+}
+
+static void isom_get_cached_sample_property( lsmash_bs_t *bs, lsmash_sample_property_t *prop )
+{
+    prop->ra_flags             = lsmash_bs_get_be32( bs );
+    prop->post_roll.identifier = lsmash_bs_get_be32( bs );
+    prop->post_roll.complete   = lsmash_bs_get_be32( bs );
+    prop->pre_roll.distance    = lsmash_bs_get_be32( bs );
+    prop->allow_earlier        = lsmash_bs_get_byte( bs );
+    prop->leading              = lsmash_bs_get_byte( bs );
+    prop->independent          = lsmash_bs_get_byte( bs );
+    prop->disposable           = lsmash_bs_get_byte( bs );
+    prop->redundant            = lsmash_bs_get_byte( bs );
+    for( int i = 0; i < 3; i++ )
+        prop->reserved[i] = lsmash_bs_get_byte( bs );
+}
+
+/* Return the chunk number of a given chunk by advancing the current position in the chunk list.
+ * Samples refer to chunks in ascending order, so the walk is linear over the whole timeline.
+ * Return 0 if not found. */
+static uint32_t isom_find_portable_chunk_number
+(
+    lsmash_entry_t       **chunk_entry,
+    uint32_t              *chunk_number,
+    isom_portable_chunk_t *chunk
+)
+{
+    while( *chunk_entry )
+    {
+        if( (*chunk_entry)->data == chunk )
+            return *chunk_number;
+        *chunk_entry   = (*chunk_entry)->next;
+        *chunk_number += 1;
+    }
+    return 0;
+}
+
+static uint32_t isom_get_portable_chunk_data_reference_index( lsmash_entry_list_t *dref_list, isom_portable_chunk_t *chunk )
+{
+    if( !dref_list || !chunk->file )
+        return 0;
+    uint32_t data_reference_index = 1;
+    for( lsmash_entry_t *entry = dref_list->head; entry; entry = entry->next )
+    {
+        isom_dref_entry_t *dref_entry = (isom_dref_entry_t *)entry->data;
+        if( dref_entry && dref_entry->ref_file == chunk->file )
+            return data_reference_index;
+        ++data_reference_index;
+    }
+    return 0;
+}
+
+static int isom_put_cached_timeline( lsmash_bs_t *bs, lsmash_file_t *file, isom_timeline_t *timeline )
+{
+    isom_trak_t *trak = isom_get_trak( file, timeline->track_ID );
+    if( LSMASH_IS_NON_EXISTING_BOX( trak->tkhd ) )
+        return LSMASH_ERR_NAMELESS;
+    isom_dref_t *dref = trak->mdia->minf->dinf->dref;
+    lsmash_entry_list_t *dref_list = LSMASH_IS_EXISTING_BOX( dref ) ? &dref->list : NULL;
+    lsmash_bs_put_be32( bs, timeline->track_ID );
+    lsmash_bs_put_be32( bs, timeline->movie_timescale );
+    lsmash_bs_put_be32( bs, timeline->media_timescale );
+    lsmash_bs_put_be32( bs, timeline->sample_count );
+    lsmash_bs_put_be32( bs, timeline->max_sample_size );
+    lsmash_bs_put_be32( bs, timeline->ctd_shift );
+    lsmash_bs_put_be64( bs, timeline->media_duration );
+    lsmash_bs_put_be64( bs, timeline->track_duration );
+    lsmash_bs_put_be32( bs, timeline->edit_list ->entry_count );
+    lsmash_bs_put_be32( bs, timeline->chunk_list->entry_count );
+    lsmash_bs_put_be32( bs, timeline->info_count );
+    lsmash_bs_put_be32( bs, timeline->bunch_list->entry_count );
+    for( lsmash_entry_t *entry = timeline->edit_list->head; entry; entry = entry->next )
+    {
+        isom_elst_entry_t *edit = (isom_elst_entry_t *)entry->data;
+        if( !edit )
+            return LSMASH_ERR_NAMELESS;
+        lsmash_bs_put_be64( bs, edit->segment_duration );
+        lsmash_bs_put_be64( bs, edit->media_time );
+        lsmash_bs_put_be32( bs, edit->media_rate );
+    }
+    for( lsmash_entry_t *entry = timeline->chunk_list->head; entry; entry = entry->next )
+    {
+        isom_portable_chunk_t *chunk = (isom_portable_chunk_t *)entry->data;
+        if( !chunk )
+            return LSMASH_ERR_NAMELESS;
+        lsmash_bs_put_be64( bs, chunk->data_offset );
+        lsmash_bs_put_be64( bs, chunk->length );
+        lsmash_bs_put_be32( bs, isom_get_portable_chunk_data_reference_index( dref_list, chunk ) );
+    }
+    lsmash_entry_t *chunk_entry  = timeline->chunk_list->head;
+    uint32_t        chunk_number = 1;
+    for( uint32_t i = 1; i <= timeline->info_count; i++ )
+    {
+        isom_sample_info_t *info = isom_get_sample_info( timeline, i );
+        if( !info )
+            return LSMASH_ERR_NAMELESS;
+        lsmash_bs_put_be64( bs, info->pos );
+        lsmash_bs_put_be32( bs, info->duration );
+        lsmash_bs_put_be32( bs, info->offset );
+        lsmash_bs_put_be32( bs, info->length );
+        lsmash_bs_put_be32( bs, info->index );
+        lsmash_bs_put_be32( bs, info->chunk ? isom_find_portable_chunk_number( &chunk_entry, &chunk_number, info->chunk ) : 0 );
+        isom_put_cached_sample_property( bs, &info->prop );
+    }
+    chunk_entry  = timeline->chunk_list->head;
+    chunk_number = 1;
+    for( lsmash_entry_t *entry = timeline->bunch_list->head; entry; entry = entry->next )
+    {
+        isom_lpcm_bunch_t *bunch = (isom_lpcm_bunch_t *)entry->data;
+        if( !bunch )
+            return LSMASH_ERR_NAMELESS;
+        lsmash_bs_put_be64( bs, bunch->pos );
+        lsmash_bs_put_be32( bs, bunch->duration );
+        lsmash_bs_put_be32( bs, bunch->offset );
+        lsmash_bs_put_be32( bs, bunch->length );
+        lsmash_bs_put_be32( bs, bunch->index );
+        lsmash_bs_put_be32( bs, bunch->chunk ? isom_find_portable_chunk_number( &chunk_entry, &chunk_number, bunch->chunk ) : 0 );
+        isom_put_cached_sample_property( bs, &bunch->prop );
+        lsmash_bs_put_be32( bs, bunch->sample_count );
+    }
+    return bs->error ? LSMASH_ERR_MEMORY_ALLOC : 0;
+}
+
+int lsmash_write_timeline_cache( lsmash_root_t *root, const char *cache_filename, const char *media_filename )
+{
+    if( isom_check_initializer_present( root ) < 0
+     || !cache_filename
+     || !media_filename )
+        return LSMASH_ERR_FUNCTION_PARAM;
+    lsmash_file_t *file = root->file;
+    if( !file->timeline || file->timeline->entry_count == 0 )
+        return LSMASH_ERR_NAMELESS;
+    uint64_t media_size;
+    int64_t  media_mtime;
+    int err = lsmash_get_file_status( media_filename, &media_size, &media_mtime );
+    if( err < 0 )
+        return err;
+    lsmash_bs_t *bs = lsmash_bs_create();
+    if( !bs )
+        return LSMASH_ERR_MEMORY_ALLOC;
+    lsmash_bs_put_be32( bs, ISOM_TIMELINE_CACHE_MAGIC );
+    lsmash_bs_put_be32( bs, ISOM_TIMELINE_CACHE_VERSION );
+    lsmash_bs_put_be64( bs, media_size );
+    lsmash_bs_put_be64( bs, media_mtime );
+    lsmash_bs_put_be32( bs, file->timeline->entry_count );
+    for( lsmash_entry_t *entry = file->timeline->head; entry; entry = entry->next )
+    {
+        isom_timeline_t *timeline = (isom_timeline_t *)entry->data;
+        if( !timeline )
+        {
+            err = LSMASH_ERR_NAMELESS;
+            goto fail;
+        }
+        if( (err = isom_put_cached_timeline( bs, file->initializer, timeline )) < 0 )
+            goto fail;
+    }
+    FILE *fp = lsmash_fopen( cache_filename, "wb" );
+    if( !fp )
+    {
+        err = LSMASH_ERR_IO;
+        goto fail;
+    }
+    size_t cache_size = lsmash_bs_get_valid_data_size( bs );
+    if( fwrite( lsmash_bs_get_buffer_data_start( bs ), 1, cache_size, fp ) != cache_size )
+        err = LSMASH_ERR_IO;
+    if( fclose( fp ) != 0 )
+        err = LSMASH_ERR_IO;
+    if( err < 0 )
+        remove( cache_filename );
+fail:
+    lsmash_bs_cleanup( bs );
+    return err;
+}
+
+/* Get the number of samples of a track listed in the sample table and the track runs read from the file. */
+static uint64_t isom_get_parsed_sample_count( lsmash_file_t *file, isom_trak_t *trak )
+{
+    uint64_t sample_count = isom_get_sample_count( trak );
+    for( lsmash_entry_t *moof_entry = file->moof_list.head; moof_entry; moof_entry = moof_entry->next )
+    {
+        isom_moof_t *moof = (isom_moof_t *)moof_entry->data;
+        if( LSMASH_IS_NON_EXISTING_BOX( moof ) )
+            continue;
+        for( lsmash_entry_t *traf_entry = moof->traf_list.head; traf_entry; traf_entry = traf_entry->next )
+        {
+            isom_traf_t *traf = (isom_traf_t *)traf_entry->data;
+            if( LSMASH_IS_NON_EXISTING_BOX( traf )
+             || traf->tfhd->track_ID != trak->tkhd->track_ID )
+                continue;
+            for( lsmash_entry_t *trun_entry = traf->trun_list.head; trun_entry; trun_entry = trun_entry->next )
+            {
+                isom_trun_t *trun = (isom_trun_t *)trun_entry->data;
+                if( LSMASH_IS_EXISTING_BOX( trun ) )
+                    sample_count += trun->sample_count;
+            }
+        }
+    }
+    return sample_count;
+}
+
+static isom_timeline_t *isom_get_cached_timeline( lsmash_bs_t *bs, lsmash_file_t *file, int *err )
+{
+    *err = LSMASH_ERR_INVALID_DATA;
+    if( lsmash_bs_get_remaining_buffer_size( bs ) < ISOM_TIMELINE_CACHE_TRACK_SIZE )
+        return NULL;
+    isom_timeline_t *timeline = isom_timeline_create();
+    if( !timeline )
+    {
+        *err = LSMASH_ERR_MEMORY_ALLOC;
+        return NULL;
+    }
+    isom_portable_chunk_t **chunks = NULL;
+    isom_timeline_set_max_info_memory( timeline, file->max_timeline_memory );
+    timeline->track_ID        = lsmash_bs_get_be32( bs );
+    timeline->movie_timescale = lsmash_bs_get_be32( bs );
+    timeline->media_timescale = lsmash_bs_get_be32( bs );
+    timeline->sample_count    = lsmash_bs_get_be32( bs );
+    timeline->max_sample_size = lsmash_bs_get_be32( bs );
+    timeline->ctd_shift       = lsmash_bs_get_be32( bs );
+    timeline->media_duration  = lsmash_bs_get_be64( bs );
+    timeline->track_duration  = lsmash_bs_get_be64( bs );
+    uint32_t edit_count  = lsmash_bs_get_be32( bs );
+    uint32_t chunk_count = lsmash_bs_get_be32( bs );
+    uint32_t info_count  = lsmash_bs_get_be32( bs );
+    uint32_t bunch_count = lsmash_bs_get_be32( bs );
+    /* Check if the cached timeline still matches the track of the file. */
+    isom_trak_t *trak = isom_get_trak( file, timeline->track_ID );
+    if( LSMASH_IS_NON_EXISTING_BOX( trak->tkhd )
+     || LSMASH_IS_NON_EXISTING_BOX( trak->mdia->mdhd )
+     || LSMASH_IS_NON_EXISTING_BOX( file->moov->mvhd )
+     || trak->mdia->mdhd->timescale != timeline->media_timescale
+     || file->moov->mvhd->timescale != timeline->movie_timescale
+     || isom_get_parsed_sample_count( file, trak ) != timeline->sample_count
+     || (info_count && bunch_count) )
+        goto fail;
+    if( lsmash_bs_get_remaining_buffer_size( bs ) < (uint64_t)edit_count  * ISOM_TIMELINE_CACHE_EDIT_SIZE
+                                                   + (uint64_t)chunk_count * ISOM_TIMELINE_CACHE_CHUNK_SIZE
+                                                   + (uint64_t)info_count  * ISOM_TIMELINE_CACHE_INFO_SIZE
+                                                   + (uint64_t)bunch_count * ISOM_TIMELINE_CACHE_BUNCH_SIZE )
+        goto fail;
+    *err = LSMASH_ERR_MEMORY_ALLOC;
+    for( uint32_t i = 0; i < edit_count; i++ )
+    {
+        isom_elst_entry_t *edit = lsmash_malloc( sizeof(isom_elst_entry_t) );
+        if( !edit )
+            goto fail;
+        edit->segment_duration = lsmash_bs_get_be64( bs );
+        edit->media_time       = lsmash_bs_get_be64( bs );
+        edit->media_rate       = lsmash_bs_get_be32( bs );
+        if( lsmash_list_add_entry( timeline->edit_list, edit ) < 0 )
+        {
+            lsmash_free( edit );
+            goto fail;
+        }
+    }
+    isom_dref_t *dref = trak->mdia->minf->dinf->dref;
+    lsmash_entry_list_t *dref_list = LSMASH_IS_EXISTING_BOX( dref ) ? &dref->list : NULL;
+    chunks = lsmash_malloc( LSMASH_MAX( chunk_count, 1 ) * sizeof(isom_portable_chunk_t *) );
+    if( !chunks )
+        goto fail;
+    for( uint32_t i = 0; i < chunk_count; i++ )
+    {
+        isom_portable_chunk_t chunk;
+        chunk.data_offset = lsmash_bs_get_be64( bs );
+        chunk.length      = lsmash_bs_get_be64( bs );
+        chunk.number      = i + 1;
+        isom_dref_entry_t *dref_entry = (isom_dref_entry_t *)lsmash_list_get_entry_data( dref_list, lsmash_bs_get_be32( bs ) );
+        chunk.file        = (!dref_entry || LSMASH_IS_NON_EXISTING_BOX( dref_entry->ref_file )) ? NULL : dref_entry->ref_file;
+        if( (*err = isom_add_portable_chunk_entry( timeline, &chunk )) < 0 )
+            goto fail;
+        chunks[i] = (isom_portable_chunk_t *)timeline->chunk_list->tail->data;
+    }
+    *err = LSMASH_ERR_INVALID_DATA;
+    for( uint32_t i = 0; i < info_count; i++ )
+    {
+        isom_sample_info_t info;
+        info.pos      = lsmash_bs_get_be64( bs );
+        info.duration = lsmash_bs_get_be32( bs );
+        info.offset   = lsmash_bs_get_be32( bs );
+        info.length   = lsmash_bs_get_be32( bs );
+        info.index    = lsmash_bs_get_be32( bs );
+        uint32_t chunk_number = lsmash_bs_get_be32( bs );
+        if( chunk_number > chunk_count )
+            goto fail;
+        info.chunk = chunk_number ? chunks[chunk_number - 1] : NULL;
+        isom_get_cached_sample_property( bs, &info.prop );
+        if( (*err = isom_add_sample_info_entry( timeline, &info )) < 0 )
+            goto fail;
+        *err = LSMASH_ERR_INVALID_DATA;
+    }
+    for( uint32_t i = 0; i < bunch_count; i++ )
+    {
+        isom_lpcm_bunch_t bunch;
+        bunch.pos      = lsmash_bs_get_be64( bs );
+        bunch.duration = lsmash_bs_get_be32( bs );
+        bunch.offset   = lsmash_bs_get_be32( bs );
+        bunch.length   = lsmash_bs_get_be32( bs );
+        bunch.index    = lsmash_bs_get_be32( bs );
+        uint32_t chunk_number = lsmash_bs_get_be32( bs );
+        if( chunk_number > chunk_count )
+            goto fail;
+        bunch.chunk = chunk_number ? chunks[chunk_number - 1] : NULL;
+        isom_get_cached_sample_property( bs, &bunch.prop );
+        bunch.sample_count = lsmash_bs_get_be32( bs );
+        if( (*err = isom_add_lpcm_bunch_entry( timeline, &bunch )) < 0 )
+            goto fail;
+        *err = LSMASH_ERR_INVALID_DATA;
+    }
+    if( bs->eob || bs->error )
+        goto fail;
+    lsmash_free( chunks );
+    if( timeline->info_count )
+        isom_timeline_set_sample_getter_funcs( timeline );
+    else
+        isom_timeline_set_lpcm_sample_getter_funcs( timeline );
+    *err = 0;
+    return timeline;
+fail:
+    lsmash_free( chunks );
+    isom_timeline_destroy( timeline );
+    return NULL;
+}
+
+int lsmash_read_timeline_cache( lsmash_root_t *root, const char *cache_filename, const char *media_filename )
+{
+    if( isom_check_initializer_present( root ) < 0
+     || !cache_filename
+     || !media_filename )
+        return LSMASH_ERR_FUNCTION_PARAM;
+    lsmash_file_t *file = root->file;
+    uint64_t media_size;
+    int64_t  media_mtime;
+    int err = lsmash_get_file_status( media_filename, &media_size, &media_mtime );
+    if( err < 0 )
+        return err;
+    /* Load the whole cache on memory. */
+    FILE *fp = lsmash_fopen( cache_filename, "rb" );
+    if( !fp )
+        return LSMASH_ERR_IO;
+    uint8_t *data = NULL;
+    int64_t  cache_size;
+    if( lsmash_fseek( fp, 0, SEEK_END ) != 0
+     || (cache_size = lsmash_ftell( fp )) < ISOM_TIMELINE_CACHE_HEADER_SIZE
+     || (uint64_t)cache_size > SIZE_MAX
+     || lsmash_fseek( fp, 0, SEEK_SET ) != 0 )
+    {
+        fclose( fp );
+        return LSMASH_ERR_INVALID_DATA;
+    }
+    data = lsmash_malloc( cache_size );
+    if( !data )
+    {
+        fclose( fp );
+        return LSMASH_ERR_MEMORY_ALLOC;
+    }
+    size_t read_size = fread( data, 1, cache_size, fp );
+    fclose( fp );
+    if( read_size != (size_t)cache_size )
+    {
+        lsmash_free( data );
+        return LSMASH_ERR_IO;
+    }
+    lsmash_entry_list_t timelines;
+    lsmash_list_init( &timelines, isom_timeline_destroy );
+    lsmash_bs_t *bs = lsmash_bs_create();
+    if( !bs )
+    {
+        err = LSMASH_ERR_MEMORY_ALLOC;
+        goto fail;
+    }
+    if( (err = lsmash_bs_set_empty_stream( bs, data, cache_size )) < 0 )
+        goto fail;
+    /* Check if the cache is valid for the media file. */
+    err = LSMASH_ERR_INVALID_DATA;
+    if( lsmash_bs_get_be32( bs ) != ISOM_TIMELINE_CACHE_MAGIC
+     || lsmash_bs_get_be32( bs ) != ISOM_TIMELINE_CACHE_VERSION
+     || lsmash_bs_get_be64( bs ) != media_size
+     || (int64_t)lsmash_bs_get_be64( bs ) != media_mtime )
+        goto fail;
+    uint32_t timeline_count = lsmash_bs_get_be32( bs );
+    for( uint32_t i = 0; i < timeline_count; i++ )
+    {
+        isom_timeline_t *timeline = isom_get_cached_timeline( bs, file->initializer, &err );
+        if( !timeline )
+            goto fail;
+        if( lsmash_list_add_entry( &timelines, timeline ) < 0 )
+        {
+            isom_timeline_destroy( timeline );
+            err = LSMASH_ERR_MEMORY_ALLOC;
+            goto fail;
+        }
+    }
+    /* Replace the existing timelines with the cached ones. */
+    if( !file->timeline )
+    {
+        file->timeline = lsmash_list_create( isom_timeline_destroy );
+        if( !file->timeline )
+        {
+            err = LSMASH_ERR_MEMORY_ALLOC;
+            goto fail;
+        }
+    }
+    for( lsmash_entry_t *entry = timelines.head; entry; entry = entry->next )
+    {
+        isom_timeline_t *timeline = (isom_timeline_t *)entry->data;
+        lsmash_destruct_timeline( root, timeline->track_ID );
+        if( lsmash_list_add_entry( file->timeline, timeline ) < 0 )
+        {
+            err = LSMASH_ERR_MEMORY_ALLOC;
+            goto fail;
+        }
+        entry->data = NULL;
+    }
+    err = 0;
+fail:
+    lsmash_list_remove_entries( &timelines );
+    lsmash_bs_cleanup( bs );
+    lsmash_free( data );
+    return err;
+}
@@ -110,6 +110,12 @@ void isom_remove_timelines
     lsmash_file_t *file
 );
 
+int isom_timeline_is_in_file
+(
+    isom_timeline_t *timeline,
+    lsmash_file_t   *file
+);
+
 int isom_timeline_construct
 (
     lsmash_root_t *root,
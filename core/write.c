@@ -33,6 +33,19 @@
 #include "codecs/mp4sys.h"
 #include "codecs/description.h"
 
+/* The bytestream given by isom_update_box_size() has neither stream nor buffer and just counts the bytes to be written.
+ * For a table of fixed-size entries, count the bytes of the whole entries at once there, and then return 1.
+ * Return 0 if the entries shall be written actually. */
+static int isom_bs_count_table_entries( lsmash_bs_t *bs, uint32_t entry_count, uint32_t entry_size )
+{
+    if( bs->stream
+     || bs->buffer.internal
+     || bs->buffer.data )
+        return 0;
+    bs->buffer.store += (size_t)entry_count * entry_size;
+    return 1;
+}
+
 static int isom_write_children( lsmash_bs_t *bs, isom_box_t *box )
 {
     for( lsmash_entry_t *entry = box->extensions.head; entry; entry = entry->next )
@@ -768,6 +781,8 @@ static int isom_write_stts( lsmash_bs_t *bs, isom_box_t *box )
     assert( stts->list );
     isom_bs_put_box_common( bs, stts );
     lsmash_bs_put_be32( bs, stts->list->entry_count );
+    if( isom_bs_count_table_entries( bs, stts->list->entry_count, 8 ) )
+        return 0;
     for( lsmash_entry_t *entry = stts->list->head; entry; entry = entry->next )
     {
         isom_stts_entry_t *data = (isom_stts_entry_t *)entry->data;
@@ -785,6 +800,8 @@ static int isom_write_ctts( lsmash_bs_t *bs, isom_box_t *box )
     assert( ctts->list );
     isom_bs_put_box_common( bs, ctts );
     lsmash_bs_put_be32( bs, ctts->list->entry_count );
+    if( isom_bs_count_table_entries( bs, ctts->list->entry_count, 8 ) )
+        return 0;
     for( lsmash_entry_t *entry = ctts->list->head; entry; entry = entry->next )
     {
         isom_ctts_entry_t *data = (isom_ctts_entry_t *)entry->data;
@@ -814,7 +831,8 @@ static int isom_write_stsz( lsmash_bs_t *bs, isom_box_t *box )
     isom_bs_put_box_common( bs, stsz );
     lsmash_bs_put_be32( bs, stsz->sample_size );
     lsmash_bs_put_be32( bs, stsz->sample_count );
-    if( stsz->sample_size == 0 && stsz->list )
+    if( stsz->sample_size == 0 && stsz->list
+     && !isom_bs_count_table_entries( bs, stsz->list->entry_count, 4 ) )
         for( lsmash_entry_t *entry = stsz->list->head; entry; entry = entry->next )
         {
             isom_stsz_entry_t *data = (isom_stsz_entry_t *)entry->data;
@@ -873,6 +891,8 @@ static int isom_write_stss( lsmash_bs_t *bs, isom_box_t *box )
     assert( stss->list );
     isom_bs_put_box_common( bs, stss );
     lsmash_bs_put_be32( bs, stss->list->entry_count );
+    if( isom_bs_count_table_entries( bs, stss->list->entry_count, 4 ) )
+        return 0;
     for( lsmash_entry_t *entry = stss->list->head; entry; entry = entry->next )
     {
         isom_stss_entry_t *data = (isom_stss_entry_t *)entry->data;
@@ -889,6 +909,8 @@ static int isom_write_stps( lsmash_bs_t *bs, isom_box_t *box )
     assert( stps->list );
     isom_bs_put_box_common( bs, stps );
     lsmash_bs_put_be32( bs, stps->list->entry_count );
+    if( isom_bs_count_table_entries( bs, stps->list->entry_count, 4 ) )
+        return 0;
     for( lsmash_entry_t *entry = stps->list->head; entry; entry = entry->next )
     {
         isom_stps_entry_t *data = (isom_stps_entry_t *)entry->data;
@@ -904,6 +926,8 @@ static int isom_write_sdtp( lsmash_bs_t *bs, isom_box_t *box )
     isom_sdtp_t *sdtp = (isom_sdtp_t *)box;
     assert( sdtp->list );
     isom_bs_put_box_common( bs, sdtp );
+    if( isom_bs_count_table_entries( bs, sdtp->list->entry_count, 1 ) )
+        return 0;
     for( lsmash_entry_t *entry = sdtp->list->head; entry; entry = entry->next )
     {
         isom_sdtp_entry_t *data = (isom_sdtp_entry_t *)entry->data;
@@ -924,6 +948,8 @@ static int isom_write_stsc( lsmash_bs_t *bs, isom_box_t *box )
     assert( stsc->list );
     isom_bs_put_box_common( bs, stsc );
     lsmash_bs_put_be32( bs, stsc->list->entry_count );
+    if( isom_bs_count_table_entries( bs, stsc->list->entry_count, 12 ) )
+        return 0;
     for( lsmash_entry_t *entry = stsc->list->head; entry; entry = entry->next )
     {
         isom_stsc_entry_t *data = (isom_stsc_entry_t *)entry->data;
@@ -942,6 +968,8 @@ static int isom_write_co64( lsmash_bs_t *bs, isom_box_t *box )
     assert( co64->list );
     isom_bs_put_box_common( bs, co64 );
     lsmash_bs_put_be32( bs, co64->list->entry_count );
+    if( isom_bs_count_table_entries( bs, co64->list->entry_count, 8 ) )
+        return 0;
     for( lsmash_entry_t *entry = co64->list->head; entry; entry = entry->next )
     {
         isom_co64_entry_t *data = (isom_co64_entry_t *)entry->data;
@@ -960,6 +988,8 @@ static int isom_write_stco( lsmash_bs_t *bs, isom_box_t *box )
     assert( stco->list );
     isom_bs_put_box_common( bs, stco );
     lsmash_bs_put_be32( bs, stco->list->entry_count );
+    if( isom_bs_count_table_entries( bs, stco->list->entry_count, 4 ) )
+        return 0;
     for( lsmash_entry_t *entry = stco->list->head; entry; entry = entry->next )
     {
         isom_stco_entry_t *data = (isom_stco_entry_t *)entry->data;
@@ -1016,6 +1046,8 @@ static int isom_write_sbgp( lsmash_bs_t *bs, isom_box_t *box )
     if( sbgp->version == 1 )
         lsmash_bs_put_be32( bs, sbgp->grouping_type_parameter );
     lsmash_bs_put_be32( bs, sbgp->list->entry_count );
+    if( isom_bs_count_table_entries( bs, sbgp->list->entry_count, 8 ) )
+        return 0;
     for( lsmash_entry_t *entry = sbgp->list->head; entry; entry = entry->next )
     {
         isom_group_assignment_entry_t *data = (isom_group_assignment_entry_t *)entry->data;
@@ -1314,7 +1346,13 @@ static int isom_write_trun( lsmash_bs_t *bs, isom_box_t *box )
     lsmash_bs_put_be32( bs, trun->sample_count );
     if( trun->flags & ISOM_TR_FLAGS_DATA_OFFSET_PRESENT        ) lsmash_bs_put_be32( bs, trun->data_offset );
     if( trun->flags & ISOM_TR_FLAGS_FIRST_SAMPLE_FLAGS_PRESENT ) isom_bs_put_sample_flags( bs, &trun->first_sample_flags );
-    if( trun->optional )
+    if( !trun->optional )
+        return 0;
+    uint32_t row_size = ((trun->flags & ISOM_TR_FLAGS_SAMPLE_DURATION_PRESENT               ) ? 4 : 0)
+                      + ((trun->flags & ISOM_TR_FLAGS_SAMPLE_SIZE_PRESENT                   ) ? 4 : 0)
+                      + ((trun->flags & ISOM_TR_FLAGS_SAMPLE_FLAGS_PRESENT                  ) ? 4 : 0)
+                      + ((trun->flags & ISOM_TR_FLAGS_SAMPLE_COMPOSITION_TIME_OFFSET_PRESENT) ? 4 : 0);
+    if( !isom_bs_count_table_entries( bs, trun->optional->entry_count, row_size ) )
         for( lsmash_entry_t *entry = trun->optional->head; entry; entry = entry->next )
         {
             isom_trun_optional_row_t *data = (isom_trun_optional_row_t *)entry->data;
@@ -1351,7 +1389,12 @@ static int isom_write_tfra( lsmash_bs_t *bs, isom_box_t *box )
     lsmash_bs_put_be32( bs, tfra->track_ID );
     lsmash_bs_put_be32( bs, temp );
     lsmash_bs_put_be32( bs, tfra->number_of_entry );
-    if( tfra->list )
+    if( tfra->list
+     && !isom_bs_count_table_entries( bs, tfra->list->entry_count,
+                                      (tfra->version == 1 ? 16 : 8)
+                                      + tfra->length_size_of_traf_num   + 1
+                                      + tfra->length_size_of_trun_num   + 1
+                                      + tfra->length_size_of_sample_num + 1 ) )
     {
         void (*bs_put_funcs[5])( lsmash_bs_t *, uint64_t ) =
             {
@@ -1416,7 +1459,9 @@ static int isom_write_mdat( lsmash_bs_t *bs, isom_box_t *box )
             isom_sample_pool_t *pool = (isom_sample_pool_t *)entry->data;
             if( !pool )
                 return LSMASH_ERR_NAMELESS;
-            lsmash_bs_put_bytes( bs, pool->size, pool->data );
+            int err = isom_write_sample_pool( bs, pool );
+            if( err < 0 )
+                return err;
         }
         mdat->media_size = file->fragment->pool_size;
         return 0;
@@ -1529,6 +1574,8 @@ static int isom_write_sidx( lsmash_bs_t *bs, isom_box_t *box )
     }
     lsmash_bs_put_be16( bs, sidx->reserved );
     lsmash_bs_put_be16( bs, sidx->reference_count );
+    if( isom_bs_count_table_entries( bs, sidx->list->entry_count, 12 ) )
+        return 0;
     for( lsmash_entry_t *entry = sidx->list->head; entry; entry = entry->next )
     {
         isom_sidx_referenced_item_t *data = (isom_sidx_referenced_item_t *)entry->data;
@@ -37,11 +37,99 @@
 #include "codecs/h264.h"
 #include "codecs/nalu.h"
 
+/* The location of a NALU kept in an access unit, excluding its start code. */
+typedef struct
+{
+    uint64_t pos;
+    uint32_t length;
+} nalu_index_entry_t;
+
+/* The list of NALUs recorded by the analysis pass in decoding order.
+ * The delivery pass reads them sequentially from 'next' onwards. */
+typedef struct
+{
+    nalu_index_entry_t *entry;
+    uint32_t            count;
+    uint32_t            alloc;
+    uint32_t            next;
+} nalu_index_t;
+
+static int nalu_index_append
+(
+    nalu_index_t *index,
+    uint64_t      pos,
+    uint32_t      length
+)
+{
+    if( index->count >= index->alloc )
+    {
+        uint32_t alloc = index->alloc ? 2 * index->alloc : (1 << 12);
+        nalu_index_entry_t *temp = (nalu_index_entry_t *)lsmash_realloc( index->entry, alloc * sizeof(nalu_index_entry_t) );
+        if( !temp )
+            return LSMASH_ERR_MEMORY_ALLOC;
+        index->entry = temp;
+        index->alloc = alloc;
+    }
+    index->entry[ index->count ].pos    = pos;
+    index->entry[ index->count ].length = length;
+    ++ index->count;
+    return 0;
+}
+
+/* Read the NALUs of the next access unit from the stream, replacing each start code with a NALU length field. */
+static int nalu_index_read_access_unit
+(
+    nalu_index_t *index,
+    lsmash_bs_t  *bs,
+    uint8_t      *au_data,
+    uint32_t      au_length
+)
+{
+    uint32_t offset = 0;
+    while( offset < au_length )
+    {
+        if( index->next >= index->count )
+            return LSMASH_ERR_NAMELESS;
+        nalu_index_entry_t *entry = &index->entry[ index->next ++ ];
+        if( offset + NALU_DEFAULT_NALU_LENGTH_SIZE + entry->length > au_length )
+            return LSMASH_ERR_NAMELESS;
+        for( int i = NALU_DEFAULT_NALU_LENGTH_SIZE; i; i-- )
+            au_data[ offset++ ] = (entry->length >> ((i - 1) * 8)) & 0xff;
+        if( lsmash_bs_read_seek( bs, entry->pos, SEEK_SET ) != entry->pos
+         || lsmash_bs_get_bytes_ex( bs, entry->length, au_data + offset ) != entry->length )
+            return LSMASH_ERR_IO;
+        offset += entry->length;
+    }
+    return 0;
+}
+
+static void nalu_index_cleanup
+(
+    nalu_index_t *index
+)
+{
+    lsmash_freep( &index->entry );
+    index->count = 0;
+    index->alloc = 0;
+    index->next  = 0;
+}
+
+typedef struct
+{
+    h264_picture_info_t picture;
+    uint32_t            length;
+    uint32_t            MaxFrameNum;
+    uint8_t             change;     /* The active avcC is switched at this access unit. */
+} h264_au_index_t;
+
 typedef struct
 {
     h264_info_t            info;
     lsmash_entry_list_t    avcC_list[1];    /* stored as lsmash_codec_specific_t */
+    lsmash_entry_list_t    sps_list[1];     /* stored as h264_sps_t active at each change of avcC */
     lsmash_media_ts_list_t ts_list;
+    nalu_index_t           nalu_index;
+    h264_au_index_t       *au_index;
     uint32_t max_au_length;
     uint32_t num_undecodable;
     uint32_t avcC_number;
@@ -66,7 +154,10 @@ static void remove_h264_importer( h264_importer_t *h264_imp )
     if( !h264_imp )
         return;
     lsmash_list_remove_entries( h264_imp->avcC_list );
+    lsmash_list_remove_entries( h264_imp->sps_list );
     h264_cleanup_parser( &h264_imp->info );
+    nalu_index_cleanup( &h264_imp->nalu_index );
+    lsmash_free( h264_imp->au_index );
     lsmash_free( h264_imp->ts_list.timestamp );
     lsmash_free( h264_imp );
 }
@@ -88,34 +179,32 @@ static h264_importer_t *create_h264_importer( importer_t *importer )
         return NULL;
     }
     lsmash_list_init( h264_imp->avcC_list, lsmash_destroy_codec_specific_data );
+    lsmash_list_init_simple( h264_imp->sps_list );
     return h264_imp;
 }
 
-static inline int h264_complete_au( h264_access_unit_t *au, int probe )
+static inline int h264_complete_au( h264_access_unit_t *au )
 {
     if( !au->picture.has_primary || au->incomplete_length == 0 )
         return 0;
-    if( !probe )
-        memcpy( au->data, au->incomplete_data, au->incomplete_length );
     au->length              = au->incomplete_length;
     au->incomplete_length   = 0;
     au->picture.has_primary = 0;
     return 1;
 }
 
-static void h264_append_nalu_to_au( h264_access_unit_t *au, uint8_t *src_nalu, uint32_t nalu_length, int probe )
+static int h264_append_nalu_to_au( h264_importer_t *h264_imp, uint64_t nalu_pos, uint32_t nalu_length )
 {
-    if( !probe )
-    {
-        uint8_t *dst_nalu = au->incomplete_data + au->incomplete_length + NALU_DEFAULT_NALU_LENGTH_SIZE;
-        for( int i = NALU_DEFAULT_NALU_LENGTH_SIZE; i; i-- )
-            *(dst_nalu - i) = (nalu_length >> ((i - 1) * 8)) & 0xff;
-        memcpy( dst_nalu, src_nalu, nalu_length );
-    }
+    h264_access_unit_t *au = &h264_imp->info.au;
+    /* Just remember where the NALU is. The delivery pass reads it from the stream via the index. */
+    int err = nalu_index_append( &h264_imp->nalu_index, nalu_pos, nalu_length );
+    if( err < 0 )
+        return err;
     /* Note: au->incomplete_length shall be 0 immediately after AU has completed.
      * Therefore, possible_au_length in h264_get_access_unit_internal() can't be used here
      * to avoid increasing AU length monotonously through the entire stream. */
     au->incomplete_length += NALU_DEFAULT_NALU_LENGTH_SIZE + nalu_length;
+    return 0;
 }
 
 static int h264_get_au_internal_succeeded( h264_importer_t *h264_imp, h264_access_unit_t *au )
@@ -217,12 +306,11 @@ static inline void h264_new_access_unit
     au->picture.broken_link_flag   = 0;
 }
 
-/* If probe equals 0, don't get the actual data (EBPS) of an access unit and only parse NALU.
+/* Parse NALUs until an access unit completes, only indexing where its NALUs are in the stream.
  * Currently, you can get AU of AVC video elemental stream only, not AVC parameter set elemental stream defined in 14496-15. */
 static int h264_get_access_unit_internal
 (
-    importer_t *importer,
-    int         probe
+    importer_t *importer
 )
 {
     h264_importer_t      *h264_imp = (h264_importer_t *)importer->info;
@@ -245,27 +333,24 @@ static int h264_get_access_unit_internal
             /* For the last NALU.
              * This NALU already has been appended into the latest access unit and parsed. */
             h264_update_picture_info( info, picture, slice, &info->sei );
-            complete_au = h264_complete_au( au, probe );
+            complete_au = h264_complete_au( au );
             if( complete_au )
                 return h264_get_au_internal_succeeded( h264_imp, au );
             else
                 return h264_get_au_internal_failed( h264_imp, au, complete_au, LSMASH_ERR_INVALID_DATA );
         }
         uint8_t  nalu_type        = nuh.nal_unit_type;
-        uint64_t next_sc_head_pos = h264_imp->sc_head_pos
-                                  + start_code_length
+        uint64_t nalu_pos         = h264_imp->sc_head_pos + start_code_length;
+        uint64_t next_sc_head_pos = nalu_pos
                                   + nalu_length
                                   + trailing_zero_bytes;
 #if 0
-        if( probe )
-        {
-            fprintf( stderr, "NALU type: %"PRIu8"                    \n", nalu_type );
-            fprintf( stderr, "    NALU header position: %"PRIx64"    \n", h264_imp->sc_head_pos + start_code_length );
-            fprintf( stderr, "    EBSP position: %"PRIx64"           \n", h264_imp->sc_head_pos + start_code_length + nuh.length );
-            fprintf( stderr, "    EBSP length: %"PRIx64" (%"PRIu64") \n", nalu_length - nuh.length, nalu_length - nuh.length );
-            fprintf( stderr, "    trailing_zero_bytes: %"PRIx64"     \n", trailing_zero_bytes );
-            fprintf( stderr, "    Next start code position: %"PRIx64"\n", next_sc_head_pos );
-        }
+        fprintf( stderr, "NALU type: %"PRIu8"                    \n", nalu_type );
+        fprintf( stderr, "    NALU header position: %"PRIx64"    \n", h264_imp->sc_head_pos + start_code_length );
+        fprintf( stderr, "    EBSP position: %"PRIx64"           \n", h264_imp->sc_head_pos + start_code_length + nuh.length );
+        fprintf( stderr, "    EBSP length: %"PRIx64" (%"PRIu64") \n", nalu_length - nuh.length, nalu_length - nuh.length );
+        fprintf( stderr, "    trailing_zero_bytes: %"PRIx64"     \n", trailing_zero_bytes );
+        fprintf( stderr, "    Next start code position: %"PRIx64"\n", next_sc_head_pos );
 #endif
         if( nalu_type == H264_NALU_TYPE_FD )
         {
@@ -296,7 +381,7 @@ static int h264_get_access_unit_internal
                 h264_slice_info_t prev_slice = *slice;
                 if( (err = h264_parse_slice( info, &nuh, sb->rbsp, nalu + nuh.length, nalu_length - nuh.length )) < 0 )
                     return h264_get_au_internal_failed( h264_imp, au, complete_au, err );
-                if( probe && info->avcC_pending )
+                if( info->avcC_pending )
                 {
                     /* Copy and append a Codec Specific info. */
                     if( (err = h264_store_codec_specific( h264_imp, &info->avcC_param )) < 0 )
@@ -312,12 +397,13 @@ static int h264_get_access_unit_internal
                         /* The current NALU is the first VCL NALU of the primary coded picture of an new AU.
                          * Therefore, the previous slice belongs to the AU you want at this time. */
                         h264_update_picture_info( info, picture, &prev_slice, &info->sei );
-                        complete_au = h264_complete_au( au, probe );
+                        complete_au = h264_complete_au( au );
                     }
                     else
                         h264_update_picture_info_for_slice( info, picture, &prev_slice );
                 }
-                h264_append_nalu_to_au( au, nalu, nalu_length, probe );
+                if( (err = h264_append_nalu_to_au( h264_imp, nalu_pos, nalu_length )) < 0 )
+                    return h264_get_au_internal_failed( h264_imp, au, complete_au, err );
                 slice->present = 1;
             }
             else
@@ -326,7 +412,7 @@ static int h264_get_access_unit_internal
                 {
                     /* The last slice belongs to the AU you want at this time. */
                     h264_update_picture_info( info, picture, slice, &info->sei );
-                    complete_au = h264_complete_au( au, probe );
+                    complete_au = h264_complete_au( au );
                 }
                 switch( nalu_type )
                 {
@@ -336,7 +422,8 @@ static int h264_get_access_unit_internal
                                                    nalu        + nuh.length,
                                                    nalu_length - nuh.length )) < 0 )
                             return h264_get_au_internal_failed( h264_imp, au, complete_au, err );
-                        h264_append_nalu_to_au( au, nalu, nalu_length, probe );
+                        if( (err = h264_append_nalu_to_au( h264_imp, nalu_pos, nalu_length )) < 0 )
+                            return h264_get_au_internal_failed( h264_imp, au, complete_au, err );
                         break;
                     }
                     case H264_NALU_TYPE_SPS :
@@ -354,7 +441,8 @@ static int h264_get_access_unit_internal
                             return h264_get_au_internal_failed( h264_imp, au, complete_au, err );
                         break;
                     default :
-                        h264_append_nalu_to_au( au, nalu, nalu_length, probe );
+                        if( (err = h264_append_nalu_to_au( h264_imp, nalu_pos, nalu_length )) < 0 )
+                            return h264_get_au_internal_failed( h264_imp, au, complete_au, err );
                         break;
                 }
                 if( info->avcC_pending )
@@ -375,7 +463,7 @@ static int h264_get_access_unit_internal
         else if( au->incomplete_length && au->length == 0 )
         {
             h264_update_picture_info( info, picture, slice, &info->sei );
-            h264_complete_au( au, probe );
+            h264_complete_au( au );
             return h264_get_au_internal_succeeded( h264_imp, au );
         }
         if( complete_au )
@@ -410,23 +498,18 @@ static int h264_importer_get_accessunit
         return LSMASH_ERR_NAMELESS;
     if( current_status == IMPORTER_EOF )
         return IMPORTER_EOF;
-    int err = h264_get_access_unit_internal( importer, 0 );
-    if( err < 0 )
-    {
-        importer->status = IMPORTER_ERROR;
-        return err;
-    }
-    h264_importer_check_eof( importer, &info->au );
-    if( importer->status == IMPORTER_CHANGE && !info->avcC_pending )
-        current_status = IMPORTER_CHANGE;
-    if( current_status == IMPORTER_CHANGE )
+    /* The whole stream has been analyzed by the probe, so just follow the access unit index here. */
+    h264_access_unit_t *au       = &info->au;
+    h264_au_index_t    *au_index = &h264_imp->au_index[ au->number ];
+    if( au_index->change )
     {
         /* Update the active summary. */
-        lsmash_codec_specific_t *cs = (lsmash_codec_specific_t *)lsmash_list_get_entry_data( h264_imp->avcC_list, ++ h264_imp->avcC_number );
-        if( !cs )
+        lsmash_codec_specific_t *cs  = (lsmash_codec_specific_t *)lsmash_list_get_entry_data( h264_imp->avcC_list, ++ h264_imp->avcC_number );
+        h264_sps_t              *sps = (h264_sps_t *)lsmash_list_get_entry_data( h264_imp->sps_list, h264_imp->avcC_number - 1 );
+        if( !cs || !sps )
             return LSMASH_ERR_NAMELESS;
         lsmash_h264_specific_parameters_t *avcC_param = (lsmash_h264_specific_parameters_t *)cs->data.structured;
-        lsmash_video_summary_t *summary = h264_create_summary( avcC_param, &info->sps, h264_imp->max_au_length );
+        lsmash_video_summary_t *summary = h264_create_summary( avcC_param, sps, h264_imp->max_au_length );
         if( !summary )
             return LSMASH_ERR_NAMELESS;
         lsmash_list_remove_entry( importer->summaries, track_number );
@@ -435,13 +518,23 @@ static int h264_importer_get_accessunit
             lsmash_cleanup_summary( (lsmash_summary_t *)summary );
             return LSMASH_ERR_MEMORY_ALLOC;
         }
-        importer->status = IMPORTER_OK;
+        current_status = IMPORTER_CHANGE;
     }
     lsmash_sample_t *sample = lsmash_create_sample( h264_imp->max_au_length );
     if( !sample )
         return LSMASH_ERR_MEMORY_ALLOC;
+    int err = nalu_index_read_access_unit( &h264_imp->nalu_index, importer->bs, sample->data, au_index->length );
+    if( err < 0 )
+    {
+        lsmash_delete_sample( sample );
+        importer->status = IMPORTER_ERROR;
+        return err;
+    }
     *p_sample = sample;
-    h264_access_unit_t  *au      = &info->au;
+    au->picture = au_index->picture;
+    au->length  = au_index->length;
+    au->number += 1;
+    importer->status = au->number < h264_imp->ts_list.sample_count ? IMPORTER_OK : IMPORTER_EOF;
     h264_picture_info_t *picture = &au->picture;
     sample->dts = h264_imp->ts_list.timestamp[ au->number - 1 ].dts;
     sample->cts = h264_imp->ts_list.timestamp[ au->number - 1 ].cts;
@@ -466,7 +559,7 @@ static int h264_importer_get_accessunit
         else if( picture->recovery_frame_cnt )
         {
             sample->prop.ra_flags = ISOM_SAMPLE_RANDOM_ACCESS_FLAG_POST_ROLL_START;
-            sample->prop.post_roll.complete = (picture->frame_num + picture->recovery_frame_cnt) % info->sps.MaxFrameNum;
+            sample->prop.post_roll.complete = (picture->frame_num + picture->recovery_frame_cnt) % au_index->MaxFrameNum;
         }
         else
         {
@@ -480,7 +573,6 @@ static int h264_importer_get_accessunit
     if( picture->idr )
         h264_imp->last_sync_cts  = sample->cts;
     sample->length = au->length;
-    memcpy( sample->data, au->data, au->length );
     return current_status;
 }
 
@@ -746,6 +838,9 @@ static int h264_analyze_whole_stream
     h264_info_t     *info     = &h264_imp->info;
     importer->status = IMPORTER_OK;
     int err = LSMASH_ERR_MEMORY_ALLOC;
+    h264_imp->au_index = (h264_au_index_t *)lsmash_malloc( (1 << 12) * sizeof(h264_au_index_t) );
+    if( !h264_imp->au_index )
+        goto fail;
     while( importer->status != IMPORTER_EOF )
     {
 #if 0
@@ -753,10 +848,13 @@ static int h264_analyze_whole_stream
 #endif
         h264_picture_info_t     *picture = &info->au.picture;
         h264_picture_info_t prev_picture = *picture;
-        if( (err = h264_get_access_unit_internal( importer, 1 ))       < 0
+        importer_status current_status = importer->status;
+        if( (err = h264_get_access_unit_internal( importer ))          < 0
          || (err = h264_calculate_poc( info, picture, &prev_picture )) < 0 )
             goto fail;
         h264_importer_check_eof( importer, &info->au );
+        if( importer->status == IMPORTER_CHANGE && !info->avcC_pending )
+            current_status = IMPORTER_CHANGE;
         if( npt_alloc <= num_access_units * sizeof(nal_pic_timing_t) )
         {
             uint32_t alloc = 2 * num_access_units * sizeof(nal_pic_timing_t);
@@ -765,6 +863,31 @@ static int h264_analyze_whole_stream
                 goto fail;
             npt       = temp;
             npt_alloc = alloc;
+            h264_au_index_t *au_index = (h264_au_index_t *)lsmash_realloc( h264_imp->au_index,
+                                                                            (alloc / sizeof(nal_pic_timing_t)) * sizeof(h264_au_index_t) );
+            if( !au_index )
+                goto fail;
+            h264_imp->au_index = au_index;
+        }
+        /* Record what the delivery pass needs so that it doesn't have to parse the stream again. */
+        h264_au_index_t *au_index = &h264_imp->au_index[num_access_units];
+        au_index->picture     = *picture;
+        au_index->length      = info->au.length;
+        au_index->MaxFrameNum = info->sps.MaxFrameNum;
+        au_index->change      = (current_status == IMPORTER_CHANGE);
+        if( au_index->change )
+        {
+            /* Keep the SPS active at the switch for the summary of the next avcC. */
+            h264_sps_t *sps = lsmash_memdup( &info->sps, sizeof(h264_sps_t) );
+            if( !sps )
+                goto fail;
+            if( lsmash_list_add_entry( h264_imp->sps_list, sps ) < 0 )
+            {
+                lsmash_free( sps );
+                goto fail;
+            }
+            if( importer->status == IMPORTER_CHANGE )
+                importer->status = IMPORTER_OK;
         }
         h264_imp->field_pic_present |= picture->field_pic_flag;
         npt[num_access_units].poc       = picture->PicOrderCnt;
@@ -860,23 +983,10 @@ static int h264_importer_probe( importer_t *importer )
     h264_imp->sc_head_pos = first_sc_head_pos;
     if( (err = h264_analyze_whole_stream( importer )) < 0 )
         goto fail;
-    /* Go back to the start code of the first NALU. */
+    /* Rewind to the first access unit.
+     * The stream is not parsed any more since access units are read through the index. */
     importer->status = IMPORTER_OK;
-    lsmash_bs_read_seek( bs, first_sc_head_pos, SEEK_SET );
-    h264_imp->sc_head_pos       = first_sc_head_pos;
-    info->prev_nalu_type        = H264_NALU_TYPE_UNSPECIFIED0;
-    uint8_t *temp_au            = info->au.data;
-    uint8_t *temp_incomplete_au = info->au.incomplete_data;
-    memset( &info->au, 0, sizeof(h264_access_unit_t) );
-    info->au.data               = temp_au;
-    info->au.incomplete_data    = temp_incomplete_au;
-    memset( &info->slice, 0, sizeof(h264_slice_info_t) );
-    memset( &info->sps, 0, sizeof(h264_sps_t) );
-    memset( &info->pps, 0, sizeof(h264_pps_t) );
-    lsmash_list_remove_entries( info->avcC_param.parameter_sets->sps_list );
-    lsmash_list_remove_entries( info->avcC_param.parameter_sets->pps_list );
-    lsmash_list_remove_entries( info->avcC_param.parameter_sets->spsext_list );
-    lsmash_destroy_h264_parameter_sets( &info->avcC_param_next );
+    info->au.number  = 0;
     return 0;
 fail:
     remove_h264_importer( h264_imp );
@@ -914,11 +1024,22 @@ const importer_functions h264_importer =
 ***************************************************************************/
 #include "codecs/hevc.h"
 
+typedef struct
+{
+    hevc_picture_info_t picture;
+    uint32_t            length;
+    uint8_t             TemporalId;
+    uint8_t             change;     /* The active hvcC is switched at this access unit. */
+} hevc_au_index_t;
+
 typedef struct
 {
     hevc_info_t            info;
     lsmash_entry_list_t    hvcC_list[1];    /* stored as lsmash_codec_specific_t */
+    lsmash_entry_list_t    sps_list[1];     /* stored as hevc_sps_t active at each change of hvcC */
     lsmash_media_ts_list_t ts_list;
+    nalu_index_t           nalu_index;
+    hevc_au_index_t       *au_index;
     uint32_t max_au_length;
     uint32_t num_undecodable;
     uint32_t hvcC_number;
@@ -935,7 +1056,10 @@ static void remove_hevc_importer( hevc_importer_t *hevc_imp )
     if( !hevc_imp )
         return;
     lsmash_list_remove_entries( hevc_imp->hvcC_list );
+    lsmash_list_remove_entries( hevc_imp->sps_list );
     hevc_cleanup_parser( &hevc_imp->info );
+    nalu_index_cleanup( &hevc_imp->nalu_index );
+    lsmash_free( hevc_imp->au_index );
     lsmash_free( hevc_imp->ts_list.timestamp );
     lsmash_free( hevc_imp );
 }
@@ -957,16 +1081,15 @@ static hevc_importer_t *create_hevc_importer( importer_t *importer )
         return NULL;
     }
     lsmash_list_init( hevc_imp->hvcC_list, lsmash_destroy_codec_specific_data );
+    lsmash_list_init_simple( hevc_imp->sps_list );
     hevc_imp->info.eos = 1;
     return hevc_imp;
 }
 
-static inline int hevc_complete_au( hevc_access_unit_t *au, int probe )
+static inline int hevc_complete_au( hevc_access_unit_t *au )
 {
     if( !au->picture.has_primary || au->incomplete_length == 0 )
         return 0;
-    if( !probe )
-        memcpy( au->data, au->incomplete_data, au->incomplete_length );
     au->TemporalId          = au->picture.TemporalId;
     au->length              = au->incomplete_length;
     au->incomplete_length   = 0;
@@ -974,19 +1097,18 @@ static inline int hevc_complete_au( hevc_access_unit_t *au, int probe )
     return 1;
 }
 
-static void hevc_append_nalu_to_au( hevc_access_unit_t *au, uint8_t *src_nalu, uint32_t nalu_length, int probe )
+static int hevc_append_nalu_to_au( hevc_importer_t *hevc_imp, uint64_t nalu_pos, uint32_t nalu_length )
 {
-    if( !probe )
-    {
-        uint8_t *dst_nalu = au->incomplete_data + au->incomplete_length + NALU_DEFAULT_NALU_LENGTH_SIZE;
-        for( int i = NALU_DEFAULT_NALU_LENGTH_SIZE; i; i-- )
-            *(dst_nalu - i) = (nalu_length >> ((i - 1) * 8)) & 0xff;
-        memcpy( dst_nalu, src_nalu, nalu_length );
-    }
+    hevc_access_unit_t *au = &hevc_imp->info.au;
+    /* Just remember where the NALU is. The delivery pass reads it from the stream via the index. */
+    int err = nalu_index_append( &hevc_imp->nalu_index, nalu_pos, nalu_length );
+    if( err < 0 )
+        return err;
     /* Note: picture->incomplete_au_length shall be 0 immediately after AU has completed.
      * Therefore, possible_au_length in hevc_get_access_unit_internal() can't be used here
      * to avoid increasing AU length monotonously through the entire stream. */
     au->incomplete_length += NALU_DEFAULT_NALU_LENGTH_SIZE + nalu_length;
+    return 0;
 }
 
 static int hevc_get_au_internal_succeeded( hevc_importer_t *hevc_imp, hevc_access_unit_t *au )
@@ -1083,11 +1205,10 @@ static inline void hevc_new_access_unit( hevc_access_unit_t *au )
     au->picture.recovery_poc_cnt  = 0;
 }
 
-/* If probe equals 0, don't get the actual data (EBPS) of an access unit and only parse NALU. */
+/* Parse NALUs until an access unit completes, only indexing where its NALUs are in the stream. */
 static int hevc_get_access_unit_internal
 (
-    importer_t *importer,
-    int         probe
+    importer_t *importer
 )
 {
     hevc_importer_t      *hevc_imp = (hevc_importer_t *)importer->info;
@@ -1110,27 +1231,24 @@ static int hevc_get_access_unit_internal
             /* For the last NALU.
              * This NALU already has been appended into the latest access unit and parsed. */
             hevc_update_picture_info( info, picture, slice, &info->sps, &info->sei );
-            complete_au = hevc_complete_au( au, probe );
+            complete_au = hevc_complete_au( au );
             if( complete_au )
                 return hevc_get_au_internal_succeeded( hevc_imp, au );
             else
                 return hevc_get_au_internal_failed( hevc_imp, au, complete_au, LSMASH_ERR_INVALID_DATA );
         }
         uint8_t  nalu_type        = nuh.nal_unit_type;
-        uint64_t next_sc_head_pos = hevc_imp->sc_head_pos
-                                  + start_code_length
+        uint64_t nalu_pos         = hevc_imp->sc_head_pos + start_code_length;
+        uint64_t next_sc_head_pos = nalu_pos
                                   + nalu_length
                                   + trailing_zero_bytes;
 #if 0
-        if( probe )
-        {
-            fprintf( stderr, "NALU type: %"PRIu8"                    \n", nalu_type );
-            fprintf( stderr, "    NALU header position: %"PRIx64"    \n", hevc_imp->sc_head_pos + start_code_length );
-            fprintf( stderr, "    EBSP position: %"PRIx64"           \n", hevc_imp->sc_head_pos + start_code_length + nuh.length );
-            fprintf( stderr, "    EBSP length: %"PRIx64" (%"PRIu64") \n", nalu_length - nuh.length, nalu_length - nuh.length );
-            fprintf( stderr, "    trailing_zero_bytes: %"PRIx64"     \n", trailing_zero_bytes );
-            fprintf( stderr, "    Next start code position: %"PRIx64"\n", next_sc_head_pos );
-        }
+        fprintf( stderr, "NALU type: %"PRIu8"                    \n", nalu_type );
+        fprintf( stderr, "    NALU header position: %"PRIx64"    \n", hevc_imp->sc_head_pos + start_code_length );
+        fprintf( stderr, "    EBSP position: %"PRIx64"           \n", hevc_imp->sc_head_pos + start_code_length + nuh.length );
+        fprintf( stderr, "    EBSP length: %"PRIx64" (%"PRIu64") \n", nalu_length - nuh.length, nalu_length - nuh.length );
+        fprintf( stderr, "    trailing_zero_bytes: %"PRIx64"     \n", trailing_zero_bytes );
+        fprintf( stderr, "    Next start code position: %"PRIx64"\n", next_sc_head_pos );
 #endif
         /* Check if the end of sequence. Used for POC calculation. */
         info->eos |= info->prev_nalu_type == HEVC_NALU_TYPE_EOS
@@ -1165,7 +1283,7 @@ static int hevc_get_access_unit_internal
                                                             nalu        + nuh.length,
                                                             nalu_length - nuh.length )) < 0 )
                     return hevc_get_au_internal_failed( hevc_imp, au, complete_au, err );
-                if( probe && info->hvcC_pending )
+                if( info->hvcC_pending )
                 {
                     /* Copy and append a Codec Specific info. */
                     if( (err = hevc_store_codec_specific( hevc_imp, &info->hvcC_param )) < 0 )
@@ -1181,12 +1299,13 @@ static int hevc_get_access_unit_internal
                         /* The current NALU is the first VCL NALU of the primary coded picture of a new AU.
                          * Therefore, the previous slice belongs to the AU you want at this time. */
                         hevc_update_picture_info( info, picture, &prev_slice, &info->sps, &info->sei );
-                        complete_au = hevc_complete_au( au, probe );
+                        complete_au = hevc_complete_au( au );
                     }
                     else
                         hevc_update_picture_info_for_slice( info, picture, &prev_slice );
                 }
-                hevc_append_nalu_to_au( au, nalu, nalu_length, probe );
+                if( (err = hevc_append_nalu_to_au( hevc_imp, nalu_pos, nalu_length )) < 0 )
+                    return hevc_get_au_internal_failed( hevc_imp, au, complete_au, err );
                 slice->present = 1;
             }
             else
@@ -1195,7 +1314,7 @@ static int hevc_get_access_unit_internal
                 {
                     /* The last slice belongs to the AU you want at this time. */
                     hevc_update_picture_info( info, picture, slice, &info->sps, &info->sei );
-                    complete_au = hevc_complete_au( au, probe );
+                    complete_au = hevc_complete_au( au );
                 }
                 switch( nalu_type )
                 {
@@ -1205,7 +1324,8 @@ static int hevc_get_access_unit_internal
                         if( (err = hevc_parse_sei( info->bits, &info->vps, &info->sps, &info->sei, &nuh,
                                                    sb->rbsp, nalu + nuh.length, nalu_length - nuh.length )) < 0 )
                             return hevc_get_au_internal_failed( hevc_imp, au, complete_au, err );
-                        hevc_append_nalu_to_au( au, nalu, nalu_length, probe );
+                        if( (err = hevc_append_nalu_to_au( hevc_imp, nalu_pos, nalu_length )) < 0 )
+                            return hevc_get_au_internal_failed( hevc_imp, au, complete_au, err );
                         break;
                     }
                     case HEVC_NALU_TYPE_VPS :
@@ -1223,7 +1343,8 @@ static int hevc_get_access_unit_internal
                     case HEVC_NALU_TYPE_AUD :   /* We drop access unit delimiters. */
                         break;
                     default :
-                        hevc_append_nalu_to_au( au, nalu, nalu_length, probe );
+                        if( (err = hevc_append_nalu_to_au( hevc_imp, nalu_pos, nalu_length )) < 0 )
+                            return hevc_get_au_internal_failed( hevc_imp, au, complete_au, err );
                         break;
                 }
                 if( info->hvcC_pending )
@@ -1243,7 +1364,7 @@ static int hevc_get_access_unit_internal
         else if( au->incomplete_length && au->length == 0 )
         {
             hevc_update_picture_info( info, picture, slice, &info->sps, &info->sei );
-            hevc_complete_au( au, probe );
+            hevc_complete_au( au );
             return hevc_get_au_internal_succeeded( hevc_imp, au );
         }
         if( complete_au )
@@ -1273,23 +1394,18 @@ static int hevc_importer_get_accessunit( importer_t *importer, uint32_t track_nu
         return LSMASH_ERR_NAMELESS;
     if( current_status == IMPORTER_EOF )
         return IMPORTER_EOF;
-    int err = hevc_get_access_unit_internal( importer, 0 );
-    if( err < 0 )
-    {
-        importer->status = IMPORTER_ERROR;
-        return err;
-    }
-    hevc_importer_check_eof( importer, &info->au );
-    if( importer->status == IMPORTER_CHANGE && !info->hvcC_pending )
-        current_status = IMPORTER_CHANGE;
-    if( current_status == IMPORTER_CHANGE )
+    /* The whole stream has been analyzed by the probe, so just follow the access unit index here. */
+    hevc_access_unit_t *au       = &info->au;
+    hevc_au_index_t    *au_index = &hevc_imp->au_index[ au->number ];
+    if( au_index->change )
     {
         /* Update the active summary. */
-        lsmash_codec_specific_t *cs = (lsmash_codec_specific_t *)lsmash_list_get_entry_data( hevc_imp->hvcC_list, ++ hevc_imp->hvcC_number );
-        if( !cs )
+        lsmash_codec_specific_t *cs  = (lsmash_codec_specific_t *)lsmash_list_get_entry_data( hevc_imp->hvcC_list, ++ hevc_imp->hvcC_number );
+        hevc_sps_t              *sps = (hevc_sps_t *)lsmash_list_get_entry_data( hevc_imp->sps_list, hevc_imp->hvcC_number - 1 );
+        if( !cs || !sps )
             return LSMASH_ERR_NAMELESS;
         lsmash_hevc_specific_parameters_t *hvcC_param = (lsmash_hevc_specific_parameters_t *)cs->data.structured;
-        lsmash_video_summary_t *summary = hevc_create_summary( hvcC_param, &info->sps, hevc_imp->max_au_length );
+        lsmash_video_summary_t *summary = hevc_create_summary( hvcC_param, sps, hevc_imp->max_au_length );
         if( !summary )
             return LSMASH_ERR_NAMELESS;
         lsmash_list_remove_entry( importer->summaries, track_number );
@@ -1298,13 +1414,24 @@ static int hevc_importer_get_accessunit( importer_t *importer, uint32_t track_nu
             lsmash_cleanup_summary( (lsmash_summary_t *)summary );
             return LSMASH_ERR_MEMORY_ALLOC;
         }
-        importer->status = IMPORTER_OK;
+        current_status = IMPORTER_CHANGE;
     }
     lsmash_sample_t *sample = lsmash_create_sample( hevc_imp->max_au_length );
     if( !sample )
         return LSMASH_ERR_MEMORY_ALLOC;
+    int err = nalu_index_read_access_unit( &hevc_imp->nalu_index, importer->bs, sample->data, au_index->length );
+    if( err < 0 )
+    {
+        lsmash_delete_sample( sample );
+        importer->status = IMPORTER_ERROR;
+        return err;
+    }
     *p_sample = sample;
-    hevc_access_unit_t  *au      = &info->au;
+    au->picture    = au_index->picture;
+    au->length     = au_index->length;
+    au->TemporalId = au_index->TemporalId;
+    au->number    += 1;
+    importer->status = au->number < hevc_imp->ts_list.sample_count ? IMPORTER_OK : IMPORTER_EOF;
     hevc_picture_info_t *picture = &au->picture;
     sample->dts = hevc_imp->ts_list.timestamp[ au->number - 1 ].dts;
     sample->cts = hevc_imp->ts_list.timestamp[ au->number - 1 ].cts;
@@ -1355,7 +1482,6 @@ static int hevc_importer_get_accessunit( importer_t *importer, uint32_t track_nu
             sample->prop.ra_flags = ISOM_SAMPLE_RANDOM_ACCESS_FLAG_RAP;
     }
     sample->length = au->length;
-    memcpy( sample->data, au->data, au->length );
     return current_status;
 }
 
@@ -1405,6 +1531,9 @@ static int hevc_analyze_whole_stream
     hevc_info_t     *info     = &hevc_imp->info;
     importer->status = IMPORTER_OK;
     int err = LSMASH_ERR_MEMORY_ALLOC;
+    hevc_imp->au_index = (hevc_au_index_t *)lsmash_malloc( (1 << 12) * sizeof(hevc_au_index_t) );
+    if( !hevc_imp->au_index )
+        goto fail;
     while( importer->status != IMPORTER_EOF )
     {
 #if 0
@@ -1412,10 +1541,13 @@ static int hevc_analyze_whole_stream
 #endif
         hevc_picture_info_t     *picture = &info->au.picture;
         hevc_picture_info_t prev_picture = *picture;
-        if( (err = hevc_get_access_unit_internal( importer, 1 ))                 < 0
+        importer_status current_status = importer->status;
+        if( (err = hevc_get_access_unit_internal( importer ))                    < 0
          || (err = hevc_calculate_poc( info, &info->au.picture, &prev_picture )) < 0 )
             goto fail;
         hevc_importer_check_eof( importer, &info->au );
+        if( importer->status == IMPORTER_CHANGE && !info->hvcC_pending )
+            current_status = IMPORTER_CHANGE;
         if( npt_alloc <= num_access_units * sizeof(nal_pic_timing_t) )
         {
             uint32_t alloc = 2 * num_access_units * sizeof(nal_pic_timing_t);
@@ -1424,6 +1556,31 @@ static int hevc_analyze_whole_stream
                 goto fail;
             npt = temp;
             npt_alloc = alloc;
+            hevc_au_index_t *au_index = (hevc_au_index_t *)lsmash_realloc( hevc_imp->au_index,
+                                                                            (alloc / sizeof(nal_pic_timing_t)) * sizeof(hevc_au_index_t) );
+            if( !au_index )
+                goto fail;
+            hevc_imp->au_index = au_index;
+        }
+        /* Record what the delivery pass needs so that it doesn't have to parse the stream again. */
+        hevc_au_index_t *au_index = &hevc_imp->au_index[num_access_units];
+        au_index->picture    = *picture;
+        au_index->length     = info->au.length;
+        au_index->TemporalId = info->au.TemporalId;
+        au_index->change     = (current_status == IMPORTER_CHANGE);
+        if( au_index->change )
+        {
+            /* Keep the SPS active at the switch for the summary of the next hvcC. */
+            hevc_sps_t *sps = lsmash_memdup( &info->sps, sizeof(hevc_sps_t) );
+            if( !sps )
+                goto fail;
+            if( lsmash_list_add_entry( hevc_imp->sps_list, sps ) < 0 )
+            {
+                lsmash_free( sps );
+                goto fail;
+            }
+            if( importer->status == IMPORTER_CHANGE )
+                importer->status = IMPORTER_OK;
         }
         hevc_imp->field_pic_present |= picture->field_coded;
         npt[num_access_units].poc       = picture->poc;
@@ -1518,23 +1675,10 @@ static int hevc_importer_probe( importer_t *importer )
     hevc_imp->sc_head_pos = first_sc_head_pos;
     if( (err = hevc_analyze_whole_stream( importer )) < 0 )
         goto fail;
-    /* Go back to the start code of the first NALU. */
+    /* Rewind to the first access unit.
+     * The stream is not parsed any more since access units are read through the index. */
     importer->status = IMPORTER_OK;
-    lsmash_bs_read_seek( bs, first_sc_head_pos, SEEK_SET );
-    hevc_imp->sc_head_pos       = first_sc_head_pos;
-    info->prev_nalu_type        = HEVC_NALU_TYPE_UNKNOWN;
-    uint8_t *temp_au            = info->au.data;
-    uint8_t *temp_incomplete_au = info->au.incomplete_data;
-    memset( &info->au, 0, sizeof(hevc_access_unit_t) );
-    info->au.data            = temp_au;
-    info->au.incomplete_data = temp_incomplete_au;
-    memset( &info->slice, 0, sizeof(hevc_slice_info_t) );
-    memset( &info->vps,   0, sizeof(hevc_vps_t) );
-    memset( &info->sps,   0, sizeof(hevc_sps_t) );
-    memset( &info->pps,   0, SIZEOF_PPS_EXCLUDING_HEAP );
-    for( int i = 0; i < HEVC_DCR_NALU_TYPE_NUM; i++ )
-        lsmash_list_remove_entries( info->hvcC_param.parameter_arrays->ps_array[i].list );
-    lsmash_destroy_hevc_parameter_arrays( &info->hvcC_param_next );
+    info->au.number  = 0;
     return 0;
 fail:
     remove_hevc_importer( hevc_imp );
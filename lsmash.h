@@ -47,8 +47,8 @@ extern "C" {
  * Version
  ****************************************************************************/
 #define LSMASH_VERSION_MAJOR  2
-#define LSMASH_VERSION_MINOR 16
-#define LSMASH_VERSION_MICRO  1
+#define LSMASH_VERSION_MINOR 17
+#define LSMASH_VERSION_MICRO  0
 
 #define LSMASH_VERSION_INT( a, b, c ) (((a) << 16) | ((b) << 8) | (c))
 
@@ -255,6 +255,62 @@ typedef struct
     uint64_t max_chunk_size;            /* max size per chunk in bytes. 4*1024*1024 (4MiB) is default value. */
     /** demuxing only **/
     uint64_t max_read_size;             /* max size of reading from the file at a time. 4*1024*1024 (4MiB) is default value. */
+    uint64_t max_timeline_memory;       /* max size of memory in bytes for sample info of each track timeline.
+                                         * Sample info beyond this size is spilled out into a temporary file.
+                                         * 0 means no limit and is default value. */
+    /** muxing only **/
+    uint64_t expected_output_size;      /* expected size of the output file in bytes. 0, i.e. unknown, is default value.
+                                         * If this is greater than UINT32_MAX, 64-bit chunk offsets are used from the beginning
+                                         * instead of converting 32-bit ones into them when any chunk offset exceeds 32-bit.
+                                         * The same is applied if the reserved size of the media data is greater than UINT32_MAX. */
+    uint64_t max_fragment_size;         /* max size of media data per movie fragment in bytes. 0 means no limit and is default value.
+                                         * If appending a sync sample makes the media data of the current movie fragment exceed
+                                         * this, the movie fragment is finished and written before the sample, and then a new
+                                         * movie fragment is started automatically. This bounds the amount of sample data held in
+                                         * memory by this plus the samples up to the next sync sample.
+                                         * Since the duration of the last sample in each track fragment is decided by the next
+                                         * sample of the track, or by lsmash_flush_pooled_samples(), the samples appended after the
+                                         * split point are held until the next sample of every track in the finished movie
+                                         * fragment comes. So a sparse track can make the library hold many samples. Use
+                                         * max_fragment_memory instead if this is not acceptable. */
+    uint64_t max_fragment_memory;       /* max size of memory in bytes for media data pooled per movie fragment.
+                                         * 0 means no limit and is default value.
+                                         * Since the Movie Fragment Box precedes the media data, all sample data of a movie
+                                         * fragment is held until the fragment is finished. Track runs whose data exceeds this
+                                         * limit are spilled out into a temporary file, and copied back into the Media Data Box
+                                         * when the movie fragment is written, inside the kernel if possible.
+                                         * The data of the track run being appended in each track is not spilled out. */
+    uint32_t reserved_subsegment_count; /* the number of subsegments per track for which the space of the Segment Index Boxes is
+                                         * reserved in front of the first Movie Fragment Box of an indexed media segment.
+                                         * 0 means no reservation and is default value.
+                                         * The reserved space is filled with a Free Space Box. If the Segment Index Boxes fit in it
+                                         * when finishing the segment, they are written there in place and the rest of the space
+                                         * is left as a Free Space Box, so that no rearrangement of the segment is required.
+                                         * Otherwise, the Segment Index Boxes are inserted after the reserved space. */
+    uint32_t subsegments_per_index;     /* the max number of subsegments referenced by each lower-level Segment Index Box of
+                                         * an indexed media segment. 0 means a flat index and is default value.
+                                         * If the segment has more subsegments than this, a two-level hierarchical index is
+                                         * constructed: each top-level Segment Index Box references lower-level ones of the
+                                         * same track, each of which is placed in front of the subsegments it references.
+                                         * This keeps the top-level index small for long segments. A flat index is constructed
+                                         * instead if the tracks are not indexed by the same subsegments.
+                                         * The space reserved by reserved_subsegment_count is left as it is for a hierarchical
+                                         * index. */
+    uint32_t mfra_checkpoint_interval;  /* the number of movie fragments per checkpoint of the Movie Fragment Random Access Box.
+                                         * 0 means the box is written only when finishing the movie and is default value.
+                                         * Otherwise, every time this number of movie fragments are written, the random access
+                                         * info so far is written after them, so that readers can seek in the file being
+                                         * recorded or left incomplete. Each checkpoint is complete, and the next movie fragment
+                                         * is written over it, so the file holds one box at most and no dead space. Hence, the
+                                         * file is indexed only while it ends with a checkpoint.
+                                         * The presentation times of sync samples are settled at each checkpoint, so that
+                                         * finishing needs to handle only sync samples after the last checkpoint. The edit list
+                                         * shall be set before the first checkpoint.
+                                         * This is available only if the Movie Fragment Random Access Box is written. */
+    uint8_t  compact_movie_fragment;    /* 1: Minimize the size of each Movie Fragment Box. 0 is default value.
+                                         * The default values in each Track Fragment Header Box and the fields present in each
+                                         * Track Fragment Run Box are chosen to make the track fragment smallest, and a track
+                                         * run is split into multiple ones if doing so reduces the size. */
 } lsmash_file_parameters_t;
 
 typedef int (*lsmash_adhoc_remux_callback)( void *param, uint64_t done, uint64_t total );
@@ -1628,6 +1684,106 @@ int lsmash_append_sample
     lsmash_sample_t *sample
 );
 
+/* Append samples to a track at a time.
+ * 'samples' is an array of 'sample_count' samples. Their 'data' are expected to point into a payload buffer where
+ * the data of consecutive samples are placed contiguously, and then the payload of consecutive samples put into
+ * the same chunk is copied at once. Samples of which data are not contiguous are also accepted.
+ * Samples of LPCM audio and hint tracks, and samples appended into movie fragments are copied one by one.
+ * Note:
+ *   Unlike lsmash_append_sample(), neither the array nor the payload is deallocated internally.
+ *   Users can reuse or deallocate them after this function returns.
+ *   If this function fails partway, the samples preceding the failed one remain appended together with their data,
+ *   and the failed one and the following ones are not appended, though the sample tables may already have an entry
+ *   of the failed one as with a failure of lsmash_append_sample(). So the track is not expected to be appended any more.
+ *
+ * Return 0 if successful.
+ * Return a negative value otherwise. */
+int lsmash_append_samples
+(
+    lsmash_root_t   *root,
+    uint32_t         track_ID,
+    lsmash_sample_t *samples,
+    uint32_t         sample_count
+);
+
+/* Append all samples in the media timelines of source tracks to destination tracks of a non-fragmented movie
+ * without reading each sample, e.g. for defragmenting a fragmented movie.
+ * Physically consecutive samples sharing a sample description, such as the samples of a track fragment run,
+ * are put into a chunk, and the media data of consecutive chunks over all tracks is copied from the source file
+ * at once in the same order as the source file.
+ * The 'i'-th destination track given by 'dst_track_IDs' gets the samples of the 'i'-th source track given by 'src_track_IDs'.
+ * Timestamps and sample description indexes of the samples are not changed, so each destination track shall have
+ * the same sample descriptions as the source track in the same order.
+ * The media timelines of the source tracks shall be constructed in advance.
+ * Note:
+ *   Media data referenced by external data references and samples of hint tracks are not supported.
+ *   Call lsmash_flush_pooled_samples() for each destination track after this function to set the last sample delta.
+ *
+ * Return 0 if successful.
+ * Return LSMASH_ERR_PATCH_WELCOME if any track is not supported, and then nothing is appended.
+ * Return a negative value otherwise. */
+int lsmash_append_samples_from_media_timelines
+(
+    lsmash_root_t  *dst,
+    const uint32_t *dst_track_IDs,
+    lsmash_root_t  *src,
+    const uint32_t *src_track_IDs,
+    uint32_t        track_count
+);
+
+/* Append a sample to a track of a fragmented movie by referring to its media data in a source file
+ * instead of holding a copy of the data, e.g. for re-segmenting a fragmented movie without reading each sample.
+ * The data of 'sample->length' bytes at 'sample->pos' in the source file is copied into the Media Data Box
+ * in large blocks when the movie fragment is written, so the source file shall be kept open until then.
+ * 'sample->data' is ignored and can be NULL. Such a sample can be given by lsmash_get_sample_info_from_media_timeline().
+ * The source file shall be opened in the read mode and seekable.
+ * Note:
+ *   Like lsmash_append_sample(), the sample is deallocated internally if successful.
+ *   Samples of hint tracks and LPCM audio samples which need to be split into audio frames are not supported.
+ *   Samples appended by this function and by lsmash_append_sample() cannot be mixed in a track fragment run.
+ *
+ * Return 0 if successful.
+ * Return a negative value otherwise. */
+int lsmash_append_sample_by_reference
+(
+    lsmash_root_t   *root,
+    uint32_t         track_ID,
+    lsmash_sample_t *sample,
+    lsmash_file_t   *src
+);
+
+/* Queue a sample of a track into the interleaver and append queued samples of all tracks in decoding time order.
+ * Samples can be given from any track in any order as long as samples in each track are given in decoding order.
+ * A queued sample is appended by lsmash_append_sample() once samples of all tracks are queued, or once its decoding time
+ * gets older than the newest queued one by more than the maximum asynchronization tolerance in the file parameters.
+ * Therefore, the memory footprint of queued samples is bounded by the tolerance.
+ * Users shall not mix this function with lsmash_append_sample() for the same track.
+ * Chunks are decided over all tracks: once a sample is later than the oldest cached chunk by more than the maximum chunk
+ * duration, the cached chunks of all tracks are fixed at once and written in decoding time order.
+ * Note:
+ *   The given sample is always owned by the library even if this function fails.
+ *   It will be deleted by lsmash_delete_sample() internally, so users shall not deallocate it after calling this function.
+ *
+ * Return 0 if successful.
+ * Return a negative value otherwise. */
+int lsmash_interleave_sample
+(
+    lsmash_root_t   *root,
+    uint32_t         track_ID,
+    lsmash_sample_t *sample
+);
+
+/* Append all samples queued in the interleaver in decoding time order.
+ * Users shall call this function before calling lsmash_create_fragment_movie() if the interleaver is used.
+ * lsmash_flush_pooled_samples() calls this function internally.
+ *
+ * Return 0 if successful.
+ * Return a negative value otherwise. */
+int lsmash_flush_interleaved_samples
+(
+    lsmash_root_t *root
+);
+
 /****************************************************************************
  * Media Layer
  ****************************************************************************/
@@ -2319,6 +2475,21 @@ int lsmash_reserve_media_data_size
     uint64_t       media_data_size
 );
 
+/* Reserve the space for the Movie Box and a Meta Box in front of the media data region of a non-fragmented movie.
+ * The reserved space is filled with a Free Space Box. If the Movie Box and the Meta Box fit in the reserved space when
+ * finishing the movie, they are written there in place and the rest of the space is left as a Free Space Box, so that
+ * no rearrangement of the media data is required. Otherwise, the reserved space is left as it is and the movie is
+ * finished as if no space was reserved. Note that the specified size includes the type and the size fields of the
+ * Free Space Box, must be at least 8 and this function must be called before any lsmash_append_sample().
+ *
+ * Return 0 if successful.
+ * Return a negative value otherwise. */
+int lsmash_reserve_movie_size
+(
+    lsmash_root_t *root,
+    uint64_t       movie_size
+);
+
 /****************************************************************************
  * Chapter list
  ****************************************************************************/
@@ -2383,6 +2554,19 @@ int lsmash_create_fragment_movie
     lsmash_root_t *root
 );
 
+/* Flush the current movie fragment as a chunk and create a new movie fragment continuing the same subsegment.
+ * This is intended for low-latency delivery such as CMAF chunks: a movie fragment is written as multiple pairs of
+ * a Movie Fragment Box and a Media Data Box, while the Segment Index Box still references each subsegment as a whole.
+ * The current subsegment is closed when lsmash_create_fragment_movie() is called or the media segment is finished.
+ * Users shall call lsmash_flush_pooled_samples() for each track before calling this function.
+ *
+ * Return 0 if successful.
+ * Return a negative value otherwise. */
+int lsmash_create_fragment_chunk
+(
+    lsmash_root_t *root
+);
+
 /* Create an empty duration track in the current movie fragment.
  * Don't specify track_ID any track fragment in the current movie fragment has.
  *
@@ -2395,6 +2579,39 @@ int lsmash_create_fragment_empty_duration
     uint32_t       duration
 );
 
+/* Set the sequence number of the next movie fragment in the current file.
+ * The following movie fragments are numbered in increasing order from it.
+ *
+ * Together with lsmash_set_segment_presentation_time(), this enables users to generate each media segment
+ * independently of the preceding ones, e.g. concurrently by separate ROOTs for VOD packaging. In that case, each ROOT
+ * shall have an initialization segment set up with the same tracks, which may be written into a dummy stream, and
+ * switch to its own media segment file; then set the state the preceding media segments would have left by these
+ * functions before appending any sample. The Track Fragment Decode Time Boxes are derived from the DTS of appended
+ * samples, so samples shall be appended with their timestamps in the whole presentation.
+ * Don't call this function after any sample is appended into the current movie fragment.
+ *
+ * Return 0 if successful.
+ * Return a negative value otherwise. */
+int lsmash_set_fragment_sequence_number
+(
+    lsmash_root_t *root,
+    uint32_t       sequence_number
+);
+
+/* Set the presentation time, on the media timescale, where the next subsegment of a track starts.
+ * This is the sum of the subsegment_durations of the preceding subsegments in the Segment Index Boxes for the track,
+ * and used to index subsegments under explicit timeline maps.
+ * Don't call this function after any sample is appended into the current subsegment.
+ *
+ * Return 0 if successful.
+ * Return a negative value otherwise. */
+int lsmash_set_segment_presentation_time
+(
+    lsmash_root_t *root,
+    uint32_t       track_ID,
+    uint64_t       presentation_time
+);
+
 /****************************************************************************
  * Dump / Print
  ****************************************************************************/
@@ -2451,6 +2668,52 @@ void lsmash_destruct_timeline
     uint32_t       track_ID
 );
 
+/* Write all constructed timelines into a timeline cache file.
+ * The cache is tied to the size and the last modification time of the media file the timelines were constructed from.
+ *
+ * Return 0 if successful.
+ * Return a negative value otherwise. */
+int lsmash_write_timeline_cache
+(
+    lsmash_root_t *root,
+    const char    *cache_filename,
+    const char    *media_filename
+);
+
+/* Load the timelines from a timeline cache file written by lsmash_write_timeline_cache() instead of constructing them.
+ * The cache is rejected if the size or the last modification time of the media file doesn't match,
+ * or if any cached track doesn't match the track in the file read by lsmash_read_file() in its timescales or its number
+ * of samples listed in the sample table and the track fragment runs.
+ * The loaded timeline is dealt with as constructed one, i.e. lsmash_construct_timeline() does nothing for its track.
+ *
+ * Return 0 if successful.
+ * Return a negative value otherwise. */
+int lsmash_read_timeline_cache
+(
+    lsmash_root_t *root,
+    const char    *cache_filename,
+    const char    *media_filename
+);
+
+/* Append a sample to the media timeline for a track in a file that is still being written.
+ * This is useful to follow a growing non-fragmented file without re-opening it, e.g. when the sample info is delivered
+ * by a side channel while the media data is appended to the placeholder of the Media Data Box.
+ * The timeline is created if not present yet.
+ * The sample data must be placed at 'sample->pos' in the file and its size is 'sample->length'.
+ * 'sample->dts' must be greater than the DTS of the last sample in the timeline and becomes the end of the duration of it.
+ * Until the next sample is appended, the duration of the appended sample is the same as the previous one.
+ * 'sample->data' is not used.
+ * Appending samples to the timeline of LPCM audio track constructed from the file is not supported.
+ *
+ * Return 0 if successful.
+ * Return a negative value otherwise. */
+int lsmash_append_sample_to_media_timeline
+(
+    lsmash_root_t   *root,
+    uint32_t         track_ID,
+    lsmash_sample_t *sample
+);
+
 /* Get the duration of the last sample from the media timeline for a track.
  *
  * Return 0 if successful.